@@ -0,0 +1,259 @@
+// Include all headers for any enabled TCPIP Stack functions
+#include "tcpip/src/tcpip_private.h"
+#include "JsonWriter.h"
+
+#define JSON_NUMBER_LEN     24  // longest formatted number: "-4294967295.000000" or "-3.402823e+38"
+#define JSON_ESCAPE_LEN     8   // longest escape sequence: "\u001f"
+
+static const uint32_t jsonPow10[] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+
+// writes document bytes; the bytes sent by a previous call are skipped
+static void _JSON_Put( TCPIP_JSON_WRITER* pWriter, const char* data, uint16_t len ) {
+    uint16_t n;
+
+    if ( ( pWriter->flags & JSON_FLAG_FULL ) != 0 || pWriter->overDepth != 0 ) return;
+
+    if ( pWriter->outCount < pWriter->skip ) {
+        n = ( pWriter->skip - pWriter->outCount < len ) ? ( uint16_t )( pWriter->skip - pWriter->outCount ) : len;
+        pWriter->outCount += n;
+        data += n;
+        len -= n;
+        if ( len == 0 ) return;
+    }
+
+    if ( pWriter->connHandle != 0 ) {
+        n = TCPIP_HTTP_DynamicWrite( pWriter->connHandle, data, len );
+    } else {
+        n = ( pWriter->buffSize - pWriter->buffLen < len ) ? pWriter->buffSize - pWriter->buffLen : len;
+        memcpy( pWriter->buff + pWriter->buffLen, data, n );
+        pWriter->buffLen += n;
+    }
+
+    pWriter->outCount += n;
+    if ( n != len ) pWriter->flags |= JSON_FLAG_FULL;
+}
+
+// writes the comma separating the items of a container, if needed
+static void _JSON_ItemStart( TCPIP_JSON_WRITER* pWriter ) {
+    uint16_t levelMask = 1 << pWriter->depth;
+
+    if ( pWriter->overDepth != 0 ) return;
+
+    if ( ( pWriter->flags & JSON_FLAG_KEY ) != 0 ) {
+        // the value of a member; the comma went before the key
+        pWriter->flags &= ~JSON_FLAG_KEY;
+        return;
+    }
+
+    if ( ( pWriter->hasItems & levelMask ) != 0 ) _JSON_Put( pWriter, ",", 1 );
+    pWriter->hasItems |= levelMask;
+}
+
+static void _JSON_Begin( TCPIP_JSON_WRITER* pWriter, const char* bracket ) {
+    if ( pWriter->overDepth != 0 || pWriter->depth == JSON_MAX_DEPTH - 1 ) {
+        // too deep: a null in its place, its contents dropped up to the matching end
+        if ( pWriter->overDepth == 0 ) {
+            _JSON_ItemStart( pWriter );
+            _JSON_Put( pWriter, "null", 4 );
+        }
+        pWriter->overDepth++;
+        pWriter->flags |= JSON_FLAG_ERROR;
+        return;
+    }
+    _JSON_ItemStart( pWriter );
+    _JSON_Put( pWriter, bracket, 1 );
+    pWriter->depth++;
+    pWriter->hasItems &= ~( 1 << pWriter->depth );
+}
+
+static void _JSON_End( TCPIP_JSON_WRITER* pWriter, const char* bracket ) {
+    if ( pWriter->overDepth != 0 ) {
+        // the end of a dropped container
+        pWriter->overDepth--;
+        return;
+    }
+    if ( pWriter->depth == 0 ) {
+        pWriter->flags |= JSON_FLAG_ERROR;
+        return;
+    }
+    pWriter->depth--;
+    _JSON_Put( pWriter, bracket, 1 );
+}
+
+// formats an unsigned value backwards, ending at pEnd; returns the first digit
+static char* _JSON_UintFormat( uint32_t value, char* pEnd ) {
+    do {
+        *--pEnd = '0' + value % 10;
+        value /= 10;
+    } while ( value != 0 );
+
+    return pEnd;
+}
+
+// writes a string between quotes, escaping the quote, the backslash and the control characters
+static void _JSON_StringPut( TCPIP_JSON_WRITER* pWriter, const char* str ) {
+    char escBuff[JSON_ESCAPE_LEN];
+    const char* pRun;
+    uint16_t len;
+    uint8_t c;
+
+    _JSON_Put( pWriter, "\"", 1 );
+    while ( *str != '\0' && ( pWriter->flags & JSON_FLAG_FULL ) == 0 ) {
+        // the characters that need no escaping are written as they are
+        for ( pRun = str; ( c = ( uint8_t )*str ) >= 0x20 && c != '"' && c != '\\'; str++ );
+        if ( str != pRun ) {
+            _JSON_Put( pWriter, pRun, ( uint16_t )( str - pRun ) );
+            continue;
+        }
+
+        escBuff[0] = '\\';
+        len = 2;
+        switch ( c ) {
+            case '"':  escBuff[1] = '"'; break;
+            case '\\': escBuff[1] = '\\'; break;
+            case '\n': escBuff[1] = 'n'; break;
+            case '\r': escBuff[1] = 'r'; break;
+            case '\t': escBuff[1] = 't'; break;
+            case '\b': escBuff[1] = 'b'; break;
+            case '\f': escBuff[1] = 'f'; break;
+            default:
+                sprintf( escBuff + 1, "u%04x", c );
+                len = 6;
+                break;
+        }
+        _JSON_Put( pWriter, escBuff, len );
+        str++;
+    }
+    _JSON_Put( pWriter, "\"", 1 );
+}
+
+void TCPIP_JSON_HttpWriterInit( TCPIP_JSON_WRITER* pWriter, HTTP_CONN_HANDLE connHandle, uint32_t resumePos ) {
+    memset( pWriter, 0, sizeof (*pWriter ) );
+    pWriter->connHandle = connHandle;
+    // the resume position is 1 + the bytes already sent, 0 for the first call
+    pWriter->skip = resumePos != 0 ? resumePos - 1 : 0;
+}
+
+void TCPIP_JSON_BufferWriterInit( TCPIP_JSON_WRITER* pWriter, uint8_t* buff, uint16_t buffSize ) {
+    memset( pWriter, 0, sizeof (*pWriter ) );
+    pWriter->buff = buff;
+    pWriter->buffSize = buffSize;
+}
+
+void TCPIP_JSON_ObjectBegin( TCPIP_JSON_WRITER* pWriter ) {
+    _JSON_Begin( pWriter, "{" );
+}
+
+void TCPIP_JSON_ObjectEnd( TCPIP_JSON_WRITER* pWriter ) {
+    _JSON_End( pWriter, "}" );
+}
+
+void TCPIP_JSON_ArrayBegin( TCPIP_JSON_WRITER* pWriter ) {
+    _JSON_Begin( pWriter, "[" );
+}
+
+void TCPIP_JSON_ArrayEnd( TCPIP_JSON_WRITER* pWriter ) {
+    _JSON_End( pWriter, "]" );
+}
+
+void TCPIP_JSON_Key( TCPIP_JSON_WRITER* pWriter, const char* key ) {
+    _JSON_ItemStart( pWriter );
+    _JSON_StringPut( pWriter, key );
+    _JSON_Put( pWriter, ":", 1 );
+    if ( pWriter->overDepth == 0 ) pWriter->flags |= JSON_FLAG_KEY;
+}
+
+void TCPIP_JSON_String( TCPIP_JSON_WRITER* pWriter, const char* str ) {
+    _JSON_ItemStart( pWriter );
+    _JSON_StringPut( pWriter, str );
+}
+
+void TCPIP_JSON_Int( TCPIP_JSON_WRITER* pWriter, int32_t value ) {
+    char numBuff[JSON_NUMBER_LEN];
+    char* pNum;
+
+    _JSON_ItemStart( pWriter );
+    pNum = _JSON_UintFormat( value < 0 ? -( uint32_t )value : ( uint32_t )value, numBuff + sizeof (numBuff ) );
+    if ( value < 0 ) *--pNum = '-';
+    _JSON_Put( pWriter, pNum, ( uint16_t )( numBuff + sizeof (numBuff ) - pNum ) );
+}
+
+void TCPIP_JSON_Uint( TCPIP_JSON_WRITER* pWriter, uint32_t value ) {
+    char numBuff[JSON_NUMBER_LEN];
+    char* pNum;
+
+    _JSON_ItemStart( pWriter );
+    pNum = _JSON_UintFormat( value, numBuff + sizeof (numBuff ) );
+    _JSON_Put( pWriter, pNum, ( uint16_t )( numBuff + sizeof (numBuff ) - pNum ) );
+}
+
+void TCPIP_JSON_Float( TCPIP_JSON_WRITER* pWriter, float value, uint8_t decimals ) {
+    char numBuff[JSON_NUMBER_LEN];
+    char* pEnd = numBuff + sizeof (numBuff );
+    char* pNum;
+    float absValue, scaled;
+    uint32_t intPart, fracPart;
+    int ix;
+
+    if ( value != value || value > 3.402823e38f || value < -3.402823e38f ) {
+        TCPIP_JSON_Null( pWriter );
+        return;
+    }
+
+    _JSON_ItemStart( pWriter );
+    if ( decimals > 6 ) decimals = 6;
+    absValue = value < 0 ? -value : value;
+
+    scaled = absValue * jsonPow10[decimals] + 0.5f;
+    if ( scaled >= 4294967295.0f ) {
+        // too large for the fixed notation
+        ix = sprintf( numBuff, "%.*e", decimals, ( double )value );
+        _JSON_Put( pWriter, numBuff, ( uint16_t )ix );
+        return;
+    }
+
+    // rounded to the requested decimals, then split
+    fracPart = ( uint32_t )scaled;
+    intPart = fracPart / jsonPow10[decimals];
+    fracPart %= jsonPow10[decimals];
+
+    pNum = pEnd;
+    if ( decimals != 0 ) {
+        for ( ix = 0; ix < decimals; ix++ ) {
+            *--pNum = '0' + fracPart % 10;
+            fracPart /= 10;
+        }
+        *--pNum = '.';
+    }
+    pNum = _JSON_UintFormat( intPart, pNum );
+    if ( value < 0 && scaled >= 1.0f ) *--pNum = '-';
+    _JSON_Put( pWriter, pNum, ( uint16_t )( pEnd - pNum ) );
+}
+
+void TCPIP_JSON_Bool( TCPIP_JSON_WRITER* pWriter, bool value ) {
+    _JSON_ItemStart( pWriter );
+    if ( value ) _JSON_Put( pWriter, "true", 4 );
+    else _JSON_Put( pWriter, "false", 5 );
+}
+
+void TCPIP_JSON_Null( TCPIP_JSON_WRITER* pWriter ) {
+    _JSON_ItemStart( pWriter );
+    _JSON_Put( pWriter, "null", 4 );
+}
+
+bool TCPIP_JSON_IsComplete( TCPIP_JSON_WRITER* pWriter ) {
+    return ( pWriter->flags & JSON_FLAG_FULL ) == 0;
+}
+
+bool TCPIP_JSON_IsValid( TCPIP_JSON_WRITER* pWriter ) {
+    return ( pWriter->flags & JSON_FLAG_ERROR ) == 0 && pWriter->depth == 0 && pWriter->overDepth == 0;
+}
+
+uint32_t TCPIP_JSON_PositionGet( TCPIP_JSON_WRITER* pWriter ) {
+    // never 0, which would end the callback
+    return pWriter->outCount + 1;
+}
+
+uint16_t TCPIP_JSON_LengthGet( TCPIP_JSON_WRITER* pWriter ) {
+    return pWriter->buffLen;
+}
@@ -0,0 +1,155 @@
+#ifndef __JSONWRITER_H
+#define __JSONWRITER_H
+
+#include "tcpip/tcpip.h"
+
+// Deepest object/array nesting supported by the writer
+#define JSON_MAX_DEPTH  16
+
+// Writer state flags
+typedef enum {
+    JSON_FLAG_NONE      = 0x00,
+    JSON_FLAG_FULL      = 0x01, // the output did not fit; the rest of the document is dropped
+    JSON_FLAG_KEY       = 0x02, // a key was written, its value comes next
+    JSON_FLAG_ERROR     = 0x04, // nesting too deep or unbalanced
+} JSON_FLAGS;
+
+// JSON writer; to be initialized with TCPIP_JSON_HttpWriterInit() or TCPIP_JSON_BufferWriterInit()
+typedef struct {
+    HTTP_CONN_HANDLE connHandle;    // HTTP connection written to; 0 when writing to buff
+    uint8_t*    buff;               // buffer written to
+    uint16_t    buffSize;           // size of buff
+    uint16_t    buffLen;            // bytes written to buff
+    uint32_t    skip;               // bytes of the document already sent by a previous call
+    uint32_t    outCount;           // bytes of the document produced so far, skipped ones included
+    uint16_t    hasItems;           // per nesting level: the container has items, a comma goes before the next one
+    uint8_t     depth;              // current nesting level
+    uint8_t     overDepth;          // containers open beyond JSON_MAX_DEPTH; their contents are dropped
+    uint8_t     flags;              // JSON_FLAGS value
+} TCPIP_JSON_WRITER;
+
+/*****************************************************************************
+ Function:
+ void TCPIP_JSON_HttpWriterInit(TCPIP_JSON_WRITER* pWriter, HTTP_CONN_HANDLE connHandle, uint32_t resumePos)
+
+ Description:
+ Initializes a writer that streams a JSON document to the response of an
+ HTTP connection, using TCPIP_HTTP_DynamicWrite().
+
+ Precondition:
+ Called from a dynamic variable callback.
+
+ Parameters:
+ pWriter    - the writer
+ connHandle - HTTP connection handle
+ resumePos  - bytes already sent by a previous call of the callback:
+              the value returned by TCPIP_JSON_PositionGet() then,
+              0 for the first call
+
+ Return Values:
+ None
+
+ Remarks:
+ When the socket fills up, the writer drops the rest of the document.
+ The callback saves TCPIP_JSON_PositionGet() as its callback position and,
+ when called again, generates the same document from the start;
+ the bytes already sent are skipped:
+
+ <code>
+ void TCPIP_HTTP_Print_status(HTTP_CONN_HANDLE connHandle)
+ {
+     TCPIP_JSON_WRITER json;
+
+     TCPIP_JSON_HttpWriterInit(&json, connHandle, TCPIP_HTTP_CurrentConnectionCallbackPosGet(connHandle));
+     TCPIP_JSON_ObjectBegin(&json);
+     TCPIP_JSON_Key(&json, "uptime");
+     TCPIP_JSON_Uint(&json, uptime);
+     TCPIP_JSON_ObjectEnd(&json);
+     TCPIP_HTTP_CurrentConnectionCallbackPosSet(connHandle, TCPIP_JSON_IsComplete(&json) ? 0 : TCPIP_JSON_PositionGet(&json));
+ }
+ </code>
+ ***************************************************************************/
+void TCPIP_JSON_HttpWriterInit(TCPIP_JSON_WRITER* pWriter, HTTP_CONN_HANDLE connHandle, uint32_t resumePos);
+
+/*****************************************************************************
+ Function:
+ void TCPIP_JSON_BufferWriterInit(TCPIP_JSON_WRITER* pWriter, uint8_t* buff, uint16_t buffSize)
+
+ Description:
+ Initializes a writer that formats a JSON document into a buffer,
+ e.g. pHttpCon->data for a TCPIP_WS_SendPayload() text frame.
+
+ Precondition:
+ None
+
+ Parameters:
+ pWriter  - the writer
+ buff     - buffer to write to
+ buffSize - size of buff
+
+ Return Values:
+ None
+
+ Remarks:
+ The document length is returned by TCPIP_JSON_LengthGet().
+ The document is not null terminated.
+ ***************************************************************************/
+void TCPIP_JSON_BufferWriterInit(TCPIP_JSON_WRITER* pWriter, uint8_t* buff, uint16_t buffSize);
+
+// Starts/ends an object or an array
+void TCPIP_JSON_ObjectBegin(TCPIP_JSON_WRITER* pWriter);
+void TCPIP_JSON_ObjectEnd(TCPIP_JSON_WRITER* pWriter);
+void TCPIP_JSON_ArrayBegin(TCPIP_JSON_WRITER* pWriter);
+void TCPIP_JSON_ArrayEnd(TCPIP_JSON_WRITER* pWriter);
+
+// Writes the key of the next object member
+void TCPIP_JSON_Key(TCPIP_JSON_WRITER* pWriter, const char* key);
+
+// Writes a value; strings are escaped as needed
+void TCPIP_JSON_String(TCPIP_JSON_WRITER* pWriter, const char* str);
+void TCPIP_JSON_Int(TCPIP_JSON_WRITER* pWriter, int32_t value);
+void TCPIP_JSON_Uint(TCPIP_JSON_WRITER* pWriter, uint32_t value);
+void TCPIP_JSON_Bool(TCPIP_JSON_WRITER* pWriter, bool value);
+void TCPIP_JSON_Null(TCPIP_JSON_WRITER* pWriter);
+
+/*****************************************************************************
+ Function:
+ void TCPIP_JSON_Float(TCPIP_JSON_WRITER* pWriter, float value, uint8_t decimals)
+
+ Description:
+ Writes a number with a fixed number of decimals, rounded.
+
+ Precondition:
+ None
+
+ Parameters:
+ pWriter  - the writer
+ value    - the number
+ decimals - number of decimals, 0 to 6
+
+ Return Values:
+ None
+
+ Remarks:
+ NaN and infinite values have no JSON representation and are written as null.
+ Values too large for the fixed notation use the exponent notation.
+ ***************************************************************************/
+void TCPIP_JSON_Float(TCPIP_JSON_WRITER* pWriter, float value, uint8_t decimals);
+
+// Returns true if the whole document was written
+bool TCPIP_JSON_IsComplete(TCPIP_JSON_WRITER* pWriter);
+
+// Returns true if the finished document is well formed: every object/array closed
+// and none nested deeper than JSON_MAX_DEPTH - 1.
+// A container nested too deep is written as null and everything up to its end is dropped;
+// an extra end is not written.
+bool TCPIP_JSON_IsValid(TCPIP_JSON_WRITER* pWriter);
+
+// Returns the resume position of the next call: 1 + the number of document bytes sent so far.
+// It is never 0, so it can be saved as the callback position even if nothing was sent yet.
+uint32_t TCPIP_JSON_PositionGet(TCPIP_JSON_WRITER* pWriter);
+
+// Returns the number of bytes written to the buffer of a buffer writer
+uint16_t TCPIP_JSON_LengthGet(TCPIP_JSON_WRITER* pWriter);
+
+#endif
@@ -44,8 +44,47 @@ SUBSTITUTE GOODS, TECHNOLOGY, SERVICES, OR ANY CLAIMS BY THIRD PARTIES
 
 
 
-#define HTTP_SEND_DATABUF_SIZE      256
-#define HTTP_INC_DATABUF_SIZE       256
+#define HTTP_FILE_BUFF_SIZE_DEFAULT 256     // file read buffer size if not set in TCPIP_HTTP_MODULE_CONFIG
+#define HTTP_FILE_BUFF_SIZE_MIN     64      // minimum file read buffer size
+
+#define HTTP_CHUNK_BUFFER_SIZE      128     // per connection buffer used to coalesce small chunks
+#define HTTP_CHUNK_OVERHEAD         8       // max chunk framing: 4 hex digits + CRLF + trailing CRLF
+#define HTTP_KEEP_ALIVE_TMO         5       // seconds an idle persistent connection is kept open
+#define HTTP_ETAG_LEN               24      // formatted entity tag: quoted size and time stamp
+#define HTTP_DATE_LEN               32      // formatted HTTP date: "Sun, 06 Nov 1994 08:49:37 GMT"
+#define HTTP_VALIDATORS_LEN         (HTTP_ETAG_LEN + HTTP_DATE_LEN + 32)    // formatted ETag and Last-Modified header lines
+#define HTTP_STATIC_HDR_LEN         (HTTP_VALIDATORS_LEN + 256)             // formatted header block of a static file
+#define HTTP_MIN_HEADER_LEN         18      // longest request header name that's parsed: "If-Modified-Since:"
+#define HTTP_RANGE_HDR_LEN          80      // longest Range header value that's parsed
+#define HTTP_RANGE_PART_HDR_LEN     160     // multipart/byteranges part header
+#define HTTP_RANGE_BOUNDARY         "7b1d3f5a9c2e4086"  // multipart/byteranges separator
+#define HTTP_ACCEPT_ENC_LEN         64      // longest Accept-Encoding header value that's parsed
+#define HTTP_GZIP_EXT               ".gz"   // name suffix of a precompressed file variant
+#define HTTP_SSE_RESPONSE           "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\nX-Accel-Buffering: no\r\n\r\n"
+#define HTTP_DYN_PAGE_RCRD_SIZE     10      // FileRcrd.bin record: name hash, DynRcrd.bin offset, variables count
+#define HTTP_DYN_PAGE_IX_UNKNOWN    0xffff  // HTTP_FILE_ENTRY::dynPageIx: the FileRcrd.bin record is not resolved yet
+#define HTTP_DYN_PAGE_IX_NONE       0xfffe  // HTTP_FILE_ENTRY::dynPageIx: the file is not a dynamic page
+#define HTTP_FILE_IX_NONE           0xffff  // HTTP_CONN::fileIx: the file is not in the file index
+// compiled page layout: signature, then segments each starting with an opcode word
+#define HTTP_PAGE_EXT               ".dpg"  // name suffix of a compiled dynamic page
+#define HTTP_PAGE_SIGNATURE         "DPG1"  // compiled page signature and format version
+#define HTTP_PAGE_HDR_SIZE          4       // signature
+#define HTTP_PAGE_OPCODE_SIZE       4       // little endian opcode word
+#define HTTP_PAGE_OPCODE_VAR        0x80000000u // set: dynamic variable, the callback ID follows in the low bits
+                                            // clear: text segment, the length follows in the low bits, then the text
+// MPFS2 image layout
+#define HTTP_MPFS2_HDR_SIZE         8       // "MPFS", version (2), number of files (2)
+#define HTTP_MPFS2_HASH_SIZE        2       // per file name hash
+#define HTTP_MPFS2_FAT_RCRD_SIZE    22      // name offset (4), data offset (4), length (4), timestamp (4), microtime (4), flags (2)
+// size of a HTTP_DYN_VAR_TABLE for nVars variables: records followed by the placeholder lengths
+#define HTTP_DYN_VAR_TABLE_SIZE(nVars)  (sizeof(HTTP_DYN_VAR_TABLE) - sizeof(HTTP_DYN_VAR_RCRD) + (nVars) * (sizeof(HTTP_DYN_VAR_RCRD) + sizeof(uint16_t)))
+
+// header name buffer; large enough for all the parsed headers
+#if (TCPIP_HTTP_MAX_HEADER_LEN < HTTP_MIN_HEADER_LEN)
+#define HTTP_HEADER_BUFF_LEN        HTTP_MIN_HEADER_LEN
+#else
+#define HTTP_HEADER_BUFF_LEN        TCPIP_HTTP_MAX_HEADER_LEN
+#endif
 
 #if defined (NVM_DRIVER_V080_WORKAROUND)
 #define MPFS_UPLOAD_DISK_NO         0
@@ -75,6 +114,16 @@ extern void TCPIP_HTTP_Print(HTTP_CONN_HANDLE connHandle,uint32_t callbackID);
   ***************************************************************************/
     static const uint8_t HTTP_CRLF[] = "\r\n";  // New line sequence
     #define HTTP_CRLF_LEN   2               // Length of above string
+    static const uint8_t HTTP_LAST_CHUNK[] = "0\r\n\r\n";  // Terminates a chunked body
+    static const char HTTP_PARTIAL_CONTENT[] = "HTTP/1.1 206 Partial Content\r\n";   // Status line of a byte range response
+    static const char HTTP_RANGE_END[] = "\r\n--" HTTP_RANGE_BOUNDARY "--\r\n";    // Terminates a multipart/byteranges body
+
+    // Request methods the server handles
+#if defined(TCPIP_HTTP_USE_POST)
+    #define HTTP_ALLOWED_METHODS    "GET, HEAD, POST, OPTIONS"
+#else
+    #define HTTP_ALLOWED_METHODS    "GET, HEAD, OPTIONS"
+#endif
         
 /****************************************************************************
   Section:
@@ -96,6 +145,10 @@ extern void TCPIP_HTTP_Print(HTTP_CONN_HANDLE connHandle,uint32_t callbackID);
         "cla",          // HTTP_JAVA
         "wav",          // HTTP_WAV
         "svg",          // HTTP_SVG
+        "json",         // HTTP_JSON
+        "ico",          // HTTP_ICO
+        "woff2",        // HTTP_WOFF2
+        "wasm",         // HTTP_WASM
         "\0\0\0"        // HTTP_UNKNOWN
     };
     
@@ -115,6 +168,10 @@ extern void TCPIP_HTTP_Print(HTTP_CONN_HANDLE connHandle,uint32_t callbackID);
         "application/java-vm",   // HTTP_JAVA
         "audio/x-wave",          // HTTP_WAV
         "image/svg+xml",         // HTTP_SVG
+        "application/json",      // HTTP_JSON
+        "image/x-icon",          // HTTP_ICO
+        "font/woff2",            // HTTP_WOFF2
+        "application/wasm",      // HTTP_WASM
         ""                       // HTTP_UNKNOWN
     };
         
@@ -126,11 +183,11 @@ extern void TCPIP_HTTP_Print(HTTP_CONN_HANDLE connHandle,uint32_t callbackID);
     // Initial response strings (Corresponding to HTTP_STATUS)
     static const char * const HTTPResponseHeaders[] =
     {
-        "HTTP/1.1 200 OK\r\nConnection: close\r\n",
+        "HTTP/1.1 200 OK\r\n",
 #if defined (TCPIP_HTTP_USE_WEBSOCKETS)
         "HTTP/1.1 200 OK\r\nPLACEHOLDER:WEBSOCKETS\r\n",
 #endif
-        "HTTP/1.1 200 OK\r\nConnection: close\r\n",
+        "HTTP/1.1 200 OK\r\n",
         "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n\r\n400 Bad Request: can't handle Content-Length\r\n",
         "HTTP/1.1 401 Unauthorized\r\nWWW-Authenticate: Basic realm=\"Protected\"\r\nConnection: close\r\n\r\n401 Unauthorized: Password required\r\n",
         #if defined(TCPIP_HTTP_FILE_UPLOAD_ENABLE)
@@ -140,9 +197,12 @@ extern void TCPIP_HTTP_Print(HTTP_CONN_HANDLE connHandle,uint32_t callbackID);
         #endif
         "HTTP/1.1 414 Request-URI Too Long\r\nConnection: close\r\n\r\n414 Request-URI Too Long: Buffer overflow detected\r\n",
         "HTTP/1.1 500 Internal Server Error\r\nConnection: close\r\n\r\n500 Internal Server Error: Expected data not present\r\n",
-        "HTTP/1.1 501 Not Implemented\r\nConnection: close\r\n\r\n501 Not Implemented: Only GET and POST supported\r\n",
+        "HTTP/1.1 501 Not Implemented\r\nAllow: " HTTP_ALLOWED_METHODS "\r\nConnection: close\r\n\r\n501 Not Implemented: Only " HTTP_ALLOWED_METHODS " supported\r\n",
         "HTTP/1.1 302 Found\r\nConnection: close\r\nLocation: ",
         "HTTP/1.1 403 Forbidden\r\nConnection: close\r\n\r\n403 Forbidden: SSL Required - use HTTPS\r\n",
+        "HTTP/1.1 304 Not Modified\r\n",
+        "HTTP/1.1 200 OK\r\nAllow: " HTTP_ALLOWED_METHODS "\r\nContent-Length: 0\r\n",
+        "HTTP/1.1 416 Range Not Satisfiable\r\n",
 
         #if defined(TCPIP_HTTP_FILE_UPLOAD_ENABLE)
         "HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Type: text/html\r\n\r\n<html><body style=\"margin:100px\"><form method=post action=\"/" TCPIP_HTTP_FILE_UPLOAD_NAME "\" enctype=\"multipart/form-data\"><b>MPFS Image Upload</b><p><input type=file name=i size=40> &nbsp; <input type=submit value=\"Upload\"></form></body></html>",
@@ -165,7 +225,14 @@ extern void TCPIP_HTTP_Print(HTTP_CONN_HANDLE connHandle,uint32_t callbackID);
         "Cookie:",
         "Authorization:",
         "Content-Length:",
-        "Sec-WebSocket-Key:"
+        "Sec-WebSocket-Key:",
+        "Connection:",
+        "If-None-Match:",
+        "If-Modified-Since:",
+        "Range:",
+        "If-Range:",
+        "Accept-Encoding:",
+        "Content-Type:",
     };
     
 /****************************************************************************
@@ -175,6 +242,47 @@ extern void TCPIP_HTTP_Print(HTTP_CONN_HANDLE connHandle,uint32_t callbackID);
 static HTTP_CONN*           httpConnCtrl = 0;       // all http connections
 static uint8_t*             httpConnData = 0;       // http connections data space
 static uint16_t             httpConnDataSize = 0;   // associated data size
+static uint8_t*             httpChunkData = 0;      // chunk buffers space
+static uint8_t*             httpFileBuff = 0;       // buffer for reading the served files, shared by all connections
+static uint16_t             httpFileBuffSize = 0;   // size of httpFileBuff
+#if (TCPIP_HTTP_DYNVAR_TTL_ENTRIES != 0)
+static HTTP_DYNVAR_TTL_ENTRY    httpDynVarTtl[TCPIP_HTTP_DYNVAR_TTL_ENTRIES];   // cached dynamic variables output
+static HTTP_DYNVAR_TTL_ENTRY*   httpDynVarCapture = 0;  // entry capturing the output of the running callback
+static uint16_t                 httpDynVarSktBytes = 0; // socket bytes written by TCPIP_HTTP_DynamicWrite() while capturing
+#endif  // (TCPIP_HTTP_DYNVAR_TTL_ENTRIES != 0)
+#if (TCPIP_HTTP_OUTPUT_BUFFERS != 0)
+static uint8_t*             httpOutBuffData = 0;    // callback output buffers space
+static uint8_t*             httpOutBuffFree[TCPIP_HTTP_OUTPUT_BUFFERS];    // output buffers not in use
+static int                  httpOutBuffFreeCount = 0;   // number of entries in httpOutBuffFree
+#endif  // (TCPIP_HTTP_OUTPUT_BUFFERS != 0)
+#if (TCPIP_HTTP_FILE_HANDLE_CACHE != 0)
+static HTTP_FILE_HANDLE_ENTRY   httpFileHandles[TCPIP_HTTP_FILE_HANDLE_CACHE];  // open files shared by the connections
+static uint32_t             httpFileHandleTick = 0; // use counter for the handle replacement
+#endif  // (TCPIP_HTTP_FILE_HANDLE_CACHE != 0)
+#if (TCPIP_HTTP_FILE_CACHE_SIZE != 0)
+static HTTP_FILE_CACHE_ENTRY*   httpFileCache = 0;  // RAM cached files, most recently used first
+static size_t               httpFileCacheSize = 0;  // memory taken by the cached files
+#endif  // (TCPIP_HTTP_FILE_CACHE_SIZE != 0)
+#if defined(TCPIP_HTTP_MAPPED_IMAGE_ENABLE)
+static const uint8_t*       httpMappedImage = 0;    // directly addressable MPFS2 image; 0 if not used
+static size_t               httpMappedImageSize = 0;    // size of httpMappedImage
+#endif  // defined(TCPIP_HTTP_MAPPED_IMAGE_ENABLE)
+static HTTP_FILE_ENTRY*     httpFileIndex = 0;      // file metadata, sorted by name hash; the name pool follows
+static int                  httpFileIndexCount = 0; // number of entries in httpFileIndex
+static bool                 httpFileIndexPartial = false;   // the directory changed while indexed, the index may miss files
+static bool                 httpFileIndexFailed = false;    // the index could not be built; not tried again until invalidated
+static HTTP_DYN_PAGE_ENTRY* httpDynPageIndex = 0;   // FileRcrd.bin records, sorted by name hash
+static int                  httpDynPageCount = 0;   // number of entries in httpDynPageIndex
+static bool                 httpDynPageIndexValid = false;  // httpDynPageIndex reflects the current image
+#if defined(TCPIP_HTTP_USE_SSE)
+static const char*          httpSSEPaths[TCPIP_HTTP_SSE_MAX_PATHS]; // registered event stream paths
+#endif  // defined(TCPIP_HTTP_USE_SSE)
+static const HTTP_ROUTE*    httpRoutes = 0;         // application route table
+static HTTP_ROUTE_ENTRY*    httpRouteIndex = 0;     // route index: exact routes by path hash, then the pattern routes
+static int                  httpRouteCount = 0;     // number of entries in httpRouteIndex
+static int                  httpRouteExactCount = 0;    // number of exact routes, first in httpRouteIndex
+static HTTP_DYN_VAR_TABLE*  httpDynVarTables = 0;   // cached dynamic variable tables, most recently used first
+static size_t               httpDynVarCacheSize = 0;    // memory taken by the cached tables
 static int                  httpConnNo = 0;         // number of HTTP connections
 static int                  httpInitCount = 0;      // module init counter
 static HTTP_MODULE_FLAGS    httpConfigFlags = 0;    // run time flags
@@ -199,11 +307,106 @@ static HTTP_READ_STATUS _HTTP_ReadTo(HTTP_CONN* pHttpCon, uint8_t delim, uint8_t
 #if defined (TCPIP_HTTP_USE_WEBSOCKETS)
 static void _HTTP_HeaderParseWebsocketKey(HTTP_CONN* pHttpCon);
 #endif
+#if defined(TCPIP_HTTP_USE_MULTIPART)
+static void _HTTP_HeaderParseContentType(HTTP_CONN* pHttpCon);
+static void _HTTP_MultipartRelease(HTTP_CONN* pHttpCon);
+#else
+#define _HTTP_MultipartRelease(pHttpCon)
+#endif  // defined(TCPIP_HTTP_USE_MULTIPART)
+static void _HTTP_HeaderParseConnection(HTTP_CONN* pHttpCon);
+static void _HTTP_HeaderParseIfNoneMatch(HTTP_CONN* pHttpCon);
+static void _HTTP_HeaderParseIfModifiedSince(HTTP_CONN* pHttpCon);
+static void _HTTP_HeaderParseRange(HTTP_CONN* pHttpCon);
+static void _HTTP_HeaderParseIfRange(HTTP_CONN* pHttpCon);
+static void _HTTP_HeaderParseAcceptEncoding(HTTP_CONN* pHttpCon);
 
 static void TCPIP_HTTP_Process(void);
 static void TCPIP_HTTP_ProcessConnection(HTTP_CONN* pHttpCon);
 static bool TCPIP_HTTP_FileSend(HTTP_CONN* pHttpCon);
 static bool TCPIP_HTTP_WebPageIsDynamic(HTTP_CONN* pHttpCon);
+static bool _HTTP_DynPageIndexBuild(void);
+static const HTTP_DYN_PAGE_ENTRY* _HTTP_DynPageFind(uint16_t nameHash);
+static const HTTP_DYN_PAGE_ENTRY* _HTTP_DynPageGet(HTTP_CONN* pHttpCon);
+static uint16_t _HTTP_DynPageResolve(const HTTP_FILE_ENTRY* pEntry);
+static HTTP_DYN_VAR_TABLE* _HTTP_DynVarTableGet(const HTTP_DYN_PAGE_ENTRY* pDynPage);
+static void _HTTP_DynVarTableRelease(HTTP_CONN* pHttpCon);
+static void _HTTP_DynVarCachePurge(size_t needSize);
+static uint32_t _HTTP_DynVarTokenLen(SYS_FS_HANDLE file, uint32_t offset, uint8_t* buff, size_t buffSize);
+static void _HTTP_DynVarPrint(HTTP_CONN* pHttpCon, uint32_t callbackID);
+#if (TCPIP_HTTP_DYNVAR_TTL_ENTRIES != 0)
+static HTTP_DYNVAR_TTL_ENTRY* _HTTP_DynVarTtlFind(uint32_t callbackID);
+static void _HTTP_DynVarCapture(const uint8_t* buffer, uint16_t nBytes);
+#endif  // (TCPIP_HTTP_DYNVAR_TTL_ENTRIES != 0)
+static void _HTTP_RequestLineDiscard(HTTP_CONN* pHttpCon);
+static uint16_t _HTTP_NameHash(const char* name);
+#if (TCPIP_HTTP_ARG_INDEX_SIZE != 0)
+static HTTP_CONN* _HTTP_ArgIndexConnGet(const uint8_t* ptr);
+static void _HTTP_ArgIndexBuild(HTTP_CONN* pHttpCon, const uint8_t* pEnd);
+#endif  // (TCPIP_HTTP_ARG_INDEX_SIZE != 0)
+static bool _HTTP_FileIndexBuild(void);
+static const HTTP_FILE_ENTRY* _HTTP_FileIndexFind(const char* fileName);
+static bool _HTTP_FileIndexCovers(const char* fileName);
+static bool _HTTP_FileIndexMayBeDir(const char* path);
+static bool _HTTP_FileInfoGet(const char* fileName, SYS_FS_FSTAT* pStat, uint8_t* pFileFlags, uint16_t* pFileIx);
+static bool _HTTP_FileStat(HTTP_CONN* pHttpCon);
+static void _HTTP_FileOpen(HTTP_CONN* pHttpCon);
+static SYS_FS_HANDLE _HTTP_FileHandleGet(const char* fileName);
+static void _HTTP_FileHandleRelease(SYS_FS_HANDLE handle);
+static void _HTTP_FileHandleCachePurge(void);
+static size_t _HTTP_FileReadAt(SYS_FS_HANDLE handle, uint32_t offset, void* buff, size_t nBytes);
+static bool _HTTP_IncludePush(HTTP_CONN* pHttpCon, const char* fileName);
+static void _HTTP_IncludePop(HTTP_CONN* pHttpCon);
+static void _HTTP_IncludeRelease(HTTP_CONN* pHttpCon);
+static uint32_t _HTTP_IncludeNestedCheck(HTTP_CONN* pHttpCon, HTTP_INC_FRAME* pFrame, uint32_t len);
+static bool _HTTP_MappedFileSend(HTTP_CONN* pHttpCon);
+static const HTTP_ROUTE* _HTTP_RouteFind(HTTP_CONN* pHttpCon, const char* path);
+static bool _HTTP_RouteMatch(HTTP_CONN* pHttpCon, const char* pattern, const char* path);
+static bool _HTTP_RouteSend(HTTP_CONN* pHttpCon);
+#if (TCPIP_HTTP_FILE_CACHE_SIZE != 0)
+static bool _HTTP_FileCacheGet(HTTP_CONN* pHttpCon);
+static void _HTTP_FileCacheLoad(HTTP_CONN* pHttpCon);
+static void _HTTP_FileCacheRelease(HTTP_CONN* pHttpCon);
+static void _HTTP_FileCachePurge(size_t needSize);
+#else
+#define _HTTP_FileCacheRelease(pHttpCon)
+#endif  // (TCPIP_HTTP_FILE_CACHE_SIZE != 0)
+#if defined(TCPIP_HTTP_MAPPED_IMAGE_ENABLE)
+static const uint8_t* _HTTP_MappedFileFind(const char* fileName, uint32_t* pFileLen);
+#endif  // defined(TCPIP_HTTP_MAPPED_IMAGE_ENABLE)
+static void _HTTP_FileVariantSelect(HTTP_CONN* pHttpCon);
+static bool _HTTP_IsNotModified(HTTP_CONN* pHttpCon);
+static void _HTTP_ETagFormat(HTTP_CONN* pHttpCon, char* eTag);
+static bool _HTTP_DateFormat(HTTP_CONN* pHttpCon, char* date);
+static int _HTTP_ValidatorsFormat(HTTP_CONN* pHttpCon, char* buff);
+static void _HTTP_ValidatorsPut(HTTP_CONN* pHttpCon);
+static HTTP_FILE_TYPE _HTTP_FileTypeGet(const char* fileName);
+static int _HTTP_StaticHeadersFormat(HTTP_CONN* pHttpCon, char* buff);
+static bool _HTTP_StaticHeadersPut(HTTP_CONN* pHttpCon);
+static void _HTTP_BodyFramingPut(HTTP_CONN* pHttpCon, bool isDynamic);
+static void _HTTP_ConnectionPut(HTTP_CONN* pHttpCon, bool isFramed);
+static bool _HTTP_RangeApplies(HTTP_CONN* pHttpCon);
+static void _HTTP_RangeFramingPut(HTTP_CONN* pHttpCon);
+static uint16_t _HTTP_RangePartHeaderFormat(HTTP_CONN* pHttpCon, int rangeIx, char* partHdr);
+static bool _HTTP_RangeSend(HTTP_CONN* pHttpCon);
+static uint16_t _HTTP_DynWrite(HTTP_CONN* pHttpCon, const uint8_t* buffer, uint16_t size);
+static uint16_t _HTTP_DynWriteIsReady(HTTP_CONN* pHttpCon);
+static bool _HTTP_ChunkFlush(HTTP_CONN* pHttpCon);
+static bool _HTTP_ChunkEnd(HTTP_CONN* pHttpCon);
+#if defined(TCPIP_HTTP_USE_SSE)
+static uint8_t _HTTP_SSEPathFind(HTTP_CONN* pHttpCon);
+static void _HTTP_SSEProcess(HTTP_CONN* pHttpCon);
+#define _HTTP_SSEIsStream(pHttpCon)     ((pHttpCon)->sseIx != 0)
+#else
+#define _HTTP_SSEIsStream(pHttpCon)     false
+#endif  // defined(TCPIP_HTTP_USE_SSE)
+#if (TCPIP_HTTP_OUTPUT_BUFFERS != 0)
+static uint16_t _HTTP_OutBuffWrite(HTTP_CONN* pHttpCon, const uint8_t* buffer, uint16_t size);
+static bool _HTTP_OutBuffDrain(HTTP_CONN* pHttpCon);
+static void _HTTP_OutBuffRelease(HTTP_CONN* pHttpCon);
+#else
+#define _HTTP_OutBuffDrain(pHttpCon)    true
+#define _HTTP_OutBuffRelease(pHttpCon)
+#endif  // (TCPIP_HTTP_OUTPUT_BUFFERS != 0)
 static void _HTTPSocketRxSignalHandler(TCP_SOCKET hTCP, TCPIP_NET_HANDLE hNet, TCPIP_TCP_SIGNAL_TYPE sigType, const void* param);
 
 #if (TCPIP_STACK_DOWN_OPERATION != 0)
@@ -250,9 +453,14 @@ static void _HTTP_CloseConnections(TCPIP_NET_IF* pNetIf)
             {
                 if(pHttpCon->file != SYS_FS_HANDLE_INVALID)
                 {
-                    SYS_FS_FileClose(pHttpCon->file);
+                    _HTTP_FileHandleRelease(pHttpCon->file);
                     pHttpCon->file = SYS_FS_HANDLE_INVALID;
                 }
+                _HTTP_IncludeRelease(pHttpCon);
+                _HTTP_OutBuffRelease(pHttpCon);
+                _HTTP_DynVarTableRelease(pHttpCon);
+                _HTTP_FileCacheRelease(pHttpCon);
+                _HTTP_MultipartRelease(pHttpCon);
 
                 if(pNetIf == 0)
                 {   // stack going down
@@ -289,6 +497,25 @@ static void _HTTP_Cleanup(const TCPIP_STACK_MODULE_CTRL* const stackCtrl)
         TCPIP_HEAP_Free(stackCtrl->memH, httpConnData);
         httpConnData = 0;
     }
+    if(httpChunkData)
+    {
+        TCPIP_HEAP_Free(stackCtrl->memH, httpChunkData);
+        httpChunkData = 0;
+    }
+    if(httpFileBuff)
+    {
+        TCPIP_HEAP_Free(stackCtrl->memH, httpFileBuff);
+        httpFileBuff = 0;
+    }
+#if (TCPIP_HTTP_OUTPUT_BUFFERS != 0)
+    if(httpOutBuffData)
+    {
+        TCPIP_HEAP_Free(stackCtrl->memH, httpOutBuffData);
+        httpOutBuffData = 0;
+    }
+    httpOutBuffFreeCount = 0;
+#endif  // (TCPIP_HTTP_OUTPUT_BUFFERS != 0)
+    TCPIP_HTTP_FileIndexInvalidate();
     if(httpConnCtrl)
     {
         TCPIP_HEAP_Free(stackCtrl->memH, httpConnCtrl);
@@ -356,6 +583,16 @@ bool TCPIP_HTTP_Initialize(const TCPIP_STACK_MODULE_CTRL* const stackCtrl,
 
         nConns = httpInitData->nConnections;
         httpConfigFlags = httpInitData->configFlags;
+#if (TCPIP_HTTP_FILE_HANDLE_CACHE != 0)
+        for(connIx = 0; connIx < TCPIP_HTTP_FILE_HANDLE_CACHE; connIx++)
+        {
+            httpFileHandles[connIx].handle = SYS_FS_HANDLE_INVALID;
+            httpFileHandles[connIx].refCount = 0;
+        }
+#endif  // (TCPIP_HTTP_FILE_HANDLE_CACHE != 0)
+#if (TCPIP_HTTP_DYNVAR_TTL_ENTRIES != 0)
+        memset(httpDynVarTtl, 0, sizeof(httpDynVarTtl));
+#endif  // (TCPIP_HTTP_DYNVAR_TTL_ENTRIES != 0)
 
         httpConnCtrl = (HTTP_CONN*)TCPIP_HEAP_Calloc(stackCtrl->memH, nConns, sizeof(*httpConnCtrl));
         httpConnData = (uint8_t*)TCPIP_HEAP_Malloc(stackCtrl->memH, nConns * httpInitData->dataLen);
@@ -366,6 +603,48 @@ bool TCPIP_HTTP_Initialize(const TCPIP_STACK_MODULE_CTRL* const stackCtrl,
             break;
         }
 
+        if((httpConfigFlags & HTTP_MODULE_FLAG_CHUNKED) != 0)
+        {
+            httpChunkData = (uint8_t*)TCPIP_HEAP_Malloc(stackCtrl->memH, nConns * HTTP_CHUNK_BUFFER_SIZE);
+            if(httpChunkData == 0)
+            {
+                SYS_ERROR(SYS_ERROR_ERROR, " HTTP: Dynamic allocation failed");
+                initFail = true;
+                break;
+            }
+        }
+
+        httpFileBuffSize = httpInitData->fileBuffSize;
+        if(httpFileBuffSize == 0)
+        {
+            httpFileBuffSize = HTTP_FILE_BUFF_SIZE_DEFAULT;
+        }
+        else if(httpFileBuffSize < HTTP_FILE_BUFF_SIZE_MIN)
+        {
+            httpFileBuffSize = HTTP_FILE_BUFF_SIZE_MIN;
+        }
+        httpFileBuff = (uint8_t*)TCPIP_HEAP_Malloc(stackCtrl->memH, httpFileBuffSize);
+        if(httpFileBuff == 0)
+        {
+            SYS_ERROR(SYS_ERROR_ERROR, " HTTP: Dynamic allocation failed");
+            initFail = true;
+            break;
+        }
+
+#if (TCPIP_HTTP_OUTPUT_BUFFERS != 0)
+        httpOutBuffData = (uint8_t*)TCPIP_HEAP_Malloc(stackCtrl->memH, TCPIP_HTTP_OUTPUT_BUFFERS * TCPIP_HTTP_OUTPUT_BUFFER_SIZE);
+        if(httpOutBuffData == 0)
+        {
+            SYS_ERROR(SYS_ERROR_ERROR, " HTTP: Dynamic allocation failed");
+            initFail = true;
+            break;
+        }
+        for(httpOutBuffFreeCount = 0; httpOutBuffFreeCount < TCPIP_HTTP_OUTPUT_BUFFERS; httpOutBuffFreeCount++)
+        {
+            httpOutBuffFree[httpOutBuffFreeCount] = httpOutBuffData + httpOutBuffFreeCount * TCPIP_HTTP_OUTPUT_BUFFER_SIZE;
+        }
+#endif  // (TCPIP_HTTP_OUTPUT_BUFFERS != 0)
+
         // create the HTTP timer
         httpSignalHandle =_TCPIPStackSignalHandlerRegister(TCPIP_THIS_MODULE_ID, TCPIP_HTTP_Task, TCPIP_HTTP_TASK_RATE);
         if(httpSignalHandle == 0)
@@ -426,6 +705,10 @@ bool TCPIP_HTTP_Initialize(const TCPIP_STACK_MODULE_CTRL* const stackCtrl,
 
             pHttpCon->data = pHttpData;
             pHttpCon->connIx = (uint16_t)connIx;
+            if(httpChunkData != 0)
+            {
+                pHttpCon->chunkBuff = httpChunkData + connIx * HTTP_CHUNK_BUFFER_SIZE;
+            }
 
             pHttpCon++;
             pHttpData += httpInitData->dataLen;
@@ -532,16 +815,23 @@ static void TCPIP_HTTP_Process(void)
         {
             pHttpCon->sm = SM_HTTP_IDLE;
             pHttpCon->file_sm = SM_IDLE;
+            pHttpCon->connFlags = 0;
 
             // Make sure any opened files are closed
+            _HTTP_IncludeRelease(pHttpCon);
+            _HTTP_OutBuffRelease(pHttpCon);
             if(pHttpCon->file != SYS_FS_HANDLE_INVALID)
             {
-                SYS_FS_FileClose(pHttpCon->file);
+                _HTTP_FileHandleRelease(pHttpCon->file);
                 pHttpCon->file = SYS_FS_HANDLE_INVALID;
                 // Important to clear related control variables,
                 // or serving continuous refresh(F5) by IE etc... will meet issue
                 memset((void *)&pHttpCon->TxFile, 0, sizeof(FILE_CTRL));
             }
+            _HTTP_DynVarTableRelease(pHttpCon);
+            _HTTP_FileCacheRelease(pHttpCon);
+            _HTTP_MultipartRelease(pHttpCon);
+            pHttpCon->asyncState = HTTP_ASYNC_NONE;
 #if (TCPIP_TCP_DYNAMIC_OPTIONS != 0)
             if((httpConfigFlags & HTTP_MODULE_FLAG_ADJUST_SKT_FIFOS) != 0)
             {
@@ -551,8 +841,16 @@ static void TCPIP_HTTP_Process(void)
 #endif  // (TCPIP_TCP_DYNAMIC_OPTIONS != 0)
         }
 
+        // A connection waiting for TCPIP_HTTP_AsyncComplete() is skipped
+        if(pHttpCon->asyncState == HTTP_ASYNC_WAIT && (int32_t)(SYS_TMR_TickCountGet() - pHttpCon->asyncTick) <= 0)
+        {
+            continue;
+        }
+        pHttpCon->asyncState = HTTP_ASYNC_NONE;
+
         // Determine if this connection is eligible for processing
-        if(pHttpCon->sm != SM_HTTP_IDLE || TCPIP_TCP_GetIsReady(pHttpCon->socket))
+        // An idle persistent connection needs to be checked for time out
+        if(pHttpCon->sm != SM_HTTP_IDLE || (pHttpCon->connFlags & HTTP_CONN_FLAG_KEEP_ALIVE) != 0 || TCPIP_TCP_GetIsReady(pHttpCon->socket))
         {
             TCPIP_HTTP_ProcessConnection(pHttpCon);
         }
@@ -582,10 +880,9 @@ static void TCPIP_HTTP_ProcessConnection(HTTP_CONN* pHttpCon)
     int i;
     uint8_t c;
     bool isDone;
+    bool isDynamic;
     uint8_t * ptr = NULL;
-    uint8_t *ext;
-    uint8_t buffer[TCPIP_HTTP_MAX_HEADER_LEN+1];
-    SYS_FS_FSTAT fs_attr = {0};
+    uint8_t buffer[HTTP_HEADER_BUFF_LEN+1];
 
     do
     {
@@ -610,6 +907,12 @@ static void TCPIP_HTTP_ProcessConnection(HTTP_CONN* pHttpCon)
                     pHttpCon->callbackPos = 0xffffffff;
                     pHttpCon->byteCount = 0;
                     pHttpCon->nameHash = 0;
+                    pHttpCon->fileIx = HTTP_FILE_IX_NONE;
+#if (TCPIP_HTTP_ARG_INDEX_SIZE != 0)
+                    pHttpCon->argEnd = 0;
+#endif  // (TCPIP_HTTP_ARG_INDEX_SIZE != 0)
+                    pHttpCon->connFlags = 0;
+                    pHttpCon->chunkLen = 0;
 #if defined(TCPIP_HTTP_USE_POST)
                     pHttpCon->smPost = 0x00;
 #endif
@@ -617,7 +920,12 @@ static void TCPIP_HTTP_ProcessConnection(HTTP_CONN* pHttpCon)
                     pHttpCon->webSocketKey[0] = '\0';
                     pHttpCon->subscriptions = 0;
 #endif
-                    pHttpCon->TxFile.fileTxDone = 0;
+#if defined (TCPIP_HTTP_USE_SSE)
+                    pHttpCon->sseIx = 0;
+#endif
+                    pHttpCon->pRoute = 0;
+                    memset((void *)&pHttpCon->TxFile, 0, sizeof(FILE_CTRL));
+                    pHttpCon->fileData = 0;
 #if (TCPIP_TCP_DYNAMIC_OPTIONS != 0)
                     if((httpConfigFlags & HTTP_MODULE_FLAG_ADJUST_SKT_FIFOS) != 0)
                     {
@@ -628,9 +936,18 @@ static void TCPIP_HTTP_ProcessConnection(HTTP_CONN* pHttpCon)
 #endif  // (TCPIP_TCP_DYNAMIC_OPTIONS != 0)
                 }
                 else
+                {
+                    if((pHttpCon->connFlags & HTTP_CONN_FLAG_KEEP_ALIVE) != 0 && (int32_t)(SYS_TMR_TickCountGet() - pHttpCon->httpTick) > 0)
+                    {// No new request on the persistent connection
+                        if(TCPIP_TCP_Disconnect(pHttpCon->socket))
+                        {
+                            pHttpCon->connFlags = 0;
+                        }
+                    }
                     // Don't break for new connections.  There may be
                     // an entire request in the buffer already.
                     break;
+                }
 
             case SM_HTTP_PARSE_REQUEST:
 
@@ -657,12 +974,25 @@ static void TCPIP_HTTP_ProcessConnection(HTTP_CONN* pHttpCon)
 
                 // Determine the request method
                 lenA = TCPIP_TCP_Find(pHttpCon->socket, ' ', 0, 0, false);
-                if(lenA > 5u)
-                    lenA = 5;
+                if(lenA > 7u)
+                    lenA = 7;
                 TCPIP_TCP_ArrayGet(pHttpCon->socket, pHttpCon->data, lenA+1);
 
                 if ( memcmp(pHttpCon->data, (const void*)"GET", 3) == 0)
                     pHttpCon->httpStatus = HTTP_GET;
+                else if ( memcmp(pHttpCon->data, (const void*)"HEAD", 4) == 0)
+                {// Same as GET, without the body
+                    pHttpCon->httpStatus = HTTP_GET;
+                    pHttpCon->connFlags |= HTTP_CONN_FLAG_HEAD;
+                }
+                else if ( memcmp(pHttpCon->data, (const void*)"OPTIONS", 7) == 0)
+                {// Answered from the headers only, no file is needed
+                    pHttpCon->httpStatus = HTTP_OPTIONS;
+                    _HTTP_RequestLineDiscard(pHttpCon);
+                    pHttpCon->sm = SM_HTTP_PARSE_HEADERS;
+                    isDone = false;
+                    break;
+                }
 #if defined(TCPIP_HTTP_USE_POST)
                 else if ( memcmp(pHttpCon->data, (const void*)"POST", 4) == 0)
                     pHttpCon->httpStatus = HTTP_POST;
@@ -715,19 +1045,34 @@ static void TCPIP_HTTP_ProcessConnection(HTTP_CONN* pHttpCon)
                 }
 #endif
 
-                // If the last character is a not a directory delimiter, then try to open the file
+#if defined (TCPIP_HTTP_USE_SSE)
+                // An event stream has no file
+                pHttpCon->sseIx = _HTTP_SSEPathFind(pHttpCon);
+#endif
+
+                // Nor does a routed request; the file system is only searched when no route matches
+                if(!_HTTP_SSEIsStream(pHttpCon))
+                {
+                    pHttpCon->pRoute = _HTTP_RouteFind(pHttpCon, (const char*)pHttpCon->data + 1);
+                }
+
+                // If the last character is a not a directory delimiter, then look for the file
                 // String starts at 2nd character, because the first is always a '/'
-                if(pHttpCon->data[lenB-1] != '/') {
-                    pHttpCon->file = SYS_FS_FileOpen_Wrapper((char *)&pHttpCon->data[1], SYS_FS_FILE_OPEN_READ);
+                // The file itself is opened only after the headers are parsed,
+                // a conditional request may not need it at all
+                if(pHttpCon->data[lenB-1] != '/' && !_HTTP_SSEIsStream(pHttpCon) && pHttpCon->pRoute == 0) {
                     if(strlen((char*)pHttpCon->data + 1) > sizeof(pHttpCon->fileName))
                     {
                         SYS_ERROR(SYS_ERROR_WARNING, " HTTP: URL exceeds allocated space!");
                     }
                     strncpy(pHttpCon->fileName, (char*)pHttpCon->data + 1, sizeof(pHttpCon->fileName));
+                    _HTTP_FileStat(pHttpCon);
                 }
 
-                // If the open fails, then add our default name and try again
-                if(pHttpCon->file == SYS_FS_HANDLE_INVALID)
+                // If the file is not there, then add our default name and try again
+                // Skipped when the index tells the path is not a directory
+                if((pHttpCon->connFlags & HTTP_CONN_FLAG_FILE_FOUND) == 0 && !_HTTP_SSEIsStream(pHttpCon) && pHttpCon->pRoute == 0 &&
+                   (pHttpCon->data[lenB-1] == '/' || _HTTP_FileIndexMayBeDir((const char*)pHttpCon->data + 1)))
                 {
                     // Add the directory delimiter if needed
                     if(pHttpCon->data[lenB-1] != '/')
@@ -737,9 +1082,9 @@ static void TCPIP_HTTP_ProcessConnection(HTTP_CONN* pHttpCon)
                     strncpy((char*)pHttpCon->data + lenB, TCPIP_HTTP_DEFAULT_FILE, httpConnDataSize - lenB);
                     lenB += strlen(TCPIP_HTTP_DEFAULT_FILE);
 
-                    // Try to open again
-                    pHttpCon->file = SYS_FS_FileOpen_Wrapper((char *)&pHttpCon->data[1],SYS_FS_FILE_OPEN_READ);
+                    // Try again
                     strncpy(pHttpCon->fileName, (char*)pHttpCon->data + 1, sizeof(pHttpCon->fileName));
+                    _HTTP_FileStat(pHttpCon);
                 }
 
                 //Calculate 2 Bytes HashIndex for  pHttpCon->file->name
@@ -753,16 +1098,8 @@ static void TCPIP_HTTP_ProcessConnection(HTTP_CONN* pHttpCon)
                     }
                 }
 
-                // Find the extension in the filename
-                for(ext = pHttpCon->data + lenB-1; ext != pHttpCon->data; ext--)
-                    if(*ext == '.')
-                        break;
-
-                // Compare to known extensions to determine Content-Type
-                ext++;
-                for(pHttpCon->fileType = HTTP_TXT; pHttpCon->fileType < HTTP_UNKNOWN; pHttpCon->fileType++)
-                    if(!strcmp((char *)ext, (const void*)httpFileExtensions[pHttpCon->fileType]))
-                        break;
+                // Compare the extension to known extensions to determine Content-Type
+                pHttpCon->fileType = pHttpCon->pRoute != 0 ? pHttpCon->pRoute->fileType : _HTTP_FileTypeGet((const char*)pHttpCon->data + 1);
 
                 // Perform first round authentication (pass file name only)
 #if defined(TCPIP_HTTP_USE_AUTHENTICATION)
@@ -797,9 +1134,8 @@ static void TCPIP_HTTP_ProcessConnection(HTTP_CONN* pHttpCon)
 
                 }
 
-                // Clear the rest of the line
-                lenA = TCPIP_TCP_Find(pHttpCon->socket, '\n', 0, 0, false);
-                TCPIP_TCP_ArrayGet(pHttpCon->socket, NULL, lenA + 1);
+                // Clear the rest of the line, noting the protocol version
+                _HTTP_RequestLineDiscard(pHttpCon);
 
                 // Move to parsing the headers
                 pHttpCon->sm = SM_HTTP_PARSE_HEADERS;
@@ -907,6 +1243,43 @@ static void TCPIP_HTTP_ProcessConnection(HTTP_CONN* pHttpCon)
                 }
 #endif
 
+                // OPTIONS needs no further processing
+                if(pHttpCon->httpStatus == HTTP_OPTIONS)
+                {
+                    pHttpCon->sm = SM_HTTP_SERVE_HEADERS;
+                    isDone = false;
+                    break;
+                }
+
+                // If the client copy of the page is still valid, answer without opening the file
+                if(_HTTP_IsNotModified(pHttpCon))
+                {
+                    pHttpCon->httpStatus = HTTP_NOT_MODIFIED;
+                    pHttpCon->sm = SM_HTTP_SERVE_HEADERS;
+                    isDone = false;
+                    break;
+                }
+
+                // Serve the requested byte ranges, if they apply
+                if(_HTTP_RangeApplies(pHttpCon))
+                {
+                    if(pHttpCon->nRanges == 0)
+                    {// None of the ranges is in the file
+                        pHttpCon->httpStatus = HTTP_RANGE_NOT_SATISFIABLE;
+                        pHttpCon->sm = SM_HTTP_SERVE_HEADERS;
+                        isDone = false;
+                        break;
+                    }
+                    pHttpCon->connFlags |= HTTP_CONN_FLAG_RANGE;
+                    pHttpCon->rangeIx = 0;
+                }
+
+                // Open the requested file; HEAD does not read it
+                if((pHttpCon->connFlags & (HTTP_CONN_FLAG_FILE_FOUND | HTTP_CONN_FLAG_HEAD)) == HTTP_CONN_FLAG_FILE_FOUND)
+                {
+                    _HTTP_FileOpen(pHttpCon);
+                }
+
                 // Move on to GET args, unless there are none
                 pHttpCon->sm = SM_HTTP_PROCESS_GET;
                 if(pHttpCon->hasArgs == 0)
@@ -941,6 +1314,25 @@ static void TCPIP_HTTP_ProcessConnection(HTTP_CONN* pHttpCon)
                 break;
                 
 #endif                
+
+#if defined (TCPIP_HTTP_USE_SSE)
+            case SM_HTTP_INIT_SSE:
+                // The response has no length, it lasts until either side closes
+                if(TCPIP_TCP_PutIsReady(pHttpCon->socket) < sizeof(HTTP_SSE_RESPONSE) - 1)
+                {
+                    break;
+                }
+                TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)HTTP_SSE_RESPONSE);
+                TCPIP_TCP_Flush(pHttpCon->socket);
+                pHttpCon->httpTick = SYS_TMR_TickCountGet() + TCPIP_HTTP_SSE_KEEP_ALIVE * SYS_TMR_TickCounterFrequencyGet();
+                pHttpCon->sm = SM_HTTP_PROC_SSE;
+                break;
+
+            case SM_HTTP_PROC_SSE:
+                _HTTP_SSEProcess(pHttpCon);
+                isDone = pHttpCon->sm == SM_HTTP_PROC_SSE;
+                break;
+#endif
                 
             case SM_HTTP_PROCESS_GET:
 
@@ -949,6 +1341,8 @@ static void TCPIP_HTTP_ProcessConnection(HTTP_CONN* pHttpCon)
                 {// If waiting for asynchronous process, return to main app
                     break;
                 }
+                // drop a token the handler did not wait for
+                pHttpCon->asyncState = HTTP_ASYNC_NONE;
 
                 // Move on to POST data
                 pHttpCon->sm = SM_HTTP_PROCESS_POST;
@@ -994,6 +1388,10 @@ static void TCPIP_HTTP_ProcessConnection(HTTP_CONN* pHttpCon)
 #endif  // defined(TCPIP_HTTP_FILE_UPLOAD_ENABLE) && defined(NVM_DRIVER_V080_WORKAROUND)
 #endif
                         c = TCPIP_HTTP_PostExecute(pHttpCon);
+                    if(c != (uint8_t)HTTP_IO_WAITING)
+                    {   // drop a token the handler did not wait for
+                        pHttpCon->asyncState = HTTP_ASYNC_NONE;
+                    }
 #ifdef  DRV_WIFI_OTA_ENABLE
                     if(c == (uint8_t)HTTP_IO_DONE)
                     {
@@ -1035,8 +1433,23 @@ static void TCPIP_HTTP_ProcessConnection(HTTP_CONN* pHttpCon)
             
             case SM_HTTP_PROCESS_REQUEST:
 
+#if defined (TCPIP_HTTP_USE_SSE)
+                if(_HTTP_SSEIsStream(pHttpCon))
+                {
+                    pHttpCon->sm = SM_HTTP_INIT_SSE;
+                    isDone = false;
+                    break;
+                }
+#endif
+
+                // A route has no file, its handler writes the body
+                if(pHttpCon->pRoute != 0)
+                {
+                    pHttpCon->callbackPos = 0;
+                    pHttpCon->file_sm = SM_ROUTE_HANDLER;
+                }
                 // Check for 404
-                if(pHttpCon->file == SYS_FS_HANDLE_INVALID)
+                else if((pHttpCon->connFlags & HTTP_CONN_FLAG_FILE_FOUND) == 0)
                 {
                     // Since we're serving a react routed application
                     // we re-direct all 404's too the index.html
@@ -1048,11 +1461,16 @@ static void TCPIP_HTTP_ProcessConnection(HTTP_CONN* pHttpCon)
                     strncpy((char*)pHttpCon->data + 1, TCPIP_HTTP_DEFAULT_FILE, httpConnDataSize - 1);
 
                     // Try to open again
-                    pHttpCon->file = SYS_FS_FileOpen_Wrapper((char *)&pHttpCon->data[1],SYS_FS_FILE_OPEN_READ);
                     strncpy(pHttpCon->fileName, (char*)pHttpCon->data + 1, sizeof(pHttpCon->fileName));
+                    pHttpCon->fileType = _HTTP_FileTypeGet(pHttpCon->fileName);
+                    pHttpCon->nameHash = _HTTP_NameHash(pHttpCon->fileName);
+                    if(_HTTP_FileStat(pHttpCon) && (pHttpCon->connFlags & HTTP_CONN_FLAG_HEAD) == 0)
+                    {
+                        _HTTP_FileOpen(pHttpCon);
+                    }
                     
-                    // Ensure the default file opened
-                    if(pHttpCon->file == SYS_FS_HANDLE_INVALID)
+                    // Ensure the default file exists
+                    if((pHttpCon->connFlags & HTTP_CONN_FLAG_FILE_FOUND) == 0)
                     {
                         pHttpCon->httpStatus = HTTP_NOT_FOUND;
                         pHttpCon->sm = SM_HTTP_SERVE_HEADERS;
@@ -1061,6 +1479,12 @@ static void TCPIP_HTTP_ProcessConnection(HTTP_CONN* pHttpCon)
                     }
                 }
 
+                // Request data left unread cannot be skipped on a persistent connection
+                if(pHttpCon->byteCount != 0)
+                {
+                    pHttpCon->connFlags |= HTTP_CONN_FLAG_CONN_CLOSE;
+                }
+
                 // Set up the dynamic substitutions
                 pHttpCon->byteCount = 0;
 
@@ -1079,7 +1503,14 @@ static void TCPIP_HTTP_ProcessConnection(HTTP_CONN* pHttpCon)
                 }
 #endif  // (TCPIP_TCP_DYNAMIC_OPTIONS != 0)
                 // Send headers
-                TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)HTTPResponseHeaders[pHttpCon->httpStatus]);
+                if((pHttpCon->connFlags & HTTP_CONN_FLAG_RANGE) != 0)
+                {
+                    TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)HTTP_PARTIAL_CONTENT);
+                }
+                else
+                {
+                    TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)HTTPResponseHeaders[pHttpCon->httpStatus]);
+                }
 
                 // If this is a redirect, print the rest of the Location: header
                 if(pHttpCon->httpStatus == HTTP_REDIRECT)
@@ -1090,6 +1521,45 @@ static void TCPIP_HTTP_ProcessConnection(HTTP_CONN* pHttpCon)
                     TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)HTTP_CRLF);
                 }
 
+                // A still valid cached copy only gets its validators refreshed
+                if(pHttpCon->httpStatus == HTTP_NOT_MODIFIED)
+                {
+                    _HTTP_ValidatorsPut(pHttpCon);
+                    if((pHttpCon->connFlags & HTTP_CONN_FLAG_VARY) != 0)
+                    {
+                        TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)"Vary: Accept-Encoding\r\n");
+                    }
+                    TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)"Cache-Control: max-age=");
+                    TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)TCPIP_HTTP_CACHE_LEN);
+                    TCPIP_TCP_StringPut(pHttpCon->socket, HTTP_CRLF);
+                    _HTTP_ConnectionPut(pHttpCon, pHttpCon->byteCount == 0);
+                    TCPIP_TCP_StringPut(pHttpCon->socket, HTTP_CRLF);
+                    pHttpCon->sm = SM_HTTP_DISCONNECT;
+                    break;
+                }
+
+                // None of the requested ranges is in the file
+                if(pHttpCon->httpStatus == HTTP_RANGE_NOT_SATISFIABLE)
+                {
+                    sprintf((char*)buffer, "%lu", (unsigned long)pHttpCon->fileSize);
+                    TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)"Content-Range: bytes */");
+                    TCPIP_TCP_StringPut(pHttpCon->socket, buffer);
+                    TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)"\r\nContent-Length: 0\r\n");
+                    _HTTP_ConnectionPut(pHttpCon, pHttpCon->byteCount == 0);
+                    TCPIP_TCP_StringPut(pHttpCon->socket, HTTP_CRLF);
+                    pHttpCon->sm = SM_HTTP_DISCONNECT;
+                    break;
+                }
+
+                // OPTIONS gets the precomputed header block only
+                if(pHttpCon->httpStatus == HTTP_OPTIONS)
+                {// A request body left unread cannot be skipped on a persistent connection
+                    _HTTP_ConnectionPut(pHttpCon, pHttpCon->byteCount == 0);
+                    TCPIP_TCP_StringPut(pHttpCon->socket, HTTP_CRLF);
+                    pHttpCon->sm = SM_HTTP_DISCONNECT;
+                    break;
+                }
+
                 // If not GET or POST, we're done
                 if(pHttpCon->httpStatus != HTTP_GET && pHttpCon->httpStatus != HTTP_POST)
                 {// Disconnect
@@ -1097,34 +1567,54 @@ static void TCPIP_HTTP_ProcessConnection(HTTP_CONN* pHttpCon)
                     break;
                 }
 
-                // Output the content type, if known
-                if(pHttpCon->fileType != HTTP_UNKNOWN)
+                // A static file gets its header block in one piece
+                isDynamic = TCPIP_HTTP_WebPageIsDynamic(pHttpCon);
+                if(isDynamic || !_HTTP_StaticHeadersPut(pHttpCon))
                 {
-                    TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)"Content-Type: ");
-                    TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)httpContentTypes[pHttpCon->fileType]);
-                    TCPIP_TCP_StringPut(pHttpCon->socket, HTTP_CRLF);
-                }
+                    // Output the content type, if known
+                    if((pHttpCon->connFlags & HTTP_CONN_FLAG_RANGE) != 0 && pHttpCon->nRanges > 1)
+                    {// the parts carry the file content type
+                        TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)"Content-Type: multipart/byteranges; boundary=" HTTP_RANGE_BOUNDARY "\r\n");
+                    }
+                    else if(pHttpCon->fileType != HTTP_UNKNOWN)
+                    {
+                        TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)"Content-Type: ");
+                        TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)httpContentTypes[pHttpCon->fileType]);
+                        TCPIP_TCP_StringPut(pHttpCon->socket, HTTP_CRLF);
+                    }
+
+                    // Output how the end of the body is signaled
+                    _HTTP_BodyFramingPut(pHttpCon, isDynamic);
+
+                    // Output the cache validators of a static page
+                    if(!isDynamic && pHttpCon->httpStatus == HTTP_GET)
+                    {
+                        _HTTP_ValidatorsPut(pHttpCon);
+                    }
 
-                // Output the gzip encoding header if needed
-                if(SYS_FS_FileStat_Wrapper((const char *)&pHttpCon->fileName, &fs_attr) != SYS_FS_HANDLE_INVALID) {
-                    if (fs_attr.fattrib == SYS_FS_ATTR_ZIP_COMPRESSED)
+                    // Output the gzip encoding header if needed
+                    if(pHttpCon->fileAttr == SYS_FS_ATTR_ZIP_COMPRESSED || (pHttpCon->connFlags & HTTP_CONN_FLAG_GZIP_VARIANT) != 0)
                     {
                         TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)"Content-Encoding: gzip\r\n");
                     }
-                }
+                    if((pHttpCon->connFlags & HTTP_CONN_FLAG_VARY) != 0)
+                    {
+                        TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)"Vary: Accept-Encoding\r\n");
+                    }
 
-                // Output the cache-control
-                TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)"Cache-Control: ");
-                if((pHttpCon->httpStatus == HTTP_POST) || (TCPIP_HTTP_WebPageIsDynamic(pHttpCon)))
-                {// This is a dynamic page or a POST request, so no cache
-                    TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)"no-cache");
-                }
-                else
-                {// This is a static page, so save it for the specified amount of time
-                    TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)"max-age=");
-                    TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)TCPIP_HTTP_CACHE_LEN);
+                    // Output the cache-control
+                    TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)"Cache-Control: ");
+                    if((pHttpCon->httpStatus == HTTP_POST) || isDynamic)
+                    {// This is a dynamic page or a POST request, so no cache
+                        TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)"no-cache");
+                    }
+                    else
+                    {// This is a static page, so save it for the specified amount of time
+                        TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)"max-age=");
+                        TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)TCPIP_HTTP_CACHE_LEN);
+                    }
+                    TCPIP_TCP_StringPut(pHttpCon->socket, HTTP_CRLF);
                 }
-                TCPIP_TCP_StringPut(pHttpCon->socket, HTTP_CRLF);
 
                 // Check if we should output cookies
                 if(pHttpCon->hasArgs != 0)
@@ -1199,21 +1689,45 @@ static void TCPIP_HTTP_ProcessConnection(HTTP_CONN* pHttpCon)
 
                 isDone = false;
 
+                // A HEAD request gets the headers only
+                if((pHttpCon->connFlags & HTTP_CONN_FLAG_HEAD) != 0)
+                {
+                    pHttpCon->sm = SM_HTTP_DISCONNECT;
+                    break;
+                }
+
                 // Try to send next packet
                 if(pHttpCon->TxFile.fileTxDone)
                 {// If EOF, then we're done so close and disconnect
                     //SYS_FS_close(pHttpCon->file);
                     //pHttpCon->file = SYS_FS_HANDLE_INVALID;
+                    if((pHttpCon->connFlags & HTTP_CONN_FLAG_CHUNKED) != 0 && !_HTTP_ChunkEnd(pHttpCon))
+                    {// No room for the last chunk yet
+                        isDone = true;
+                        break;
+                    }
                     pHttpCon->sm = SM_HTTP_DISCONNECT;
                     isDone = true;
                 }
+                else if((pHttpCon->connFlags & HTTP_CONN_FLAG_RANGE) != 0)
+                {
+                    isDone = _HTTP_RangeSend(pHttpCon);
+                }
+                else if(pHttpCon->pRoute != 0)
+                {
+                    isDone = _HTTP_RouteSend(pHttpCon);
+                }
+                else if(pHttpCon->fileData != 0)
+                {
+                    isDone = _HTTP_MappedFileSend(pHttpCon);
+                }
                 else
                 {
                     isDone = TCPIP_HTTP_FileSend(pHttpCon);
                 }
 
                 // If the TX FIFO is full, then return to main app loop
-                if(!isDone && TCPIP_TCP_PutIsReady(pHttpCon->socket) == 0u)
+                if(!isDone && _HTTP_DynWriteIsReady(pHttpCon) == 0u)
                 {
                     isDone = true;
                 }
@@ -1223,9 +1737,22 @@ static void TCPIP_HTTP_ProcessConnection(HTTP_CONN* pHttpCon)
                 // Make sure any opened files are closed
                 if(pHttpCon->file != SYS_FS_HANDLE_INVALID)
                 {
-                    SYS_FS_FileClose(pHttpCon->file);
+                    _HTTP_FileHandleRelease(pHttpCon->file);
                     pHttpCon->file = SYS_FS_HANDLE_INVALID;
                 }
+                _HTTP_IncludeRelease(pHttpCon);
+                _HTTP_OutBuffRelease(pHttpCon);
+                _HTTP_DynVarTableRelease(pHttpCon);
+                _HTTP_FileCacheRelease(pHttpCon);
+                _HTTP_MultipartRelease(pHttpCon);
+
+                if((pHttpCon->connFlags & HTTP_CONN_FLAG_KEEP_ALIVE) != 0)
+                {// Persistent connection, wait for the next request
+                    TCPIP_TCP_Flush(pHttpCon->socket);
+                    pHttpCon->httpTick = SYS_TMR_TickCountGet() + HTTP_KEEP_ALIVE_TMO * SYS_TMR_TickCounterFrequencyGet();
+                    pHttpCon->sm = SM_HTTP_IDLE;
+                    break;
+                }
 
                 if(TCPIP_TCP_Disconnect(pHttpCon->socket))
                 {
@@ -1260,382 +1787,3253 @@ static void TCPIP_HTTP_ProcessConnection(HTTP_CONN* pHttpCon)
   ***************************************************************************/
 static bool TCPIP_HTTP_WebPageIsDynamic(HTTP_CONN* pHttpCon)
 {
-    SYS_FS_HANDLE fp = SYS_FS_HANDLE_INVALID;
-    uint16_t nameHash = 0;
-    uint32_t numFile = 0;
-    bool ret = false;
+    if((pHttpCon->connFlags & HTTP_CONN_FLAG_COMPILED_PAGE) != 0 || pHttpCon->pRoute != 0)
+    {
+        return true;
+    }
+    return _HTTP_DynPageGet(pHttpCon) != 0;
+}
+
+// orders the dynamic page index by name hash; file order for the same hash
+static int _HTTP_DynPageEntryCompare(const void* p1, const void* p2)
+{
+    const HTTP_DYN_PAGE_ENTRY* pE1 = (const HTTP_DYN_PAGE_ENTRY*)p1;
+    const HTTP_DYN_PAGE_ENTRY* pE2 = (const HTTP_DYN_PAGE_ENTRY*)p2;
+
+    if(pE1->nameHash != pE2->nameHash)
+    {
+        return (int)pE1->nameHash - (int)pE2->nameHash;
+    }
+    return (int)pE1->rcrdIx - (int)pE2->rcrdIx;
+}
+
+/*****************************************************************************
+  Function:
+    static bool _HTTP_DynPageIndexBuild(void)
+
+  Description:
+    Loads the FileRcrd.bin records into RAM, sorted by the name hash,
+    so that the dynamic pages are looked up without file access.
+    FileRcrd.bin format: number of records (4 bytes),
+    then for each page: name hash (2), DynRcrd.bin offset (4),
+    number of dynamic variables (4).
+
+  Precondition:
+    None
+
+  Parameters:
+    None
+
+  Returns:
+    true  - the index is available; it may be empty
+    false - the file system is not accessible, try again later
+  ***************************************************************************/
+static bool _HTTP_DynPageIndexBuild(void)
+{
+    SYS_FS_HANDLE fp;
+    uint32_t    numFile;
+    int         ix, nRead, recIx;
+    uint8_t     rcrdBuff[HTTP_DYN_PAGE_RCRD_SIZE * 16];
+    HTTP_DYN_PAGE_ENTRY* pEntry;
 
     fp = SYS_FS_FileOpen_Wrapper("FileRcrd.bin", SYS_FS_FILE_OPEN_READ);
-    if (fp == SYS_FS_HANDLE_INVALID)
-    return false;
-    SYS_FS_FileRead(fp, &numFile, 4); //Reading Number of files in record
+    if(fp == SYS_FS_HANDLE_INVALID)
+    {   // no dynamic pages, unless the file system is not there yet
+        httpDynPageIndexValid = httpFileIndex != 0;
+        return httpDynPageIndexValid;
+    }
+
+    numFile = 0;
+    if(SYS_FS_FileRead(fp, &numFile, 4) != 4 || numFile > (uint32_t)SYS_FS_FileSize(fp) / HTTP_DYN_PAGE_RCRD_SIZE)
+    {
+        numFile = 0;
+    }
 
-    while(numFile)
+    pEntry = 0;
+    if(numFile != 0)
     {
-        SYS_FS_FileRead(fp, &nameHash, 2); //Reading HashName record
-        if(pHttpCon->nameHash == nameHash) 
+        pEntry = (HTTP_DYN_PAGE_ENTRY*)TCPIP_STACK_MALLOC_FUNC(numFile * sizeof(*pEntry));
+        if(pEntry == 0)
         {
-            ret = true;
+            SYS_FS_FileClose(fp);
+            return false;
+        }
+    }
+
+    // read the records in blocks
+    for(recIx = 0; recIx < numFile; )
+    {
+        nRead = mMIN(numFile - recIx, sizeof(rcrdBuff) / HTTP_DYN_PAGE_RCRD_SIZE);
+        if(SYS_FS_FileRead(fp, rcrdBuff, nRead * HTTP_DYN_PAGE_RCRD_SIZE) != nRead * HTTP_DYN_PAGE_RCRD_SIZE)
+        {   // truncated file; keep what was read
             break;
         }
-        else //Seek to next name hash position
+        for(ix = 0; ix < nRead; ix++, recIx++)
         {
-            SYS_FS_FileSeek(fp, 8, SYS_FS_SEEK_CUR);
+            memcpy(&pEntry[recIx].nameHash, rcrdBuff + ix * HTTP_DYN_PAGE_RCRD_SIZE, 2);
+            memcpy(&pEntry[recIx].dynRcrdOffset, rcrdBuff + ix * HTTP_DYN_PAGE_RCRD_SIZE + 2, 4);
+            memcpy(&pEntry[recIx].dynVarCount, rcrdBuff + ix * HTTP_DYN_PAGE_RCRD_SIZE + 6, 4);
+            pEntry[recIx].rcrdIx = (uint16_t)recIx;
         }
-        numFile-=1;
-    }
-    // Close file
-    if (fp != SYS_FS_HANDLE_INVALID) {
-        SYS_FS_FileClose(fp);
     }
+    SYS_FS_FileClose(fp);
 
-    return ret;
+    if(pEntry != 0)
+    {
+        qsort(pEntry, recIx, sizeof(*pEntry), _HTTP_DynPageEntryCompare);
+    }
+    httpDynPageIndex = pEntry;
+    httpDynPageCount = recIx;
+    httpDynPageIndexValid = true;
+    return true;
 }
 
 /*****************************************************************************
   Function:
-    static bool TCPIP_HTTP_FileSend(HTTP_CONN* pHttpCon)
+    static HTTP_DYN_VAR_TABLE* _HTTP_DynVarTableGet(const HTTP_DYN_PAGE_ENTRY* pDynPage)
 
   Description:
-    Serves up the next chunk of curHTTP's file, up to:
-  a) the available TX FIFO space or
-  b) the next callback index, whichever comes first.
+    Returns the dynamic variable table of a page, loading it from DynRcrd.bin
+    when it is not cached already.
+    The table is shared by all the connections serving the page,
+    so DynRcrd.bin is read once per page and not once per variable.
+    DynRcrd.bin page format: 6 bytes header, then for each variable:
+    offset in the page (4), callback ID (4).
+    Tables not in use are released, least recently used first,
+    to keep the cache within TCPIP_HTTP_DYNVAR_CACHE_SIZE.
 
   Precondition:
-    pHttpCon->file has been opened for reading.
-
-  Parameters:
     None
 
-  Return Values:
-    true  - no more data can be processed for this call and the big TCPIP_HTTP_ProcessConnection loop has to be broken
-            this is due to the dynamic variable processing
-            when the application notifies that it has more data to send to this current HTTP connection
-    false - TCPIP_HTTP_ProcessConnection can continue, no break needed
-
-  Note:
-    the function sets the pHttpCon->TxFile.fileTxDone flag which also breaks the TCPIP_HTTP_ProcessConnection loop
+  Parameters:
+    pDynPage  - the FileRcrd.bin record of the page
 
+  Returns:
+    the page table, with its reference count incremented
+    0 if there's not enough memory right now
+    0 and fileErr set if DynRcrd.bin could not be read
   ***************************************************************************/
-
-static bool TCPIP_HTTP_FileSend(HTTP_CONN* pHttpCon)
+static HTTP_DYN_VAR_TABLE* _HTTP_DynVarTableGet(const HTTP_DYN_PAGE_ENTRY* pDynPage)
 {
-    uint32_t len;
-    uint32_t cntr=0;
-    //uint32_t dynVarCallBackID;
-    uint32_t UInt32DataFromBinFile;
-    uint16_t nameHashRcrd;
-    uint32_t recrdcntr=0;
-    uint8_t sendDataBuffer[HTTP_SEND_DATABUF_SIZE];
-    SYS_FS_HANDLE FileRcrdPtr=SYS_FS_HANDLE_INVALID, DynVarFilePtr = SYS_FS_HANDLE_INVALID;
-    bool needBreak = false;
-    int16_t bytesPut;
+    HTTP_DYN_VAR_TABLE  *pTbl, *pPrev;
+    SYS_FS_HANDLE fp;
+    size_t      tblSize, rdSize;
 
-    switch(pHttpCon->file_sm)
+    for(pPrev = 0, pTbl = httpDynVarTables; pTbl != 0; pPrev = pTbl, pTbl = pTbl->next)
     {
-        case SM_IDLE:
-
-            pHttpCon->TxFile.numBytes = SYS_FS_FileSize(pHttpCon->file);
-            if ((pHttpCon->TxFile.numBytes == SYS_FS_HANDLE_INVALID) || (pHttpCon->TxFile.numBytes == 0)) {
-                pHttpCon->TxFile.fileTxDone = 1;
-                return false;
+        if(pTbl->dynRcrdOffset == pDynPage->dynRcrdOffset)
+        {   // move it in front
+            if(pPrev != 0)
+            {
+                pPrev->next = pTbl->next;
+                pTbl->next = httpDynVarTables;
+                httpDynVarTables = pTbl;
             }
-            pHttpCon->TxFile.bytesReadCount=0;
-            pHttpCon->callbackPos = 0;
+            pTbl->refCount++;
+            return pTbl;
+        }
+    }
 
-        case SM_GET_NO_OF_FILES:
-            FileRcrdPtr = SYS_FS_FileOpen_Wrapper("FileRcrd.bin", SYS_FS_FILE_OPEN_READ);
-            if(FileRcrdPtr == SYS_FS_HANDLE_INVALID)
-            {   // No dynamic variables, so default the flag to 1
-                pHttpCon->file_sm = SM_SERVE_TEXT_DATA ;
-                pHttpCon->TxFile.EndOfCallBackFileFlag = true;
-                break;
+    if(pDynPage->dynVarCount > 0xffff)
+    {   // corrupted record
+        _HTTP_FileRdCheck(0, __FILE__, __LINE__);
+        return 0;
+    }
+
+    rdSize = pDynPage->dynVarCount * sizeof(HTTP_DYN_VAR_RCRD);
+    tblSize = HTTP_DYN_VAR_TABLE_SIZE(pDynPage->dynVarCount);
+    _HTTP_DynVarCachePurge(tblSize);
+    pTbl = (HTTP_DYN_VAR_TABLE*)TCPIP_STACK_MALLOC_FUNC(tblSize);
+    if(pTbl == 0)
+    {   // release all that's not in use and try again
+        _HTTP_DynVarCachePurge(TCPIP_HTTP_DYNVAR_CACHE_SIZE);
+        pTbl = (HTTP_DYN_VAR_TABLE*)TCPIP_STACK_MALLOC_FUNC(tblSize);
+        if(pTbl == 0)
+        {
+            return 0;
+        }
+    }
+
+    fp = SYS_FS_FileOpen_Wrapper("DynRcrd.bin", SYS_FS_FILE_OPEN_READ);
+    _HTTP_FileRdCheck(fp != SYS_FS_HANDLE_INVALID, __FILE__, __LINE__);
+    if(fp != SYS_FS_HANDLE_INVALID)
+    {   // the records are stored as HTTP_DYN_VAR_RCRD
+        if(SYS_FS_FileSeek(fp, pDynPage->dynRcrdOffset + 6, SYS_FS_SEEK_SET) < 0 ||
+           SYS_FS_FileRead(fp, pTbl->rcrd, rdSize) != rdSize)
+        {
+            _HTTP_FileRdCheck(0, __FILE__, __LINE__);
+        }
+        SYS_FS_FileClose(fp);
+    }
+
+    if(fileErr != 0)
+    {
+        TCPIP_STACK_FREE_FUNC(pTbl);
+        return 0;
+    }
+
+    pTbl->dynRcrdOffset = pDynPage->dynRcrdOffset;
+    pTbl->nVars = (uint16_t)pDynPage->dynVarCount;
+    pTbl->varLen = (uint16_t*)(pTbl->rcrd + pTbl->nVars);
+    memset(pTbl->varLen, 0, pTbl->nVars * sizeof(*pTbl->varLen));
+    pTbl->refCount = 1;
+    pTbl->next = httpDynVarTables;
+    httpDynVarTables = pTbl;
+    httpDynVarCacheSize += tblSize;
+
+    return pTbl;
+}
+
+// releases the dynamic variable table used by the connection, if any
+static void _HTTP_DynVarTableRelease(HTTP_CONN* pHttpCon)
+{
+    HTTP_DYN_VAR_TABLE* pCached;
+    HTTP_DYN_VAR_TABLE* pTbl = pHttpCon->pDynVars;
+
+    if(pTbl == 0)
+    {
+        return;
+    }
+
+    pHttpCon->pDynVars = 0;
+    if(--pTbl->refCount != 0)
+    {
+        return;
+    }
+
+    for(pCached = httpDynVarTables; pCached != 0; pCached = pCached->next)
+    {
+        if(pCached == pTbl)
+        {   // still cached; it stays if within budget
+            _HTTP_DynVarCachePurge(0);
+            return;
+        }
+    }
+
+    // detached by TCPIP_HTTP_FileIndexInvalidate
+    TCPIP_STACK_FREE_FUNC(pTbl);
+}
+
+// releases the least recently used tables that are not in use
+// until needSize more bytes fit within TCPIP_HTTP_DYNVAR_CACHE_SIZE
+static void _HTTP_DynVarCachePurge(size_t needSize)
+{
+    HTTP_DYN_VAR_TABLE  *pTbl, *pPrev, *pLru, *pLruPrev;
+
+    while(httpDynVarCacheSize + needSize > TCPIP_HTTP_DYNVAR_CACHE_SIZE)
+    {
+        pLru = pLruPrev = 0;
+        for(pPrev = 0, pTbl = httpDynVarTables; pTbl != 0; pPrev = pTbl, pTbl = pTbl->next)
+        {
+            if(pTbl->refCount == 0)
+            {
+                pLru = pTbl;
+                pLruPrev = pPrev;
             }
+        }
 
-            cntr=SYS_FS_FileRead(FileRcrdPtr,&recrdcntr, 4); //Reading Number of files in record        
-            _HTTP_FileRdCheck(cntr==4, __FILE__, __LINE__);
+        if(pLru == 0)
+        {   // all in use
+            break;
+        }
 
-            //Continue to next state
-            pHttpCon->file_sm = SM_GET_HASH_RCRD;
+        if(pLruPrev == 0)
+        {
+            httpDynVarTables = pLru->next;
+        }
+        else
+        {
+            pLruPrev->next = pLru->next;
+        }
+        httpDynVarCacheSize -= HTTP_DYN_VAR_TABLE_SIZE(pLru->nVars);
+        TCPIP_STACK_FREE_FUNC(pLru);
+    }
+}
+
+// returns the length of the dynamic variable placeholder at the file offset:
+// the whole ~name~ token, or 1 if there's no token there.
+// Returns 0 if the token could not be read.
+static uint32_t _HTTP_DynVarTokenLen(SYS_FS_HANDLE file, uint32_t offset, uint8_t* buff, size_t buffSize)
+{
+    size_t      nRead;
+    uint32_t    rdCount, tokenLen;
+    uint8_t*    pStart;
+    uint8_t*    pEnd;
+
+    rdCount = tokenLen = 0;
+    while(tokenLen == 0)
+    {
+        nRead = _HTTP_FileReadAt(file, offset + rdCount, buff, buffSize);
+        if(nRead == 0)
+        {   // end of file or read error
+            break;
+        }
+
+        pStart = buff;
+        if(rdCount == 0)
+        {   // the token opening
+            if(buff[0] != '~')
+            {
+                tokenLen = 1;
+            }
+            pStart++;
+        }
 
-        case SM_GET_HASH_RCRD:
+        if(tokenLen == 0 && (pEnd = memchr(pStart, '~', nRead - (pStart - buff))) != 0)
+        {
+            tokenLen = rdCount + (pEnd - buff) + 1;
+        }
+        rdCount += nRead;
+    }
+
+    return tokenLen;
+}
+
+/*****************************************************************************
+  Function:
+    static void _HTTP_DynVarPrint(HTTP_CONN* pHttpCon, uint32_t callbackID)
+
+  Description:
+    Calls TCPIP_HTTP_Print() for a dynamic variable.
+    For a variable with a TTL set by TCPIP_HTTP_DynVarTtlSet(),
+    the output written by the first call is captured in the cache
+    and, while fresh, it is sent to the other connections
+    without calling TCPIP_HTTP_Print().
+    The callback IDs are per variable and arguments,
+    so the ID alone is the cache key.
+    A callback writing to the socket directly, bypassing
+    TCPIP_HTTP_DynamicWrite(), has an output that cannot be captured
+    and it is never cached.
+
+  Precondition:
+    None
+
+  Parameters:
+    pHttpCon    - HTTP connection
+    callbackID  - callback ID of the variable
+
+  Returns:
+    None
+  ***************************************************************************/
+static void _HTTP_DynVarPrint(HTTP_CONN* pHttpCon, uint32_t callbackID)
+{
+#if (TCPIP_HTTP_DYNVAR_TTL_ENTRIES != 0)
+    HTTP_DYNVAR_TTL_ENTRY* pEntry;
+    uint16_t sktReady;
 
-            while(recrdcntr)
+    // EndOfCallBackFileFlag is cleared for the calls resuming a callback
+    if(pHttpCon->TxFile.EndOfCallBackFileFlag == true && (pEntry = _HTTP_DynVarTtlFind(callbackID)) != 0)
+    {
+        if(pEntry->isValid && (int32_t)(SYS_TMR_TickCountGet() - pEntry->expiryTick) < 0)
+        {
+            if(TCPIP_HTTP_DynamicWriteIsReady(pHttpCon) >= pEntry->outLen)
+            {
+                TCPIP_HTTP_DynamicWrite(pHttpCon, pEntry->data, pEntry->outLen);
+                return;
+            }
+            // no room for the whole output; let the callback render it
+        }
+        else
+        {   // capture a fresh output
+            pEntry->isValid = false;
+            pEntry->isOverflow = false;
+            pEntry->outLen = 0;
+            httpDynVarCapture = pEntry;
+            httpDynVarSktBytes = 0;
+            sktReady = TCPIP_TCP_PutIsReady(pHttpCon->socket);
+            TCPIP_HTTP_Print(pHttpCon, callbackID);
+            httpDynVarCapture = 0;
+            if((uint16_t)(sktReady - TCPIP_TCP_PutIsReady(pHttpCon->socket)) != httpDynVarSktBytes)
+            {   // the callback wrote to the socket directly
+                return;
+            }
+            if(pHttpCon->TxFile.EndOfCallBackFileFlag == true && !pEntry->isOverflow && pEntry->outLen != 0)
             {
-                cntr=SYS_FS_FileRead(FileRcrdPtr, &nameHashRcrd, 2); //Reading HashName record
-                _HTTP_FileRdCheck(cntr==2, __FILE__, __LINE__);
-                if(pHttpCon->nameHash == nameHashRcrd) // Check if namHash calculation contains dir delimiter '/'
+                pEntry->isValid = true;
+                pEntry->expiryTick = SYS_TMR_TickCountGet() + pEntry->ttlTicks;
+            }
+            return;
+        }
+    }
+#endif  // (TCPIP_HTTP_DYNVAR_TTL_ENTRIES != 0)
+
+    TCPIP_HTTP_Print(pHttpCon, callbackID);
+}
+
+#if (TCPIP_HTTP_DYNVAR_TTL_ENTRIES != 0)
+// finds the TTL entry of a callback ID, 0 if the variable has no TTL
+static HTTP_DYNVAR_TTL_ENTRY* _HTTP_DynVarTtlFind(uint32_t callbackID)
+{
+    HTTP_DYNVAR_TTL_ENTRY* pEntry;
+    int ix;
+
+    for(ix = 0, pEntry = httpDynVarTtl; ix < TCPIP_HTTP_DYNVAR_TTL_ENTRIES; ix++, pEntry++)
+    {
+        if(pEntry->ttlTicks != 0 && pEntry->callbackID == callbackID)
+        {
+            return pEntry;
+        }
+    }
+
+    return 0;
+}
+
+// appends the output written by the running callback to its TTL entry
+static void _HTTP_DynVarCapture(const uint8_t* buffer, uint16_t nBytes)
+{
+    HTTP_DYNVAR_TTL_ENTRY* pEntry = httpDynVarCapture;
+
+    if(pEntry->isOverflow || pEntry->outLen + nBytes > sizeof(pEntry->data))
+    {
+        pEntry->isOverflow = true;
+        return;
+    }
+
+    memcpy(pEntry->data + pEntry->outLen, buffer, nBytes);
+    pEntry->outLen += nBytes;
+}
+#endif  // (TCPIP_HTTP_DYNVAR_TTL_ENTRIES != 0)
+
+// finds the FileRcrd.bin record of a page, 0 if the page is not dynamic
+static const HTTP_DYN_PAGE_ENTRY* _HTTP_DynPageFind(uint16_t nameHash)
+{
+    int low, high, mid;
+
+    if(!httpDynPageIndexValid && !_HTTP_DynPageIndexBuild())
+    {
+        return 0;
+    }
+
+    low = 0;
+    high = httpDynPageCount;
+    while(low < high)
+    {   // the first record with this hash, as the file scan would find
+        mid = (low + high) / 2;
+        if(httpDynPageIndex[mid].nameHash < nameHash)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    if(low < httpDynPageCount && httpDynPageIndex[low].nameHash == nameHash)
+    {
+        return httpDynPageIndex + low;
+    }
+
+    return 0;
+}
+
+// returns the FileRcrd.bin record of the requested page, 0 if the page is not dynamic
+// an indexed file is resolved once, then its record is a direct index
+static const HTTP_DYN_PAGE_ENTRY* _HTTP_DynPageGet(HTTP_CONN* pHttpCon)
+{
+    HTTP_FILE_ENTRY* pEntry;
+
+    if(pHttpCon->fileIx == HTTP_FILE_IX_NONE)
+    {   // not in the index, the name hash has to do
+        return _HTTP_DynPageFind(pHttpCon->nameHash);
+    }
+
+    if(!httpDynPageIndexValid && !_HTTP_DynPageIndexBuild())
+    {
+        return 0;
+    }
+
+    pEntry = httpFileIndex + pHttpCon->fileIx;
+    if(pEntry->dynPageIx == HTTP_DYN_PAGE_IX_UNKNOWN)
+    {
+        pEntry->dynPageIx = _HTTP_DynPageResolve(pEntry);
+        if(pEntry->dynPageIx == HTTP_DYN_PAGE_IX_UNKNOWN)
+        {   // could not be checked now
+            return _HTTP_DynPageFind(pHttpCon->nameHash);
+        }
+    }
+
+    return pEntry->dynPageIx == HTTP_DYN_PAGE_IX_NONE ? 0 : httpDynPageIndex + pEntry->dynPageIx;
+}
+
+/*****************************************************************************
+  Function:
+    static uint16_t _HTTP_DynPageResolve(const HTTP_FILE_ENTRY* pEntry)
+
+  Description:
+    Finds the FileRcrd.bin record of an indexed file.
+    FileRcrd.bin identifies a page by the 16 bit name hash only,
+    so a record with the hash of the file may belong to another file.
+    A record is taken only if the placeholder of its first variable,
+    as stored in DynRcrd.bin, is in the file: a '~' at that offset.
+    Of the records sharing the hash, the first one that checks is taken.
+
+  Precondition:
+    The dynamic page index is valid.
+
+  Parameters:
+    pEntry  - the file index entry
+
+  Returns:
+    the index of the record in httpDynPageIndex
+    HTTP_DYN_PAGE_IX_NONE if the file is not a dynamic page
+    HTTP_DYN_PAGE_IX_UNKNOWN if the files could not be read
+  ***************************************************************************/
+static uint16_t _HTTP_DynPageResolve(const HTTP_FILE_ENTRY* pEntry)
+{
+    const HTTP_DYN_PAGE_ENTRY* pDynPage;
+    const HTTP_DYN_PAGE_ENTRY* pEnd;
+    const char* fileName;
+    SYS_FS_HANDLE fp, file;
+    uint32_t    varOffset;
+    uint16_t    dynPageIx;
+    uint8_t     c;
+
+    if((pDynPage = _HTTP_DynPageFind(pEntry->nameHash)) == 0)
+    {
+        return HTTP_DYN_PAGE_IX_NONE;
+    }
+
+    fileName = (const char*)(httpFileIndex + httpFileIndexCount) + pEntry->nameOffset;
+    if((file = _HTTP_FileHandleGet(fileName)) == SYS_FS_HANDLE_INVALID)
+    {
+        return HTTP_DYN_PAGE_IX_UNKNOWN;
+    }
+    if((fp = SYS_FS_FileOpen_Wrapper("DynRcrd.bin", SYS_FS_FILE_OPEN_READ)) == SYS_FS_HANDLE_INVALID)
+    {
+        _HTTP_FileHandleRelease(file);
+        return HTTP_DYN_PAGE_IX_UNKNOWN;
+    }
+
+    dynPageIx = HTTP_DYN_PAGE_IX_NONE;
+    pEnd = httpDynPageIndex + httpDynPageCount;
+    for(; pDynPage != pEnd && pDynPage->nameHash == pEntry->nameHash; pDynPage++)
+    {
+        if(pDynPage->dynVarCount == 0)
+        {   // nothing to check; served as a static page anyway
+            continue;
+        }
+        varOffset = 0xffffffff;
+        if(SYS_FS_FileSeek(fp, pDynPage->dynRcrdOffset + 6, SYS_FS_SEEK_SET) < 0 || SYS_FS_FileRead(fp, &varOffset, 4) != 4)
+        {
+            continue;
+        }
+        if(varOffset < pEntry->fileSize && _HTTP_FileReadAt(file, varOffset, &c, 1) == 1 && c == '~')
+        {
+            dynPageIx = (uint16_t)(pDynPage - httpDynPageIndex);
+            break;
+        }
+    }
+
+    SYS_FS_FileClose(fp);
+    _HTTP_FileHandleRelease(file);
+    return dynPageIx;
+}
+
+/*****************************************************************************
+  Function:
+    static bool TCPIP_HTTP_FileSend(HTTP_CONN* pHttpCon)
+
+  Description:
+    Serves up the next chunk of curHTTP's file, up to:
+  a) the available TX FIFO space or
+  b) the next callback index, whichever comes first.
+
+  Precondition:
+    pHttpCon->file has been opened for reading.
+
+  Parameters:
+    None
+
+  Return Values:
+    true  - no more data can be processed for this call and the big TCPIP_HTTP_ProcessConnection loop has to be broken
+            this is due to the dynamic variable processing
+            when the application notifies that it has more data to send to this current HTTP connection
+    false - TCPIP_HTTP_ProcessConnection can continue, no break needed
+
+  Note:
+    the function sets the pHttpCon->TxFile.fileTxDone flag which also breaks the TCPIP_HTTP_ProcessConnection loop
+
+  ***************************************************************************/
+
+static bool TCPIP_HTTP_FileSend(HTTP_CONN* pHttpCon)
+{
+    uint32_t len;
+    uint32_t cntr=0;
+    //uint32_t dynVarCallBackID;
+    uint8_t* sendDataBuffer = httpFileBuff;
+    uint16_t avlblBytes;
+    const HTTP_DYN_PAGE_ENTRY* pDynPage;
+    const HTTP_DYN_VAR_RCRD* pDynVar;
+    uint16_t* pVarLen;
+    bool needBreak = false;
+    int16_t bytesPut;
+
+    if(!_HTTP_OutBuffDrain(pHttpCon))
+    {   // the pending callback output goes first
+        return false;
+    }
+
+    switch(pHttpCon->file_sm)
+    {
+        case SM_IDLE:
+
+            pHttpCon->TxFile.numBytes = SYS_FS_FileSize(pHttpCon->file);
+            if ((pHttpCon->TxFile.numBytes == SYS_FS_HANDLE_INVALID) || (pHttpCon->TxFile.numBytes == 0)) {
+                pHttpCon->TxFile.fileTxDone = 1;
+                return false;
+            }
+            pHttpCon->TxFile.bytesReadCount=0;
+            pHttpCon->callbackPos = 0;
+
+            if((pHttpCon->connFlags & HTTP_CONN_FLAG_COMPILED_PAGE) != 0)
+            {   // compiled page: a single linear pass, no records to look up
+                len = _HTTP_FileReadAt(pHttpCon->file, 0, sendDataBuffer, HTTP_PAGE_HDR_SIZE);
+                _HTTP_FileRdCheck(len == HTTP_PAGE_HDR_SIZE && memcmp(sendDataBuffer, HTTP_PAGE_SIGNATURE, HTTP_PAGE_HDR_SIZE) == 0, __FILE__, __LINE__);
+                if(fileErr != 0)
                 {
-                    pHttpCon->TxFile.nameHashMatched = true;
-                    cntr=SYS_FS_FileRead(FileRcrdPtr, &UInt32DataFromBinFile, 4);
-                    _HTTP_FileRdCheck(cntr==4, __FILE__, __LINE__);
-                    pHttpCon->TxFile.DynRcrdRdCount = UInt32DataFromBinFile;
-                    cntr=SYS_FS_FileRead(FileRcrdPtr, &pHttpCon->TxFile.dynVarCntr, 4);
-                    _HTTP_FileRdCheck(cntr==4, __FILE__, __LINE__);
                     break;
                 }
-                else //Dummy Read..to hop to next hash name or HOP by "FileSeek" in file handle
-                {
-                    cntr=SYS_FS_FileRead(FileRcrdPtr, &UInt32DataFromBinFile,4);
-                    _HTTP_FileRdCheck(cntr==4, __FILE__, __LINE__);
-                    cntr=SYS_FS_FileRead(FileRcrdPtr, &UInt32DataFromBinFile,4);
-                    _HTTP_FileRdCheck(cntr==4, __FILE__, __LINE__);
-                }
-                recrdcntr-=1;
-            }
-            if(FileRcrdPtr != SYS_FS_HANDLE_INVALID) {
-                SYS_FS_FileClose(FileRcrdPtr);
-                FileRcrdPtr = SYS_FS_HANDLE_INVALID;
+                pHttpCon->TxFile.numBytes -= HTTP_PAGE_HDR_SIZE;
+                pHttpCon->TxFile.bytesReadCount = HTTP_PAGE_HDR_SIZE;
+                pHttpCon->TxFile.EndOfCallBackFileFlag = true;
+                pHttpCon->file_sm = SM_PAGE_SEGMENT_GET;
+                break;
             }
 
-            if(pHttpCon->TxFile.nameHashMatched == true)
-            {
-                //Continue to next state
-                pHttpCon->file_sm = SM_GET_DYN_VAR_FILE_RCRD;
+        case SM_GET_NO_OF_FILES:
+            pDynPage = _HTTP_DynPageGet(pHttpCon);
+            if(pDynPage == 0 || pDynPage->dynVarCount == 0)
+            {   // No dynamic variables, so default the flag to 1
+                pHttpCon->file_sm = SM_SERVE_TEXT_DATA ;
+                pHttpCon->TxFile.EndOfCallBackFileFlag = true;
+                break;
             }
 
-            //If NO HashName record matched means the requrested webpage do not have dynamic variables
-            if(recrdcntr == 0 && pHttpCon->TxFile.nameHashMatched !=true )
+            pHttpCon->pDynVars = _HTTP_DynVarTableGet(pDynPage);
+            if(pHttpCon->pDynVars == 0)
             {
-                pHttpCon->file_sm=SM_SERVE_TEXT_DATA ;
-                pHttpCon->TxFile.EndOfCallBackFileFlag = true; // No variable, so default the flag to 1
-
+                if(fileErr == 0)
+                {   // no memory right now, retry later
+                    pHttpCon->file_sm = SM_GET_NO_OF_FILES;
+                    return true;
+                }
                 break;
             }
 
+            pHttpCon->TxFile.nameHashMatched = true;
+            pHttpCon->TxFile.dynVarCntr = pHttpCon->pDynVars->nVars;
+            pHttpCon->TxFile.dynVarIx = 0;
+
+            //Continue to next state
+            pHttpCon->file_sm = SM_GET_DYN_VAR_FILE_RCRD;
+
         case SM_GET_DYN_VAR_FILE_RCRD:
             pHttpCon->callbackPos = 0;
-            // Open DynRcrd.bin if not opened
-            DynVarFilePtr=SYS_FS_FileOpen_Wrapper("DynRcrd.bin", SYS_FS_FILE_OPEN_READ);
-            if (DynVarFilePtr == SYS_FS_HANDLE_INVALID)
-                return false;
-            if(pHttpCon->TxFile.lock_dynrcd == 0)
+            _HTTP_FileRdCheck(pHttpCon->TxFile.dynVarIx < pHttpCon->pDynVars->nVars, __FILE__, __LINE__);
+            if(fileErr != 0)
             {
-                SYS_FS_FileSeek(DynVarFilePtr, pHttpCon->TxFile.DynRcrdRdCount+6, SYS_FS_SEEK_SET);
-                pHttpCon->TxFile.lock_dynrcd = 1;
-            } else {
-                SYS_FS_FileSeek(DynVarFilePtr, pHttpCon->TxFile.DynRcrdRdCount, SYS_FS_SEEK_SET);
-            }
-            cntr=SYS_FS_FileRead(DynVarFilePtr, &pHttpCon->TxFile.dynVarRcrdOffset, 4);//Reading dynamic variable offset in webpage
-            _HTTP_FileRdCheck(cntr==4, __FILE__, __LINE__);
-            cntr=SYS_FS_FileRead(DynVarFilePtr, &pHttpCon->TxFile.dynVarCallBackID, 4);//Reading dynamic variable call back ID
-            _HTTP_FileRdCheck(cntr==4, __FILE__, __LINE__);
+                break;
+            }
+            pDynVar = pHttpCon->pDynVars->rcrd + pHttpCon->TxFile.dynVarIx++;
+            pHttpCon->TxFile.dynVarRcrdOffset = pDynVar->dynVarOffset;     // dynamic variable offset in webpage
+            pHttpCon->TxFile.dynVarCallBackID = pDynVar->callbackID;        // dynamic variable call back ID
             
             //Continue to next state
             pHttpCon->file_sm =SM_PARSE_TILL_DYN_VAR;
 
-        case SM_PARSE_TILL_DYN_VAR:
-            // Check if it is re-entering service
-            if (DynVarFilePtr == SYS_FS_HANDLE_INVALID) {
-                DynVarFilePtr=SYS_FS_FileOpen_Wrapper("DynRcrd.bin", SYS_FS_FILE_OPEN_READ);
-                SYS_FS_FileSeek(DynVarFilePtr, pHttpCon->TxFile.DynRcrdRdCount, SYS_FS_SEEK_SET);
-            }
-            if( pHttpCon->TxFile.dynVarRcrdOffset== 0x00)
-            {
-                pHttpCon->file_sm = SM_PARSE_DYN_VAR_STRING;
-            }
-            else
-            {
-                TCPIP_TCP_PutIsReady(pHttpCon->socket);
-                
-                if((pHttpCon->TxFile.dynVarRcrdOffset-pHttpCon->TxFile.bytesReadCount) >= sizeof(sendDataBuffer))
-                {
-                    cntr = sizeof(sendDataBuffer);
-                }
-                else
-                {
-                    cntr = pHttpCon->TxFile.dynVarRcrdOffset - pHttpCon->TxFile.bytesReadCount;
-                }
-                len = SYS_FS_FileRead(pHttpCon->file, sendDataBuffer, cntr);
-                _HTTP_FileRdCheck((len==cntr), __FILE__, __LINE__);
-                bytesPut = TCPIP_TCP_ArrayPut(pHttpCon->socket, sendDataBuffer, len);
-                //SYS_CMD_PRINT("cntr %d len %d BP %d\r\n", cntr, len, bytesPut);
-                if (bytesPut != len)
-                {
-                    // we didn't transmit the entire buffer, so we have to seek backwards.
-                    SYS_FS_FileSeek(pHttpCon->file, 0 - (len - bytesPut), SYS_FS_SEEK_CUR);
-                }
-                pHttpCon->TxFile.numBytes -= bytesPut;
-                pHttpCon->TxFile.bytesReadCount+=bytesPut;
-            }
-            pHttpCon->TxFile.DynRcrdRdCount = SYS_FS_FileTell(DynVarFilePtr);
-            if(pHttpCon->TxFile.dynVarRcrdOffset == pHttpCon->TxFile.bytesReadCount)
-            {
-                pHttpCon->file_sm = SM_PARSE_DYN_VAR_STRING;
-            }
-            SYS_FS_FileClose(DynVarFilePtr);
-            break;
+        case SM_PARSE_TILL_DYN_VAR:
+            if( pHttpCon->TxFile.dynVarRcrdOffset== 0x00)
+            {
+                pHttpCon->file_sm = SM_PARSE_DYN_VAR_STRING;
+            }
+            else
+            {   // read only what the socket can take
+                avlblBytes = _HTTP_DynWriteIsReady(pHttpCon);
+                cntr = mMIN(pHttpCon->TxFile.dynVarRcrdOffset - pHttpCon->TxFile.bytesReadCount, httpFileBuffSize);
+                cntr = mMIN(cntr, avlblBytes);
+                if(cntr != 0)
+                {
+                    len = _HTTP_FileReadAt(pHttpCon->file, pHttpCon->TxFile.bytesReadCount, sendDataBuffer, cntr);
+                    _HTTP_FileRdCheck((len==cntr), __FILE__, __LINE__);
+                    bytesPut = _HTTP_DynWrite(pHttpCon, sendDataBuffer, len);
+                    pHttpCon->TxFile.numBytes -= bytesPut;
+                    pHttpCon->TxFile.bytesReadCount+=bytesPut;
+                }
+            }
+            if(pHttpCon->TxFile.dynVarRcrdOffset == pHttpCon->TxFile.bytesReadCount)
+            {
+                pHttpCon->file_sm = SM_PARSE_DYN_VAR_STRING;
+            }
+            break;
+
+        case SM_PARSE_DYN_VAR_STRING:
+            // skip the ~name~ placeholder; its length is learned the first time the page is served
+            pVarLen = pHttpCon->pDynVars->varLen + pHttpCon->TxFile.dynVarIx - 1;
+            len = *pVarLen;
+            if(len == 0)
+            {
+                len = _HTTP_DynVarTokenLen(pHttpCon->file, pHttpCon->TxFile.bytesReadCount, sendDataBuffer, httpFileBuffSize);
+                if(len <= 0xffff)
+                {
+                    *pVarLen = (uint16_t)len;
+                }
+            }
+            _HTTP_FileRdCheck(len != 0 && len <= pHttpCon->TxFile.numBytes, __FILE__, __LINE__);
+            if(fileErr != 0)
+            {
+                break;
+            }
+            pHttpCon->TxFile.numBytes -= len;
+            pHttpCon->TxFile.bytesReadCount += len;
+
+            //Continue to next state to process the dynamic variable callback
+            pHttpCon->file_sm =SM_PROCESS_DYN_VAR_CALLBACK;
+            pHttpCon->TxFile.EndOfCallBackFileFlag = true;
+
+        case SM_PROCESS_DYN_VAR_CALLBACK:
+
+            _HTTP_DynVarPrint(pHttpCon, pHttpCon->TxFile.dynVarCallBackID);
+
+            if(pHttpCon->TxFile.EndOfCallBackFileFlag == true)
+            {
+                pHttpCon->TxFile.dynVarCntr-=1;
+                pHttpCon->file_sm=SM_GET_DYN_VAR_FILE_RCRD;
+                if(pHttpCon->TxFile.dynVarCntr == 0)
+                {       
+                    if (pHttpCon->TxFile.numBytes != 0)
+                    {
+                        pHttpCon->file_sm =SM_SERVE_TEXT_DATA;
+                    }
+                }
+            }
+            else if (pHttpCon->callbackPos != 0 && pHttpCon->callbackPos != -1)
+            {
+                needBreak = true;
+            }
+
+            break;
+
+        case SM_SERVE_TEXT_DATA:
+
+            // If HashIndex do not match,that means no entry in the "FilRcrd.bin", means no dynamic variables for this wepage,
+            //then proceed to serve the page as normal HTML text
+
+            // read only what the socket can take, so every byte is read once
+            avlblBytes = _HTTP_DynWriteIsReady(pHttpCon);
+            cntr = mMIN(pHttpCon->TxFile.numBytes, httpFileBuffSize);
+            cntr = mMIN(cntr, avlblBytes);
+            if(cntr == 0)
+            {
+                break;
+            }
+            len = _HTTP_FileReadAt(pHttpCon->file, pHttpCon->TxFile.bytesReadCount, sendDataBuffer, cntr);
+            _HTTP_FileRdCheck(len==cntr, __FILE__, __LINE__);
+            bytesPut = _HTTP_DynWrite(pHttpCon, sendDataBuffer, len);
+            pHttpCon->TxFile.numBytes -=bytesPut;
+            pHttpCon->TxFile.bytesReadCount+=bytesPut;
+
+            break;
+
+        case SM_PAGE_SEGMENT_GET:
+            pHttpCon->callbackPos = 0;
+            len = _HTTP_FileReadAt(pHttpCon->file, pHttpCon->TxFile.bytesReadCount, sendDataBuffer, HTTP_PAGE_OPCODE_SIZE);
+            _HTTP_FileRdCheck(len == HTTP_PAGE_OPCODE_SIZE && pHttpCon->TxFile.numBytes >= HTTP_PAGE_OPCODE_SIZE, __FILE__, __LINE__);
+            if(fileErr != 0)
+            {
+                break;
+            }
+            cntr = sendDataBuffer[0] | ((uint32_t)sendDataBuffer[1] << 8) | ((uint32_t)sendDataBuffer[2] << 16) | ((uint32_t)sendDataBuffer[3] << 24);
+            pHttpCon->TxFile.numBytes -= HTTP_PAGE_OPCODE_SIZE;
+            pHttpCon->TxFile.bytesReadCount += HTTP_PAGE_OPCODE_SIZE;
+
+            if((cntr & HTTP_PAGE_OPCODE_VAR) == 0)
+            {   // text segment; dynVarRcrdOffset marks its end
+                _HTTP_FileRdCheck(cntr <= pHttpCon->TxFile.numBytes, __FILE__, __LINE__);
+                pHttpCon->TxFile.dynVarRcrdOffset = pHttpCon->TxFile.bytesReadCount + cntr;
+                pHttpCon->file_sm = SM_PAGE_SERVE_TEXT;
+                break;
+            }
+
+            pHttpCon->TxFile.dynVarCallBackID = cntr & ~HTTP_PAGE_OPCODE_VAR;
+            pHttpCon->TxFile.EndOfCallBackFileFlag = true;
+            pHttpCon->file_sm = SM_PAGE_CALLBACK;
+            // no break, process the variable right away
+
+        case SM_PAGE_CALLBACK:
+            _HTTP_DynVarPrint(pHttpCon, pHttpCon->TxFile.dynVarCallBackID);
+
+            if(pHttpCon->TxFile.EndOfCallBackFileFlag == true)
+            {
+                pHttpCon->file_sm = SM_PAGE_SEGMENT_GET;
+            }
+            else if (pHttpCon->callbackPos != 0 && pHttpCon->callbackPos != -1)
+            {
+                needBreak = true;
+            }
+            break;
+
+        case SM_PAGE_SERVE_TEXT:
+            // read only what the socket can take
+            avlblBytes = _HTTP_DynWriteIsReady(pHttpCon);
+            cntr = mMIN(pHttpCon->TxFile.dynVarRcrdOffset - pHttpCon->TxFile.bytesReadCount, httpFileBuffSize);
+            cntr = mMIN(cntr, avlblBytes);
+            if(cntr != 0)
+            {
+                len = _HTTP_FileReadAt(pHttpCon->file, pHttpCon->TxFile.bytesReadCount, sendDataBuffer, cntr);
+                _HTTP_FileRdCheck(len==cntr, __FILE__, __LINE__);
+                bytesPut = _HTTP_DynWrite(pHttpCon, sendDataBuffer, len);
+                pHttpCon->TxFile.numBytes -= bytesPut;
+                pHttpCon->TxFile.bytesReadCount += bytesPut;
+            }
+            if(pHttpCon->TxFile.bytesReadCount == pHttpCon->TxFile.dynVarRcrdOffset)
+            {
+                pHttpCon->file_sm = SM_PAGE_SEGMENT_GET;
+            }
+            break;
+
+        default:
+            return false;
+    }
+
+    if((((pHttpCon->TxFile.numBytes == 0)) && (pHttpCon->TxFile.EndOfCallBackFileFlag == true) && _HTTP_OutBuffDrain(pHttpCon)) \
+        || (fileErr==1))    // Exception on file reading
+    {
+        TCPIP_TCP_Flush(pHttpCon->socket);
+        if(fileErr == 1)
+        {   // the client won't get the announced body; don't reuse the connection
+            pHttpCon->connFlags &= ~HTTP_CONN_FLAG_KEEP_ALIVE;
+        }
+
+        pHttpCon->TxFile.nameHashMatched = false;
+        pHttpCon->TxFile.dynVarCallBackID = 0;
+        pHttpCon->TxFile.dynVarIx = 0;
+        _HTTP_DynVarTableRelease(pHttpCon);
+        
+        pHttpCon->TxFile.bytesReadCount=0;
+        pHttpCon->file_sm=SM_IDLE;
+        pHttpCon->TxFile.fileTxDone = 1;
+
+        fileErr = 0;
+        return false;
+    }
+
+    if(needBreak)
+    {   // the callback is pending, send what we have so far
+        _HTTP_ChunkFlush(pHttpCon);
+    }
+
+    return needBreak ? true : false;
+
+}
+
+/*****************************************************************************
+  Function:
+    static void _HTTP_BodyFramingPut(HTTP_CONN* pHttpCon, bool isDynamic)
+
+  Description:
+    Outputs the headers that let the client find the end of the response
+    body and decides if the connection is kept open after the response.
+    A static file is sent with a Content-Length header,
+    or with the byte range headers if only parts of it are sent.
+    A dynamic page is sent using the chunked transfer encoding, if enabled.
+    Otherwise the end of the body is signaled by closing the connection.
+
+  Precondition:
+    pHttpCon->file has been opened for reading.
+
+  Parameters:
+    pHttpCon  - HTTP connection
+    isDynamic - the page contains dynamic variables
+
+  Returns:
+    None
+  ***************************************************************************/
+static void _HTTP_BodyFramingPut(HTTP_CONN* pHttpCon, bool isDynamic)
+{
+    bool    isFramed = false;
+    char    lenBuff[32];
+
+    if(!isDynamic)
+    {
+        TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)"Accept-Ranges: bytes\r\n");
+        if((pHttpCon->connFlags & HTTP_CONN_FLAG_RANGE) != 0)
+        {
+            _HTTP_RangeFramingPut(pHttpCon);
+        }
+        else
+        {
+            sprintf(lenBuff, "Content-Length: %lu\r\n", (unsigned long)pHttpCon->fileSize);
+            TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)lenBuff);
+        }
+        isFramed = true;
+    }
+    else if((httpConfigFlags & HTTP_MODULE_FLAG_CHUNKED) != 0 && (pHttpCon->connFlags & HTTP_CONN_FLAG_HTTP_1_1) != 0)
+    {
+        TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)"Transfer-Encoding: chunked\r\n");
+        pHttpCon->connFlags |= HTTP_CONN_FLAG_CHUNKED;
+        pHttpCon->chunkLen = 0;
+        isFramed = true;
+    }
+
+    _HTTP_ConnectionPut(pHttpCon, isFramed);
+}
+
+// decides if the connection is kept open after a response
+// and outputs the Connection header if it's not
+static void _HTTP_ConnectionPut(HTTP_CONN* pHttpCon, bool isFramed)
+{
+    if(isFramed && (httpConfigFlags & HTTP_MODULE_FLAG_KEEP_ALIVE) != 0 &&
+        (pHttpCon->connFlags & (HTTP_CONN_FLAG_HTTP_1_1 | HTTP_CONN_FLAG_CONN_CLOSE)) == HTTP_CONN_FLAG_HTTP_1_1)
+    {
+        pHttpCon->connFlags |= HTTP_CONN_FLAG_KEEP_ALIVE;
+    }
+    else
+    {
+        TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)"Connection: close\r\n");
+    }
+}
+
+// discards the rest of the request line, noting the protocol version
+static void _HTTP_RequestLineDiscard(HTTP_CONN* pHttpCon)
+{
+    uint16_t len;
+
+    len = TCPIP_TCP_Find(pHttpCon->socket, '\n', 0, 0, false);
+    if(TCPIP_TCP_ArrayFind(pHttpCon->socket, (const uint8_t*)"HTTP/1.1", 8, 0, len, false) != 0xffff)
+    {
+        pHttpCon->connFlags |= HTTP_CONN_FLAG_HTTP_1_1;
+    }
+    TCPIP_TCP_ArrayGet(pHttpCon->socket, NULL, len + 1);
+}
+
+// calculates the hash of a file name, the same way the request parser does
+static uint16_t _HTTP_NameHash(const char* name)
+{
+    uint16_t nameHash = 0;
+
+    for(; *name != '\0'; name++)
+    {
+        if(*name != 0x20)
+        {
+            nameHash += *name;
+            nameHash <<= 1;
+        }
+    }
+
+    return nameHash;
+}
+
+// orders the file index by name hash
+static int _HTTP_FileEntryCompare(const void* p1, const void* p2)
+{
+    return (int)((const HTTP_FILE_ENTRY*)p1)->nameHash - (int)((const HTTP_FILE_ENTRY*)p2)->nameHash;
+}
+
+/*****************************************************************************
+  Function:
+    static bool _HTTP_FileIndexBuild(void)
+
+  Description:
+    Reads the web pages directory and caches the metadata of all the files,
+    sorted by the name hash.
+    The directory is read twice: once to size the allocation
+    and once to fill it in.
+    Files that have a precompressed "<file>.gz" variant are marked.
+    The sub-directories are indexed as well, but not the files in them:
+    a path in a sub-directory that's not there is known to be missing.
+
+  Precondition:
+    None
+
+  Parameters:
+    None
+
+  Returns:
+    true  - the index is available
+    false - the directory could not be read, the names are too large
+            or no memory; the files are looked up in the file system.
+            The failure is remembered until TCPIP_HTTP_FileIndexInvalidate(),
+            so that the lookups don't read the directory every time.
+  ***************************************************************************/
+static bool _HTTP_FileIndexBuild(void)
+{
+    SYS_FS_HANDLE       dirH;
+    SYS_FS_FSTAT        fs_attr;
+    HTTP_FILE_ENTRY*    pEntry;
+    const HTTP_FILE_ENTRY* pBase;
+    char*               namePool;
+    char*               fileName;
+    int                 pass, nFiles, maxFiles, ix;
+    size_t              nameLen, namesSize, maxNamesSize;
+    char                lfName[SYS_FS_MAX_PATH];
+
+    if(httpFileIndexFailed)
+    {
+        return false;
+    }
+
+    pEntry = 0;
+    namePool = 0;
+    maxFiles = 0;
+    maxNamesSize = 0;
+    nFiles = 0;
+    httpFileIndexPartial = false;
+
+    for(pass = 0; pass < 2; pass++)
+    {
+        dirH = SYS_FS_DirOpen(LOCAL_WEBSITE_PATH_FS);
+        if(dirH == SYS_FS_HANDLE_INVALID)
+        {
+            if(pEntry != 0)
+            {
+                TCPIP_STACK_FREE_FUNC(pEntry);
+            }
+            httpFileIndexFailed = true;
+            return false;
+        }
+
+        nFiles = 0;
+        namesSize = 0;
+        while(1)
+        {
+            memset(&fs_attr, 0, sizeof(fs_attr));
+            lfName[0] = '\0';
+            fs_attr.lfname = lfName;
+            fs_attr.lfsize = sizeof(lfName);
+            if(SYS_FS_DirRead(dirH, &fs_attr) != SYS_FS_RES_SUCCESS)
+            {
+                break;
+            }
+            fileName = lfName[0] != '\0' ? lfName : fs_attr.fname;
+            if(fileName[0] == '\0')
+            {   // end of the directory
+                break;
+            }
+
+            nameLen = strlen(fileName) + 1;
+            if(pass != 0)
+            {
+                if(nFiles == maxFiles || namesSize + nameLen > maxNamesSize)
+                {   // the directory changed since the first pass
+                    httpFileIndexPartial = true;
+                    break;
+                }
+                pEntry[nFiles].nameHash = _HTTP_NameHash(fileName);
+                pEntry[nFiles].nameOffset = (uint16_t)namesSize;
+                pEntry[nFiles].fileSize = fs_attr.fsize;
+                pEntry[nFiles].fileDate = fs_attr.fdate;
+                pEntry[nFiles].fileTime = fs_attr.ftime;
+                pEntry[nFiles].fileAttr = fs_attr.fattrib;
+                pEntry[nFiles].fileFlags = HTTP_FILE_FLAG_NONE;
+                pEntry[nFiles].hdrLen = 0;
+                pEntry[nFiles].hdrBlock = 0;
+                pEntry[nFiles].dynPageIx = HTTP_DYN_PAGE_IX_UNKNOWN;
+                memcpy(namePool + namesSize, fileName, nameLen);
+            }
+            nFiles++;
+            namesSize += nameLen;
+        }
+        SYS_FS_DirClose(dirH);
+
+        if(pass == 0)
+        {
+            maxFiles = nFiles;
+            maxNamesSize = namesSize;
+            if(maxNamesSize > 0xffff)
+            {   // the name offsets are 16 bit
+                httpFileIndexFailed = true;
+                return false;
+            }
+            pEntry = (HTTP_FILE_ENTRY*)TCPIP_STACK_MALLOC_FUNC(maxFiles * sizeof(*pEntry) + maxNamesSize + 1);
+            if(pEntry == 0)
+            {
+                httpFileIndexFailed = true;
+                return false;
+            }
+            namePool = (char*)(pEntry + maxFiles);
+        }
+    }
+
+    qsort(pEntry, nFiles, sizeof(*pEntry), _HTTP_FileEntryCompare);
+    if(nFiles != maxFiles)
+    {   // the name pool follows the entries
+        memmove(pEntry + nFiles, namePool, maxNamesSize);
+        namePool = (char*)(pEntry + nFiles);
+    }
+    httpFileIndex = pEntry;
+    httpFileIndexCount = nFiles;
+
+    // mark the files having a precompressed variant
+    for(ix = 0; ix < nFiles; ix++)
+    {
+        fileName = namePool + pEntry[ix].nameOffset;
+        nameLen = strlen(fileName);
+        if(nameLen > sizeof(HTTP_GZIP_EXT) - 1 && strcmp(fileName + nameLen - (sizeof(HTTP_GZIP_EXT) - 1), HTTP_GZIP_EXT) == 0)
+        {
+            nameLen -= sizeof(HTTP_GZIP_EXT) - 1;
+            memcpy(lfName, fileName, nameLen);
+            lfName[nameLen] = '\0';
+            if((pBase = _HTTP_FileIndexFind(lfName)) != 0)
+            {
+                ((HTTP_FILE_ENTRY*)pBase)->fileFlags |= HTTP_FILE_FLAG_GZIP_VARIANT;
+            }
+        }
+    }
+
+    return true;
+}
+
+// finds a file in the index, 0 if not there
+static const HTTP_FILE_ENTRY* _HTTP_FileIndexFind(const char* fileName)
+{
+    uint16_t    nameHash;
+    int         low, high, mid;
+    const char* namePool;
+
+    nameHash = _HTTP_NameHash(fileName);
+    low = 0;
+    high = httpFileIndexCount;
+    while(low < high)
+    {   // find the first entry with this hash
+        mid = (low + high) / 2;
+        if(httpFileIndex[mid].nameHash < nameHash)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    namePool = (const char*)(httpFileIndex + httpFileIndexCount);
+    for(; low < httpFileIndexCount && httpFileIndex[low].nameHash == nameHash; low++)
+    {
+        if(strcmp(namePool + httpFileIndex[low].nameOffset, fileName) == 0)
+        {
+            return httpFileIndex + low;
+        }
+    }
+
+    return 0;
+}
+
+// checks if the index has all the files of the directory of a file:
+// the web pages directory or a sub-directory that does not exist
+static bool _HTTP_FileIndexCovers(const char* fileName)
+{
+    const HTTP_FILE_ENTRY* pEntry;
+    const char* pSlash;
+    char        dirName[SYS_FS_MAX_PATH];
+
+    if(httpFileIndexPartial)
+    {
+        return false;
+    }
+
+    if((pSlash = strchr(fileName, '/')) == 0)
+    {
+        return true;
+    }
+
+    if((size_t)(pSlash - fileName) >= sizeof(dirName))
+    {
+        return false;
+    }
+    memcpy(dirName, fileName, pSlash - fileName);
+    dirName[pSlash - fileName] = '\0';
+    pEntry = _HTTP_FileIndexFind(dirName);
+    return pEntry == 0 || (pEntry->fileAttr & SYS_FS_ATTR_DIR) == 0;
+}
+
+// checks if a path may be a directory; false when the index tells it's not
+static bool _HTTP_FileIndexMayBeDir(const char* path)
+{
+    const HTTP_FILE_ENTRY* pEntry;
+
+    if((httpFileIndex == 0 && !_HTTP_FileIndexBuild()) || !_HTTP_FileIndexCovers(path))
+    {
+        return true;
+    }
+
+    pEntry = _HTTP_FileIndexFind(path);
+    return pEntry != 0 && (pEntry->fileAttr & SYS_FS_ATTR_DIR) != 0;
+}
+
+/*****************************************************************************
+  Function:
+    static bool _HTTP_FileInfoGet(const char* fileName, SYS_FS_FSTAT* pStat, uint8_t* pFileFlags, uint16_t* pFileIx)
+
+  Description:
+    Gets the size, date and attributes of a file.
+    The file index is used when available;
+    the file system is queried only for the files of the sub-directories.
+
+  Precondition:
+    None
+
+  Parameters:
+    fileName    - name of the file, relative to the web pages directory
+    pStat       - address to store the file metadata
+    pFileFlags  - address to store the HTTP_FILE_FLAGS of the file
+    pFileIx     - address to store the index of the file in the file index,
+                  HTTP_FILE_IX_NONE if not indexed; could be 0
+
+  Returns:
+    true  - the file exists
+    false - no such file
+  ***************************************************************************/
+static bool _HTTP_FileInfoGet(const char* fileName, SYS_FS_FSTAT* pStat, uint8_t* pFileFlags, uint16_t* pFileIx)
+{
+    const HTTP_FILE_ENTRY* pEntry;
+
+    *pFileFlags = HTTP_FILE_FLAG_NONE;
+    if(pFileIx != 0)
+    {
+        *pFileIx = HTTP_FILE_IX_NONE;
+    }
+    if(httpFileIndex != 0 || _HTTP_FileIndexBuild())
+    {
+        if((pEntry = _HTTP_FileIndexFind(fileName)) != 0 && (pEntry->fileAttr & SYS_FS_ATTR_DIR) == 0)
+        {
+            pStat->fsize = pEntry->fileSize;
+            pStat->fdate = pEntry->fileDate;
+            pStat->ftime = pEntry->fileTime;
+            pStat->fattrib = pEntry->fileAttr;
+            *pFileFlags = pEntry->fileFlags;
+            if(pFileIx != 0)
+            {
+                *pFileIx = (uint16_t)(pEntry - httpFileIndex);
+            }
+            return true;
+        }
+        if(_HTTP_FileIndexCovers(fileName))
+        {   // the index has all the files of the directory
+            return false;
+        }
+    }
+
+    return SYS_FS_FileStat_Wrapper(fileName, pStat) == SYS_FS_RES_SUCCESS;
+}
+
+/*****************************************************************************
+  Function:
+    static bool _HTTP_FileStat(HTTP_CONN* pHttpCon)
+
+  Description:
+    Looks up the file in pHttpCon->fileName and stores its size, date
+    and attributes in the connection.
+    The file is not opened, a request that's answered from the
+    headers alone does not need it.
+    If a compiled "<file>.dpg" page exists, it's served instead
+    and pHttpCon->fileName is changed to it.
+    A request for a ".dpg" file itself is not found:
+    the compiled page is internal, like FileRcrd.bin and DynRcrd.bin.
+    The position of the file in the file index is stored in pHttpCon->fileIx,
+    the later lookups for the file use it instead of the name hash.
+
+  Precondition:
+    pHttpCon->fileName is set.
+
+  Parameters:
+    pHttpCon  - HTTP connection
+
+  Returns:
+    true  - the file exists, HTTP_CONN_FLAG_FILE_FOUND is set
+    false - no such file, or a compiled page requested by its own name
+  ***************************************************************************/
+static bool _HTTP_FileStat(HTTP_CONN* pHttpCon)
+{
+    SYS_FS_FSTAT fs_attr = {0};
+    uint8_t      fileFlags;
+    size_t       nameLen, extIx;
+
+    pHttpCon->connFlags &= ~(HTTP_CONN_FLAG_FILE_FOUND | HTTP_CONN_FLAG_VARY | HTTP_CONN_FLAG_COMPILED_PAGE);
+
+    nameLen = strlen(pHttpCon->fileName);
+    // the compiled page binary is not served as is; case folded for case insensitive file systems
+    if(nameLen >= sizeof(HTTP_PAGE_EXT) - 1)
+    {
+        for(extIx = 0; extIx < sizeof(HTTP_PAGE_EXT) - 1; extIx++)
+        {
+            if((pHttpCon->fileName[nameLen - (sizeof(HTTP_PAGE_EXT) - 1) + extIx] | 0x20) != HTTP_PAGE_EXT[extIx])
+            {
+                break;
+            }
+        }
+        if(extIx == sizeof(HTTP_PAGE_EXT) - 1)
+        {
+            return false;
+        }
+    }
+
+    // a compiled "<file>.dpg" page takes the place of the file
+    if(nameLen + sizeof(HTTP_PAGE_EXT) <= sizeof(pHttpCon->fileName))
+    {
+        strcpy(pHttpCon->fileName + nameLen, HTTP_PAGE_EXT);
+        if(_HTTP_FileInfoGet(pHttpCon->fileName, &fs_attr, &fileFlags, &pHttpCon->fileIx))
+        {
+            pHttpCon->connFlags |= HTTP_CONN_FLAG_COMPILED_PAGE;
+        }
+        else
+        {
+            pHttpCon->fileName[nameLen] = '\0';
+        }
+    }
+
+    if((pHttpCon->connFlags & HTTP_CONN_FLAG_COMPILED_PAGE) == 0 && !_HTTP_FileInfoGet(pHttpCon->fileName, &fs_attr, &fileFlags, &pHttpCon->fileIx))
+    {
+        return false;
+    }
+
+    pHttpCon->fileSize = fs_attr.fsize;
+    pHttpCon->fileDate = fs_attr.fdate;
+    pHttpCon->fileTime = fs_attr.ftime;
+    pHttpCon->fileAttr = fs_attr.fattrib;
+    pHttpCon->connFlags |= HTTP_CONN_FLAG_FILE_FOUND;
+    if((fileFlags & HTTP_FILE_FLAG_GZIP_VARIANT) != 0)
+    {
+        pHttpCon->connFlags |= HTTP_CONN_FLAG_VARY;
+    }
+    return true;
+}
+
+/*****************************************************************************
+  Function:
+    static SYS_FS_HANDLE _HTTP_FileHandleGet(const char* fileName)
+
+  Description:
+    Returns an open handle for the file, shared with the other
+    connections serving the same file.
+    The handles stay open after use, so a hot file is opened once.
+    When all the cache slots are taken, the least recently used handle
+    that's not in use is closed.
+    Since the file position is shared, the file has to be read
+    with _HTTP_FileReadAt().
+
+  Precondition:
+    None
+
+  Parameters:
+    fileName  - name of the file
+
+  Returns:
+    the file handle, to be released with _HTTP_FileHandleRelease()
+    SYS_FS_HANDLE_INVALID if the file could not be opened
+  ***************************************************************************/
+static SYS_FS_HANDLE _HTTP_FileHandleGet(const char* fileName)
+{
+#if (TCPIP_HTTP_FILE_HANDLE_CACHE != 0)
+    HTTP_FILE_HANDLE_ENTRY  *pEntry, *pEmpty, *pLru, *pSlot;
+    SYS_FS_HANDLE handle;
+    int     ix;
+
+    pEmpty = pLru = 0;
+    for(ix = 0, pEntry = httpFileHandles; ix < TCPIP_HTTP_FILE_HANDLE_CACHE; ix++, pEntry++)
+    {
+        if(pEntry->handle == SYS_FS_HANDLE_INVALID)
+        {
+            pEmpty = pEntry;
+        }
+        else if(strcmp(pEntry->fileName, fileName) == 0)
+        {
+            pEntry->refCount++;
+            pEntry->useTick = ++httpFileHandleTick;
+            return pEntry->handle;
+        }
+        else if(pEntry->refCount == 0 && (pLru == 0 || (int32_t)(pEntry->useTick - pLru->useTick) < 0))
+        {
+            pLru = pEntry;
+        }
+    }
+
+    // make room before opening, the file system has a limited number of handles
+    pSlot = pEmpty != 0 ? pEmpty : pLru;
+    if(pSlot != 0 && pSlot->handle != SYS_FS_HANDLE_INVALID)
+    {
+        SYS_FS_FileClose(pSlot->handle);
+        pSlot->handle = SYS_FS_HANDLE_INVALID;
+    }
+
+    handle = SYS_FS_FileOpen_Wrapper(fileName, SYS_FS_FILE_OPEN_READ);
+    if(handle != SYS_FS_HANDLE_INVALID && pSlot != 0 && strlen(fileName) < sizeof(pSlot->fileName))
+    {
+        strcpy(pSlot->fileName, fileName);
+        pSlot->handle = handle;
+        pSlot->refCount = 1;
+        pSlot->useTick = ++httpFileHandleTick;
+    }
+    // else all handles in use; this one is not cached
+
+    return handle;
+#else
+    return SYS_FS_FileOpen_Wrapper(fileName, SYS_FS_FILE_OPEN_READ);
+#endif  // (TCPIP_HTTP_FILE_HANDLE_CACHE != 0)
+}
+
+// releases a handle obtained with _HTTP_FileHandleGet()
+// a cached handle stays open for the next user
+static void _HTTP_FileHandleRelease(SYS_FS_HANDLE handle)
+{
+#if (TCPIP_HTTP_FILE_HANDLE_CACHE != 0)
+    HTTP_FILE_HANDLE_ENTRY* pEntry;
+    int     ix;
+#endif  // (TCPIP_HTTP_FILE_HANDLE_CACHE != 0)
+
+    if(handle == SYS_FS_HANDLE_INVALID)
+    {
+        return;
+    }
+
+#if (TCPIP_HTTP_FILE_HANDLE_CACHE != 0)
+    for(ix = 0, pEntry = httpFileHandles; ix < TCPIP_HTTP_FILE_HANDLE_CACHE; ix++, pEntry++)
+    {
+        if(pEntry->handle == handle)
+        {
+            if(pEntry->refCount != 0)
+            {
+                pEntry->refCount--;
+            }
+            return;
+        }
+    }
+#endif  // (TCPIP_HTTP_FILE_HANDLE_CACHE != 0)
+
+    // not cached or detached by TCPIP_HTTP_FileIndexInvalidate
+    SYS_FS_FileClose(handle);
+}
+
+// closes the cached file handles
+// the handles in use are detached and closed when released
+static void _HTTP_FileHandleCachePurge(void)
+{
+#if (TCPIP_HTTP_FILE_HANDLE_CACHE != 0)
+    HTTP_FILE_HANDLE_ENTRY* pEntry;
+    int     ix;
+
+    for(ix = 0, pEntry = httpFileHandles; ix < TCPIP_HTTP_FILE_HANDLE_CACHE; ix++, pEntry++)
+    {
+        if(pEntry->handle != SYS_FS_HANDLE_INVALID && pEntry->refCount == 0)
+        {
+            SYS_FS_FileClose(pEntry->handle);
+        }
+        pEntry->handle = SYS_FS_HANDLE_INVALID;
+        pEntry->refCount = 0;
+    }
+#endif  // (TCPIP_HTTP_FILE_HANDLE_CACHE != 0)
+}
+
+// reads from a file whose handle may be shared, at the specified offset
+// returns the number of bytes read
+static size_t _HTTP_FileReadAt(SYS_FS_HANDLE handle, uint32_t offset, void* buff, size_t nBytes)
+{
+    size_t nRead;
+
+    if(SYS_FS_FileSeek(handle, offset, SYS_FS_SEEK_SET) == -1)
+    {
+        return 0;
+    }
+
+    nRead = SYS_FS_FileRead(handle, buff, nBytes);
+    return nRead == (size_t)-1 ? 0 : nRead;
+}
+
+// gets the requested file ready to be served:
+// a static page is served from the mapped image, if there is one,
+// or from the RAM file cache; otherwise the file is opened
+static void _HTTP_FileOpen(HTTP_CONN* pHttpCon)
+{
+#if defined(TCPIP_HTTP_MAPPED_IMAGE_ENABLE)
+    uint32_t fileLen;
+
+    if(httpMappedImage != 0 && !TCPIP_HTTP_WebPageIsDynamic(pHttpCon))
+    {
+        pHttpCon->fileData = _HTTP_MappedFileFind(pHttpCon->fileName, &fileLen);
+        if(pHttpCon->fileData != 0 && fileLen == pHttpCon->fileSize)
+        {
+            pHttpCon->TxFile.bytesReadCount = 0;
+            return;
+        }
+        pHttpCon->fileData = 0;
+    }
+#endif  // defined(TCPIP_HTTP_MAPPED_IMAGE_ENABLE)
+
+#if (TCPIP_HTTP_FILE_CACHE_SIZE != 0)
+    if(_HTTP_FileCacheGet(pHttpCon))
+    {
+        return;
+    }
+#endif  // (TCPIP_HTTP_FILE_CACHE_SIZE != 0)
+
+    pHttpCon->file = _HTTP_FileHandleGet(pHttpCon->fileName);
+
+#if (TCPIP_HTTP_FILE_CACHE_SIZE != 0)
+    if(pHttpCon->file != SYS_FS_HANDLE_INVALID)
+    {
+        _HTTP_FileCacheLoad(pHttpCon);
+    }
+#endif  // (TCPIP_HTTP_FILE_CACHE_SIZE != 0)
+}
+
+#if (TCPIP_HTTP_FILE_CACHE_SIZE != 0)
+/*****************************************************************************
+  Function:
+    static bool _HTTP_FileCacheGet(HTTP_CONN* pHttpCon)
+
+  Description:
+    Looks up the requested file in the RAM file cache.
+    On a hit the connection serves the cached copy:
+    no file is opened and no flash is read.
+
+  Precondition:
+    _HTTP_FileStat() succeeded for pHttpCon->fileName.
+
+  Parameters:
+    pHttpCon  - HTTP connection
+
+  Returns:
+    true  - the file is served from the cache
+    false - the file is not cached
+  ***************************************************************************/
+static bool _HTTP_FileCacheGet(HTTP_CONN* pHttpCon)
+{
+    HTTP_FILE_CACHE_ENTRY   *pEntry, *pPrev;
+
+    for(pPrev = 0, pEntry = httpFileCache; pEntry != 0; pPrev = pEntry, pEntry = pEntry->next)
+    {
+        if(strcmp(pEntry->fileName, pHttpCon->fileName) == 0)
+        {
+            break;
+        }
+    }
+
+    if(pEntry == 0 || pEntry->fileSize != pHttpCon->fileSize ||
+       pEntry->fileDate != pHttpCon->fileDate || pEntry->fileTime != pHttpCon->fileTime)
+    {   // not cached or stale; a stale entry goes when no longer used
+        return false;
+    }
+
+    if(pPrev != 0)
+    {   // move it in front
+        pPrev->next = pEntry->next;
+        pEntry->next = httpFileCache;
+        httpFileCache = pEntry;
+    }
+
+    pEntry->refCount++;
+    pHttpCon->pFileCache = pEntry;
+    pHttpCon->fileData = pEntry->data;
+    pHttpCon->TxFile.bytesReadCount = 0;
+    return true;
+}
+
+/*****************************************************************************
+  Function:
+    static void _HTTP_FileCacheLoad(HTTP_CONN* pHttpCon)
+
+  Description:
+    Reads a small static file, just opened for serving, into the RAM
+    file cache, together with its precomputed validator headers.
+    The least recently used entries not in use are released
+    to keep the cache within TCPIP_HTTP_FILE_CACHE_SIZE.
+    On success the file is closed and the connection serves
+    the cached copy.
+
+  Precondition:
+    pHttpCon->file has been opened for reading.
+
+  Parameters:
+    pHttpCon  - HTTP connection
+
+  Returns:
+    None
+  ***************************************************************************/
+static void _HTTP_FileCacheLoad(HTTP_CONN* pHttpCon)
+{
+    HTTP_FILE_CACHE_ENTRY* pEntry;
+    size_t  nameLen, entrySize;
+    int     validatorsLen;
+    char    validators[HTTP_VALIDATORS_LEN];
+
+    if(pHttpCon->fileSize == 0 || pHttpCon->fileSize > TCPIP_HTTP_FILE_CACHE_MAX_OBJECT ||
+       pHttpCon->httpStatus != HTTP_GET || TCPIP_HTTP_WebPageIsDynamic(pHttpCon))
+    {
+        return;
+    }
+
+    nameLen = strlen(pHttpCon->fileName) + 1;
+    validatorsLen = _HTTP_ValidatorsFormat(pHttpCon, validators) + 1;
+    entrySize = sizeof(HTTP_FILE_CACHE_ENTRY) - 1 + pHttpCon->fileSize + nameLen + validatorsLen;
+    _HTTP_FileCachePurge(entrySize);
+    if(httpFileCacheSize + entrySize > TCPIP_HTTP_FILE_CACHE_SIZE)
+    {   // no room, the entries are in use
+        return;
+    }
+
+    pEntry = (HTTP_FILE_CACHE_ENTRY*)TCPIP_STACK_MALLOC_FUNC(entrySize);
+    if(pEntry == 0)
+    {
+        return;
+    }
+
+    if(_HTTP_FileReadAt(pHttpCon->file, 0, pEntry->data, pHttpCon->fileSize) != pHttpCon->fileSize)
+    {   // serve it from the file, if still possible
+        TCPIP_STACK_FREE_FUNC(pEntry);
+        return;
+    }
+
+    pEntry->fileName = (const char*)pEntry->data + pHttpCon->fileSize;
+    strcpy((char*)pEntry->fileName, pHttpCon->fileName);
+    pEntry->validators = pEntry->fileName + nameLen;
+    strcpy((char*)pEntry->validators, validators);
+    pEntry->fileSize = pHttpCon->fileSize;
+    pEntry->fileDate = pHttpCon->fileDate;
+    pEntry->fileTime = pHttpCon->fileTime;
+    pEntry->entrySize = entrySize;
+    pEntry->refCount = 1;
+    pEntry->next = httpFileCache;
+    httpFileCache = pEntry;
+    httpFileCacheSize += entrySize;
+
+    _HTTP_FileHandleRelease(pHttpCon->file);
+    pHttpCon->file = SYS_FS_HANDLE_INVALID;
+    pHttpCon->pFileCache = pEntry;
+    pHttpCon->fileData = pEntry->data;
+    pHttpCon->TxFile.bytesReadCount = 0;
+}
+
+// releases the cache entry served by the connection, if any
+static void _HTTP_FileCacheRelease(HTTP_CONN* pHttpCon)
+{
+    HTTP_FILE_CACHE_ENTRY* pCached;
+    HTTP_FILE_CACHE_ENTRY* pEntry = pHttpCon->pFileCache;
+
+    if(pEntry == 0)
+    {
+        return;
+    }
+
+    pHttpCon->pFileCache = 0;
+    pHttpCon->fileData = 0;
+    if(--pEntry->refCount != 0)
+    {
+        return;
+    }
+
+    for(pCached = httpFileCache; pCached != 0; pCached = pCached->next)
+    {
+        if(pCached == pEntry)
+        {   // still cached
+            return;
+        }
+    }
+
+    // detached by TCPIP_HTTP_FileIndexInvalidate
+    TCPIP_STACK_FREE_FUNC(pEntry);
+}
+
+// releases the least recently used entries that are not in use
+// until needSize more bytes fit within TCPIP_HTTP_FILE_CACHE_SIZE
+static void _HTTP_FileCachePurge(size_t needSize)
+{
+    HTTP_FILE_CACHE_ENTRY   *pEntry, *pPrev, *pLru, *pLruPrev;
+
+    while(httpFileCacheSize + needSize > TCPIP_HTTP_FILE_CACHE_SIZE)
+    {
+        pLru = pLruPrev = 0;
+        for(pPrev = 0, pEntry = httpFileCache; pEntry != 0; pPrev = pEntry, pEntry = pEntry->next)
+        {
+            if(pEntry->refCount == 0)
+            {
+                pLru = pEntry;
+                pLruPrev = pPrev;
+            }
+        }
+
+        if(pLru == 0)
+        {   // all in use
+            break;
+        }
+
+        if(pLruPrev == 0)
+        {
+            httpFileCache = pLru->next;
+        }
+        else
+        {
+            pLruPrev->next = pLru->next;
+        }
+        httpFileCacheSize -= pLru->entrySize;
+        TCPIP_STACK_FREE_FUNC(pLru);
+    }
+}
+#endif  // (TCPIP_HTTP_FILE_CACHE_SIZE != 0)
+
+#if defined(TCPIP_HTTP_MAPPED_IMAGE_ENABLE)
+/*****************************************************************************
+  Function:
+    static const uint8_t* _HTTP_MappedFileFind(const char* fileName, uint32_t* pFileLen)
+
+  Description:
+    Looks up a file in the mapped MPFS2 image.
+    MPFS2 image format: header "MPFS", version (2), number of files (2),
+    then the name hash of each file (2),
+    then a FAT record for each file: name offset (4), data offset (4),
+    length (4), timestamp (4), microtime (4), flags (2).
+    The offsets are from the beginning of the image;
+    the names are 0 terminated.
+    Only the records with a matching name hash have their name compared.
+
+  Precondition:
+    httpMappedImage is valid.
+
+  Parameters:
+    fileName  - name of the file, relative to the web pages directory
+    pFileLen  - address to store the file length
+
+  Returns:
+    the address of the file contents in the image
+    0 if the file is not in the image
+  ***************************************************************************/
+static const uint8_t* _HTTP_MappedFileFind(const char* fileName, uint32_t* pFileLen)
+{
+    uint16_t    nFiles, fileIx, nameHash, fileHash;
+    uint32_t    nameOffset, dataOffset, dataLen;
+    size_t      nameLen;
+    const uint8_t *pHash, *pFat, *pRcrd;
+    const char* pName;
+
+    // the hash of the MPFS2 generator, every character included
+    for(nameHash = 0, pName = fileName; *pName != '\0'; pName++)
+    {
+        nameHash = (uint16_t)((nameHash + (uint8_t)*pName) << 1);
+    }
+
+    memcpy(&nFiles, httpMappedImage + 6, 2);
+    pHash = httpMappedImage + HTTP_MPFS2_HDR_SIZE;
+    pFat = pHash + nFiles * HTTP_MPFS2_HASH_SIZE;
+    nameLen = strlen(fileName) + 1;
+
+    for(fileIx = 0; fileIx < nFiles; fileIx++, pHash += HTTP_MPFS2_HASH_SIZE)
+    {
+        memcpy(&fileHash, pHash, 2);
+        if(fileHash != nameHash)
+        {
+            continue;
+        }
+
+        pRcrd = pFat + fileIx * HTTP_MPFS2_FAT_RCRD_SIZE;
+        memcpy(&nameOffset, pRcrd, 4);
+        if(nameOffset >= httpMappedImageSize || httpMappedImageSize - nameOffset < nameLen)
+        {
+            continue;
+        }
+        if(memcmp(httpMappedImage + nameOffset, fileName, nameLen) != 0)
+        {
+            continue;
+        }
+
+        memcpy(&dataOffset, pRcrd + 4, 4);
+        memcpy(&dataLen, pRcrd + 8, 4);
+        if(dataOffset > httpMappedImageSize || httpMappedImageSize - dataOffset < dataLen)
+        {   // corrupted record
+            return 0;
+        }
+        *pFileLen = dataLen;
+        return httpMappedImage + dataOffset;
+    }
+
+    return 0;
+}
+#endif  // defined(TCPIP_HTTP_MAPPED_IMAGE_ENABLE)
+
+/*****************************************************************************
+  Function:
+    static bool _HTTP_MappedFileSend(HTTP_CONN* pHttpCon)
+
+  Description:
+    Serves the next part of a static file from the mapped image
+    or from the RAM file cache.
+    The data is put straight from memory into the socket,
+    as much as the socket can take.
+
+  Precondition:
+    pHttpCon->fileData is valid.
+
+  Parameters:
+    pHttpCon  - HTTP connection
+
+  Returns:
+    false - TCPIP_HTTP_ProcessConnection can continue, no break needed
+
+  Note:
+    the function sets the pHttpCon->TxFile.fileTxDone flag when the whole file is sent
+  ***************************************************************************/
+static bool _HTTP_MappedFileSend(HTTP_CONN* pHttpCon)
+{
+    uint16_t avlblBytes;
+    uint32_t cntr;
+
+    avlblBytes = _HTTP_DynWriteIsReady(pHttpCon);
+    cntr = mMIN(pHttpCon->fileSize - pHttpCon->TxFile.bytesReadCount, avlblBytes);
+    if(cntr != 0)
+    {
+        pHttpCon->TxFile.bytesReadCount += _HTTP_DynWrite(pHttpCon, pHttpCon->fileData + pHttpCon->TxFile.bytesReadCount, cntr);
+    }
+
+    if(pHttpCon->TxFile.bytesReadCount == pHttpCon->fileSize)
+    {
+        TCPIP_TCP_Flush(pHttpCon->socket);
+        pHttpCon->TxFile.fileTxDone = 1;
+    }
+
+    return false;
+}
+
+/*****************************************************************************
+  Function:
+    static void _HTTP_FileVariantSelect(HTTP_CONN* pHttpCon)
+
+  Description:
+    Switches the request to the precompressed "<file>.gz" variant
+    of the requested file, if there is one.
+    Only static pages requested with GET qualify.
+    The content type is still the one of the requested file.
+    Conditional and range headers parsed before the switch
+    refer to the other variant and are dropped,
+    so the whole variant is served.
+
+  Precondition:
+    The client accepts the gzip encoding.
+
+  Parameters:
+    pHttpCon  - HTTP connection
+
+  Returns:
+    None
+  ***************************************************************************/
+static void _HTTP_FileVariantSelect(HTTP_CONN* pHttpCon)
+{
+    SYS_FS_FSTAT fs_attr = {0};
+    uint8_t      fileFlags;
+    size_t       nameLen;
+    char         gzName[SYS_FS_MAX_PATH];
+
+    if((pHttpCon->connFlags & (HTTP_CONN_FLAG_FILE_FOUND | HTTP_CONN_FLAG_GZIP_VARIANT)) != HTTP_CONN_FLAG_FILE_FOUND ||
+       pHttpCon->httpStatus != HTTP_GET || pHttpCon->fileAttr == SYS_FS_ATTR_ZIP_COMPRESSED)
+    {
+        return;
+    }
+
+    if(httpFileIndex != 0 && (pHttpCon->connFlags & HTTP_CONN_FLAG_VARY) == 0 && _HTTP_FileIndexCovers(pHttpCon->fileName))
+    {   // the index knows there's no variant
+        return;
+    }
+
+    nameLen = strlen(pHttpCon->fileName);
+    if(nameLen + sizeof(HTTP_GZIP_EXT) > sizeof(gzName))
+    {
+        return;
+    }
+    strcpy(gzName, pHttpCon->fileName);
+    strcpy(gzName + nameLen, HTTP_GZIP_EXT);
+
+    if(!_HTTP_FileInfoGet(gzName, &fs_attr, &fileFlags, 0) || TCPIP_HTTP_WebPageIsDynamic(pHttpCon))
+    {
+        return;
+    }
+
+    strncpy(pHttpCon->fileName, gzName, sizeof(pHttpCon->fileName));
+    pHttpCon->fileSize = fs_attr.fsize;
+    pHttpCon->fileDate = fs_attr.fdate;
+    pHttpCon->fileTime = fs_attr.ftime;
+    pHttpCon->fileAttr = fs_attr.fattrib;
+    pHttpCon->connFlags &= ~(HTTP_CONN_FLAG_ETAG_MATCH | HTTP_CONN_FLAG_DATE_MATCH | HTTP_CONN_FLAG_RANGE_REQ);
+    pHttpCon->connFlags |= HTTP_CONN_FLAG_GZIP_VARIANT | HTTP_CONN_FLAG_VARY;
+}
+
+/*****************************************************************************
+  Function:
+    static bool _HTTP_IsNotModified(HTTP_CONN* pHttpCon)
+
+  Description:
+    Checks if a conditional request can be answered with 304 Not Modified.
+    If-None-Match takes precedence over If-Modified-Since.
+    Only GET requests for static pages without arguments qualify:
+    dynamic pages are generated again for every request
+    and arguments are left for TCPIP_HTTP_GetExecute() to process.
+
+  Precondition:
+    The request headers have been parsed.
+
+  Parameters:
+    pHttpCon  - HTTP connection
+
+  Returns:
+    true  - the client copy is still valid
+    false - the page has to be served
+  ***************************************************************************/
+static bool _HTTP_IsNotModified(HTTP_CONN* pHttpCon)
+{
+    uint16_t matchFlag;
+
+    if(pHttpCon->httpStatus != HTTP_GET || pHttpCon->hasArgs != 0)
+    {
+        return false;
+    }
+
+    matchFlag = (pHttpCon->connFlags & HTTP_CONN_FLAG_COND_ETAG) != 0 ? HTTP_CONN_FLAG_ETAG_MATCH : HTTP_CONN_FLAG_DATE_MATCH;
+    if((pHttpCon->connFlags & matchFlag) == 0)
+    {
+        return false;
+    }
+
+    return !TCPIP_HTTP_WebPageIsDynamic(pHttpCon);
+}
+
+// formats the entity tag of the requested file
+// The MPFS image stores no content hash,
+// so the size and time stamp recorded at image build time are used
+static void _HTTP_ETagFormat(HTTP_CONN* pHttpCon, char* eTag)
+{
+    sprintf(eTag, "\"%lx-%04x%04x%s\"", (unsigned long)pHttpCon->fileSize, pHttpCon->fileDate, pHttpCon->fileTime,
+            (pHttpCon->connFlags & HTTP_CONN_FLAG_GZIP_VARIANT) != 0 ? "-gz" : "");
+}
+
+// formats the modification date of the requested file as an HTTP date
+// returns false if the file system has no valid date for the file
+static bool _HTTP_DateFormat(HTTP_CONN* pHttpCon, char* date)
+{
+    static const char httpDays[] = "SunMonTueWedThuFriSat";
+    static const char httpMonths[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    static const uint8_t monthOffs[] = {0, 3, 2, 5, 0, 3, 5, 1, 4, 6, 2, 4};
+    int year, month, day, wDay, y;
+
+    // FAT date: bits 15-9 year since 1980, 8-5 month, 4-0 day
+    year = 1980 + (pHttpCon->fileDate >> 9);
+    month = (pHttpCon->fileDate >> 5) & 0x0f;
+    day = pHttpCon->fileDate & 0x1f;
+    if(month < 1 || month > 12 || day < 1)
+    {
+        return false;
+    }
+
+    y = month < 3 ? year - 1 : year;
+    wDay = (y + y / 4 - y / 100 + y / 400 + monthOffs[month - 1] + day) % 7;
+
+    // FAT time: bits 15-11 hours, 10-5 minutes, 4-0 seconds / 2
+    sprintf(date, "%.3s, %02d %.3s %d %02d:%02d:%02d GMT", httpDays + wDay * 3, day, httpMonths + (month - 1) * 3, year,
+            pHttpCon->fileTime >> 11, (pHttpCon->fileTime >> 5) & 0x3f, (pHttpCon->fileTime & 0x1f) * 2);
+    return true;
+}
+
+// outputs the ETag and Last-Modified headers of the requested file
+static void _HTTP_ValidatorsPut(HTTP_CONN* pHttpCon)
+{
+    char validators[HTTP_VALIDATORS_LEN];
+
+    if(pHttpCon->pFileCache != 0)
+    {   // precomputed when the file was cached
+        TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)pHttpCon->pFileCache->validators);
+        return;
+    }
+
+    _HTTP_ValidatorsFormat(pHttpCon, validators);
+    TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)validators);
+}
+
+// finds the HTTP_FILE_TYPE of a file from its extension
+static HTTP_FILE_TYPE _HTTP_FileTypeGet(const char* fileName)
+{
+    const char* ext;
+    HTTP_FILE_TYPE fileType;
+
+    ext = strrchr(fileName, '.');
+    ext = ext == 0 ? fileName : ext + 1;
+    for(fileType = HTTP_TXT; fileType < HTTP_UNKNOWN; fileType++)
+    {
+        if(strcmp(ext, httpFileExtensions[fileType]) == 0)
+        {
+            break;
+        }
+    }
+
+    return fileType;
+}
+
+// formats the headers of a GET response for a static file, after the status line;
+// they depend on the file only, except for the Connection header
+// returns the length of the formatted block
+static int _HTTP_StaticHeadersFormat(HTTP_CONN* pHttpCon, char* buff)
+{
+    int len = 0;
+
+    if(pHttpCon->fileType != HTTP_UNKNOWN)
+    {
+        len += sprintf(buff + len, "Content-Type: %s\r\n", httpContentTypes[pHttpCon->fileType]);
+    }
+    len += sprintf(buff + len, "Accept-Ranges: bytes\r\nContent-Length: %lu\r\n", (unsigned long)pHttpCon->fileSize);
+    len += _HTTP_ValidatorsFormat(pHttpCon, buff + len);
+    if(pHttpCon->fileAttr == SYS_FS_ATTR_ZIP_COMPRESSED || (pHttpCon->connFlags & HTTP_CONN_FLAG_GZIP_VARIANT) != 0)
+    {
+        len += sprintf(buff + len, "Content-Encoding: gzip\r\n");
+    }
+    if((pHttpCon->connFlags & HTTP_CONN_FLAG_VARY) != 0)
+    {
+        len += sprintf(buff + len, "Vary: Accept-Encoding\r\n");
+    }
+    len += sprintf(buff + len, "Cache-Control: max-age=%s\r\n", TCPIP_HTTP_CACHE_LEN);
+
+    return len;
+}
+
+/*****************************************************************************
+  Function:
+    static bool _HTTP_StaticHeadersPut(HTTP_CONN* pHttpCon)
+
+  Description:
+    Outputs the response headers of a static file requested with GET,
+    following the status line, with a single socket write.
+    The Content-Type, Content-Length, validators,
+    Content-Encoding and Cache-Control headers depend on the file only,
+    so they are formatted the first time the file is served
+    and kept with its file index entry.
+    The block is reused only for the same file type and gzip variant:
+    a negotiated .gz file and a direct request for it share the entry
+    but not the Content-Encoding, Vary and ETag headers.
+    Only the Connection header is added for each request.
+
+  Precondition:
+    The requested file is static; _HTTP_FileStat() succeeded.
+
+  Parameters:
+    pHttpCon  - HTTP connection
+
+  Returns:
+    true  - the headers were sent
+    false - the response is not a whole static file;
+            the headers have to be built for this request
+  ***************************************************************************/
+static bool _HTTP_StaticHeadersPut(HTTP_CONN* pHttpCon)
+{
+    HTTP_FILE_ENTRY* pEntry;
+    char*   pBlock;
+    int     hdrLen;
+    uint8_t isGzip;
+    char    hdrBuff[HTTP_STATIC_HDR_LEN];
+
+    if(pHttpCon->httpStatus != HTTP_GET || (pHttpCon->connFlags & HTTP_CONN_FLAG_RANGE) != 0 || httpFileIndex == 0)
+    {
+        return false;
+    }
+
+    if((pEntry = (HTTP_FILE_ENTRY*)_HTTP_FileIndexFind(pHttpCon->fileName)) == 0)
+    {
+        return false;
+    }
+
+    // the file type and the gzip variant are the request dependent parts of the block
+    isGzip = (pHttpCon->connFlags & HTTP_CONN_FLAG_GZIP_VARIANT) != 0;
+    if(pEntry->hdrBlock == 0 || pEntry->hdrFileType != pHttpCon->fileType || pEntry->hdrGzip != isGzip)
+    {
+        hdrLen = _HTTP_StaticHeadersFormat(pHttpCon, hdrBuff);
+        if(pEntry->hdrBlock != 0 || (pBlock = (char*)TCPIP_STACK_MALLOC_FUNC(hdrLen)) == 0)
+        {   // just this once
+            TCPIP_TCP_ArrayPut(pHttpCon->socket, (const uint8_t*)hdrBuff, hdrLen);
+            _HTTP_ConnectionPut(pHttpCon, true);
+            return true;
+        }
+        memcpy(pBlock, hdrBuff, hdrLen);
+        pEntry->hdrBlock = pBlock;
+        pEntry->hdrLen = (uint16_t)hdrLen;
+        pEntry->hdrFileType = (uint8_t)pHttpCon->fileType;
+        pEntry->hdrGzip = isGzip;
+    }
+
+    TCPIP_TCP_ArrayPut(pHttpCon->socket, (const uint8_t*)pEntry->hdrBlock, pEntry->hdrLen);
+    _HTTP_ConnectionPut(pHttpCon, true);
+    return true;
+}
+
+// formats the ETag and Last-Modified header lines of the requested file
+// returns the length of the formatted lines
+static int _HTTP_ValidatorsFormat(HTTP_CONN* pHttpCon, char* buff)
+{
+    int  len;
+    char eTag[HTTP_ETAG_LEN];
+    char date[HTTP_DATE_LEN];
+
+    _HTTP_ETagFormat(pHttpCon, eTag);
+    len = sprintf(buff, "ETag: %s\r\n", eTag);
+
+    if(_HTTP_DateFormat(pHttpCon, date))
+    {
+        len += sprintf(buff + len, "Last-Modified: %s\r\n", date);
+    }
+
+    return len;
+}
+
+/*****************************************************************************
+  Function:
+    static bool _HTTP_RangeApplies(HTTP_CONN* pHttpCon)
+
+  Description:
+    Checks if the Range header of the request is to be honored.
+    Ranges apply to static files requested with GET only.
+    A failed If-Range, a precompressed variant or a dynamic page
+    gets the whole content;
+    the range request flags are cleared then.
+
+  Precondition:
+    The request headers have been parsed.
+
+  Parameters:
+    pHttpCon  - HTTP connection
+
+  Returns:
+    true  - the ranges apply; pHttpCon->nRanges == 0 means none is satisfiable
+    false - the whole file is served
+  ***************************************************************************/
+static bool _HTTP_RangeApplies(HTTP_CONN* pHttpCon)
+{
+    if((pHttpCon->connFlags & HTTP_CONN_FLAG_RANGE_REQ) == 0)
+    {
+        return false;
+    }
+
+    if(pHttpCon->httpStatus != HTTP_GET || (pHttpCon->connFlags & (HTTP_CONN_FLAG_IF_RANGE_FAIL | HTTP_CONN_FLAG_GZIP_VARIANT)) != 0 ||
+       TCPIP_HTTP_WebPageIsDynamic(pHttpCon))
+    {
+        pHttpCon->connFlags &= ~HTTP_CONN_FLAG_RANGE_REQ;
+        return false;
+    }
+
+    return true;
+}
+
+// outputs Content-Range and Content-Length for the ranges to be sent
+static void _HTTP_RangeFramingPut(HTTP_CONN* pHttpCon)
+{
+    int      ix;
+    uint32_t bodyLen;
+    char     hdrBuff[HTTP_RANGE_PART_HDR_LEN];
+
+    if(pHttpCon->nRanges == 1)
+    {
+        sprintf(hdrBuff, "Content-Range: bytes %lu-%lu/%lu\r\n", (unsigned long)pHttpCon->rangeStart[0],
+                (unsigned long)(pHttpCon->rangeStart[0] + pHttpCon->rangeLen[0] - 1), (unsigned long)pHttpCon->fileSize);
+        TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)hdrBuff);
+        bodyLen = pHttpCon->rangeLen[0];
+    }
+    else
+    {   // multipart/byteranges: part headers, data and the closing boundary
+        bodyLen = sizeof(HTTP_RANGE_END) - 1;
+        for(ix = 0; ix < pHttpCon->nRanges; ix++)
+        {
+            bodyLen += _HTTP_RangePartHeaderFormat(pHttpCon, ix, hdrBuff) + pHttpCon->rangeLen[ix];
+        }
+    }
+
+    sprintf(hdrBuff, "Content-Length: %lu\r\n", (unsigned long)bodyLen);
+    TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)hdrBuff);
+}
+
+// formats the header preceding a part of a multipart/byteranges body
+// returns the header length
+static uint16_t _HTTP_RangePartHeaderFormat(HTTP_CONN* pHttpCon, int rangeIx, char* partHdr)
+{
+    int len;
+
+    // the CRLF ending the previous part data comes first
+    len = sprintf(partHdr, "%s--" HTTP_RANGE_BOUNDARY "\r\n", rangeIx == 0 ? "" : "\r\n");
+    if(pHttpCon->fileType != HTTP_UNKNOWN)
+    {
+        len += sprintf(partHdr + len, "Content-Type: %s\r\n", httpContentTypes[pHttpCon->fileType]);
+    }
+    len += sprintf(partHdr + len, "Content-Range: bytes %lu-%lu/%lu\r\n\r\n", (unsigned long)pHttpCon->rangeStart[rangeIx],
+                   (unsigned long)(pHttpCon->rangeStart[rangeIx] + pHttpCon->rangeLen[rangeIx] - 1), (unsigned long)pHttpCon->fileSize);
+
+    return (uint16_t)len;
+}
+
+/*****************************************************************************
+  Function:
+    static bool _HTTP_RangeSend(HTTP_CONN* pHttpCon)
+
+  Description:
+    Serves the next piece of the requested byte ranges of a static file,
+    up to the available TX FIFO space.
+    The file is positioned at the start of each range,
+    the rest of the file is never read.
+
+  Precondition:
+    pHttpCon->file has been opened for reading.
+    HTTP_CONN_FLAG_RANGE is set.
+
+  Parameters:
+    pHttpCon  - HTTP connection
+
+  Return Values:
+    true  - no TX space for the next part header, the processing loop has to be broken
+    false - processing can continue
+
+  Note:
+    the function sets the pHttpCon->TxFile.fileTxDone flag when all the ranges are sent
+  ***************************************************************************/
+static bool _HTTP_RangeSend(HTTP_CONN* pHttpCon)
+{
+    char     partHdr[HTTP_RANGE_PART_HDR_LEN];
+    uint16_t avlblBytes, hdrLen;
+    uint32_t cntr, len;
+
+    avlblBytes = TCPIP_TCP_PutIsReady(pHttpCon->socket);
+
+    if(pHttpCon->TxFile.numBytes == 0)
+    {   // current range done
+        if(pHttpCon->rangeIx == pHttpCon->nRanges)
+        {   // all ranges sent
+            if(pHttpCon->nRanges > 1)
+            {
+                if(avlblBytes < sizeof(HTTP_RANGE_END) - 1)
+                {
+                    return true;
+                }
+                TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)HTTP_RANGE_END);
+            }
+            TCPIP_TCP_Flush(pHttpCon->socket);
+            pHttpCon->TxFile.fileTxDone = 1;
+            return false;
+        }
+
+        if(pHttpCon->nRanges > 1)
+        {
+            hdrLen = _HTTP_RangePartHeaderFormat(pHttpCon, pHttpCon->rangeIx, partHdr);
+            if(avlblBytes < hdrLen)
+            {
+                return true;
+            }
+            TCPIP_TCP_ArrayPut(pHttpCon->socket, (const uint8_t*)partHdr, hdrLen);
+            avlblBytes -= hdrLen;
+        }
+
+        pHttpCon->TxFile.bytesReadCount = pHttpCon->rangeStart[pHttpCon->rangeIx];
+        pHttpCon->TxFile.numBytes = pHttpCon->rangeLen[pHttpCon->rangeIx];
+        pHttpCon->rangeIx++;
+    }
+
+    // read only what the socket can take, no seeking back
+    cntr = mMIN(pHttpCon->TxFile.numBytes, httpFileBuffSize);
+    cntr = mMIN(cntr, avlblBytes);
+    if(cntr == 0)
+    {
+        return false;
+    }
+
+    if(pHttpCon->fileData != 0)
+    {   // straight from the mapped image
+        len = TCPIP_TCP_ArrayPut(pHttpCon->socket, pHttpCon->fileData + pHttpCon->TxFile.bytesReadCount, cntr);
+    }
+    else
+    {
+        len = _HTTP_FileReadAt(pHttpCon->file, pHttpCon->TxFile.bytesReadCount, httpFileBuff, cntr);
+        if(len != cntr)
+        {   // the client won't get the announced body; don't reuse the connection
+            pHttpCon->connFlags &= ~HTTP_CONN_FLAG_KEEP_ALIVE;
+            pHttpCon->TxFile.fileTxDone = 1;
+            return false;
+        }
+        TCPIP_TCP_ArrayPut(pHttpCon->socket, httpFileBuff, len);
+    }
+    pHttpCon->TxFile.numBytes -= len;
+    pHttpCon->TxFile.bytesReadCount += len;
+
+    return false;
+}
+
+// writes the size line of a chunk
+static void _HTTP_ChunkHeaderPut(HTTP_CONN* pHttpCon, uint16_t chunkSize)
+{
+    char hdrBuff[8];
+
+    sprintf(hdrBuff, "%x\r\n", chunkSize);
+    TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)hdrBuff);
+}
+
+/*****************************************************************************
+  Function:
+    static uint16_t _HTTP_DynWrite(HTTP_CONN* pHttpCon, const uint8_t* buffer, uint16_t size)
+
+  Description:
+    Writes response body data to the connection.
+    For a chunked response the data is coalesced in the connection
+    chunk buffer. When the buffer cannot hold the data, the pending data
+    and the new data are sent as one chunk, space permitting.
+    Otherwise the data is written directly to the socket.
+
+  Precondition:
+    None
+
+  Parameters:
+    pHttpCon - HTTP connection
+    buffer   - data to write
+    size     - number of bytes in buffer
+
+  Returns:
+    Number of bytes accepted.
+  ***************************************************************************/
+static uint16_t _HTTP_DynWrite(HTTP_CONN* pHttpCon, const uint8_t* buffer, uint16_t size)
+{
+    uint16_t avlbSize;
+
+    if((pHttpCon->connFlags & HTTP_CONN_FLAG_CHUNKED) == 0)
+    {
+        return TCPIP_TCP_ArrayPut(pHttpCon->socket, buffer, size);
+    }
+
+    if(pHttpCon->chunkLen + size > HTTP_CHUNK_BUFFER_SIZE)
+    {
+        avlbSize = TCPIP_TCP_PutIsReady(pHttpCon->socket);
+        if(avlbSize >= pHttpCon->chunkLen + size + HTTP_CHUNK_OVERHEAD)
+        {   // send everything as one chunk
+            _HTTP_ChunkHeaderPut(pHttpCon, pHttpCon->chunkLen + size);
+            TCPIP_TCP_ArrayPut(pHttpCon->socket, pHttpCon->chunkBuff, pHttpCon->chunkLen);
+            TCPIP_TCP_ArrayPut(pHttpCon->socket, buffer, size);
+            TCPIP_TCP_ArrayPut(pHttpCon->socket, HTTP_CRLF, HTTP_CRLF_LEN);
+            pHttpCon->chunkLen = 0;
+            return size;
+        }
+
+        // make room, then buffer as much as possible
+        _HTTP_ChunkFlush(pHttpCon);
+        if(pHttpCon->chunkLen + size > HTTP_CHUNK_BUFFER_SIZE)
+        {
+            size = HTTP_CHUNK_BUFFER_SIZE - pHttpCon->chunkLen;
+        }
+    }
+
+    memcpy(pHttpCon->chunkBuff + pHttpCon->chunkLen, buffer, size);
+    pHttpCon->chunkLen += size;
+    return size;
+}
+
+// returns the number of bytes that _HTTP_DynWrite() can accept
+static uint16_t _HTTP_DynWriteIsReady(HTTP_CONN* pHttpCon)
+{
+    uint16_t avlbSize, buffSize;
+
+    avlbSize = TCPIP_TCP_PutIsReady(pHttpCon->socket);
+    if((pHttpCon->connFlags & HTTP_CONN_FLAG_CHUNKED) == 0)
+    {
+        return avlbSize;
+    }
+
+    buffSize = HTTP_CHUNK_BUFFER_SIZE - pHttpCon->chunkLen;
+    if(avlbSize > pHttpCon->chunkLen + HTTP_CHUNK_OVERHEAD + buffSize)
+    {   // a direct chunk can take more than the buffer
+        return avlbSize - pHttpCon->chunkLen - HTTP_CHUNK_OVERHEAD;
+    }
+
+    return buffSize;
+}
+
+// sends the data pending in the chunk buffer
+// returns false if there's not enough room in the socket
+static bool _HTTP_ChunkFlush(HTTP_CONN* pHttpCon)
+{
+    if(pHttpCon->chunkLen == 0)
+    {
+        return true;
+    }
+
+    if(TCPIP_TCP_PutIsReady(pHttpCon->socket) < pHttpCon->chunkLen + HTTP_CHUNK_OVERHEAD)
+    {
+        return false;
+    }
+
+    _HTTP_ChunkHeaderPut(pHttpCon, pHttpCon->chunkLen);
+    TCPIP_TCP_ArrayPut(pHttpCon->socket, pHttpCon->chunkBuff, pHttpCon->chunkLen);
+    TCPIP_TCP_ArrayPut(pHttpCon->socket, HTTP_CRLF, HTTP_CRLF_LEN);
+    pHttpCon->chunkLen = 0;
+    return true;
+}
+
+// sends the pending data and the last chunk of a chunked response
+// returns false if there's not enough room in the socket
+static bool _HTTP_ChunkEnd(HTTP_CONN* pHttpCon)
+{
+    if(TCPIP_TCP_PutIsReady(pHttpCon->socket) < pHttpCon->chunkLen + HTTP_CHUNK_OVERHEAD + sizeof(HTTP_LAST_CHUNK) - 1)
+    {
+        return false;
+    }
+
+    _HTTP_ChunkFlush(pHttpCon);
+    TCPIP_TCP_StringPut(pHttpCon->socket, HTTP_LAST_CHUNK);
+    TCPIP_TCP_Flush(pHttpCon->socket);
+    pHttpCon->connFlags &= ~HTTP_CONN_FLAG_CHUNKED;
+    return true;
+}
+
+// orders the route index by path hash
+static int _HTTP_RouteEntryCompare(const void* p1, const void* p2)
+{
+    return (int)((const HTTP_ROUTE_ENTRY*)p1)->nameHash - (int)((const HTTP_ROUTE_ENTRY*)p2)->nameHash;
+}
+
+/*****************************************************************************
+  Function:
+    static const HTTP_ROUTE* _HTTP_RouteFind(HTTP_CONN* pHttpCon, const char* path)
+
+  Description:
+    Looks up the route of a request path.
+    The exact routes are searched by the path hash, the same way
+    as the file index. The pattern routes are matched after, in table order.
+    The path of a routed request is kept in fileName,
+    for the path parameters.
+
+  Precondition:
+    None
+
+  Parameters:
+    pHttpCon  - HTTP connection
+    path      - decoded request path, without the leading '/'
+
+  Returns:
+    The route; 0 if no route matches.
+  ***************************************************************************/
+static const HTTP_ROUTE* _HTTP_RouteFind(HTTP_CONN* pHttpCon, const char* path)
+{
+    const HTTP_ROUTE* pRoute = 0;
+    uint16_t    nameHash;
+    int         low, high, mid;
+
+    pHttpCon->routeNParams = 0;
+    if(httpRouteCount == 0 || strlen(path) >= sizeof(pHttpCon->fileName))
+    {
+        return 0;
+    }
+
+    nameHash = _HTTP_NameHash(path);
+    low = 0;
+    high = httpRouteExactCount;
+    while(low < high)
+    {   // find the first entry with this hash
+        mid = (low + high) / 2;
+        if(httpRouteIndex[mid].nameHash < nameHash)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    for(; low < httpRouteExactCount && httpRouteIndex[low].nameHash == nameHash; low++)
+    {
+        if(strcmp(httpRoutes[httpRouteIndex[low].routeIx].path, path) == 0)
+        {
+            pRoute = httpRoutes + httpRouteIndex[low].routeIx;
+            break;
+        }
+    }
+
+    for(low = httpRouteExactCount; pRoute == 0 && low < httpRouteCount; low++)
+    {
+        if(_HTTP_RouteMatch(pHttpCon, httpRoutes[httpRouteIndex[low].routeIx].path, path))
+        {
+            pRoute = httpRoutes + httpRouteIndex[low].routeIx;
+        }
+    }
+
+    if(pRoute != 0)
+    {
+        strcpy(pHttpCon->fileName, path);
+    }
+    return pRoute;
+}
+
+// matches a path against a route pattern, recording the path parameters
+static bool _HTTP_RouteMatch(HTTP_CONN* pHttpCon, const char* pattern, const char* path)
+{
+    const char* pathStart = path;
+    const char* pParam;
+
+    pHttpCon->routeNParams = 0;
+    while(*pattern != '\0')
+    {
+        if(*pattern == ':' || (*pattern == '*' && pattern[1] == '\0'))
+        {
+            if(pHttpCon->routeNParams == TCPIP_HTTP_ROUTE_MAX_PARAMS)
+            {
+                return false;
+            }
+
+            pParam = path;
+            if(*pattern++ == '*')
+            {   // the rest of the path, may be empty
+                path += strlen(path);
+            }
+            else
+            {   // a whole segment, not empty
+                while(*path != '\0' && *path != '/')
+                {
+                    path++;
+                }
+                while(*pattern != '\0' && *pattern != '/')
+                {
+                    pattern++;
+                }
+                if(path == pParam)
+                {
+                    return false;
+                }
+            }
+
+            pHttpCon->routeParamOff[pHttpCon->routeNParams] = (uint16_t)(pParam - pathStart);
+            pHttpCon->routeParamLen[pHttpCon->routeNParams] = (uint16_t)(path - pParam);
+            pHttpCon->routeNParams++;
+            continue;
+        }
+
+        if(*pattern++ != *path++)
+        {
+            return false;
+        }
+    }
+
+    return *path == '\0';
+}
+
+/*****************************************************************************
+  Function:
+    static bool _HTTP_RouteSend(HTTP_CONN* pHttpCon)
+
+  Description:
+    Calls the route handler to write the response body.
+    The handler is called once per pass until it returns HTTP_IO_DONE.
+
+  Precondition:
+    None
+
+  Parameters:
+    pHttpCon  - HTTP connection
+
+  Returns:
+    true  - TCPIP_HTTP_ProcessConnection needs to return to the main loop
+    false - TCPIP_HTTP_ProcessConnection can continue, no break needed
+
+  Note:
+    the function sets the pHttpCon->TxFile.fileTxDone flag when the handler is done
+    and its output sent
+  ***************************************************************************/
+static bool _HTTP_RouteSend(HTTP_CONN* pHttpCon)
+{
+    // the output left from the previous call goes first
+    if(!_HTTP_OutBuffDrain(pHttpCon))
+    {
+        return true;
+    }
+
+    if(pHttpCon->file_sm == SM_ROUTE_HANDLER)
+    {
+        if((*pHttpCon->pRoute->handler)(pHttpCon) != HTTP_IO_DONE)
+        {
+            return true;
+        }
+        pHttpCon->file_sm = SM_ROUTE_DONE;
+        if(!_HTTP_OutBuffDrain(pHttpCon))
+        {
+            return true;
+        }
+    }
+
+    TCPIP_TCP_Flush(pHttpCon->socket);
+    pHttpCon->file_sm = SM_IDLE;
+    pHttpCon->TxFile.fileTxDone = 1;
+    return false;
+}
+
+#if defined(TCPIP_HTTP_USE_SSE)
+// checks if a request is for a registered event stream
+// returns 1 + index of the path; 0 if it's not an event stream
+static uint8_t _HTTP_SSEPathFind(HTTP_CONN* pHttpCon)
+{
+    int ix;
+
+    if(pHttpCon->httpStatus != HTTP_GET || (pHttpCon->connFlags & HTTP_CONN_FLAG_HEAD) != 0)
+    {
+        return 0;
+    }
+
+    for(ix = 0; ix < TCPIP_HTTP_SSE_MAX_PATHS; ix++)
+    {   // the path follows the leading '/'
+        if(httpSSEPaths[ix] != 0 && strcmp(httpSSEPaths[ix], (const char*)pHttpCon->data + 1) == 0)
+        {
+            return (uint8_t)(ix + 1);
+        }
+    }
+
+    return 0;
+}
+
+/*****************************************************************************
+  Function:
+    static void _HTTP_SSEProcess(HTTP_CONN* pHttpCon)
+
+  Description:
+    Serves an open event stream:
+    calls TCPIP_HTTP_SSETaskCallback() to let the application send events,
+    then flushes all the events sent since the last pass at once.
+    A comment line is sent when the stream was idle
+    for TCPIP_HTTP_SSE_KEEP_ALIVE seconds.
+
+  Precondition:
+    The event stream response headers were sent.
+
+  Parameters:
+    pHttpCon  - HTTP connection
+
+  Returns:
+    None
+  ***************************************************************************/
+static void _HTTP_SSEProcess(HTTP_CONN* pHttpCon)
+{
+    // the client has nothing to say on an event stream
+    TCPIP_TCP_Discard(pHttpCon->socket);
+
+    if(TCPIP_HTTP_SSETaskCallback(pHttpCon, pHttpCon->sseIx - 1) != 0)
+    {
+        TCPIP_TCP_Flush(pHttpCon->socket);
+        pHttpCon->sm = SM_HTTP_DISCONNECT;
+        return;
+    }
+
+    if((pHttpCon->connFlags & HTTP_CONN_FLAG_SSE_PENDING) == 0 && TCPIP_HTTP_SSE_KEEP_ALIVE != 0 &&
+       (int32_t)(SYS_TMR_TickCountGet() - pHttpCon->httpTick) > 0 && TCPIP_TCP_PutIsReady(pHttpCon->socket) >= 3)
+    {
+        TCPIP_TCP_ArrayPut(pHttpCon->socket, (const uint8_t*)":\n\n", 3);
+        pHttpCon->connFlags |= HTTP_CONN_FLAG_SSE_PENDING;
+    }
+
+    if((pHttpCon->connFlags & HTTP_CONN_FLAG_SSE_PENDING) != 0)
+    {
+        TCPIP_TCP_Flush(pHttpCon->socket);
+        pHttpCon->connFlags &= ~HTTP_CONN_FLAG_SSE_PENDING;
+        pHttpCon->httpTick = SYS_TMR_TickCountGet() + TCPIP_HTTP_SSE_KEEP_ALIVE * SYS_TMR_TickCounterFrequencyGet();
+    }
+}
+#endif  // defined(TCPIP_HTTP_USE_SSE)
+
+#if (TCPIP_HTTP_OUTPUT_BUFFERS != 0)
+/*****************************************************************************
+  Function:
+    static uint16_t _HTTP_OutBuffWrite(HTTP_CONN* pHttpCon, const uint8_t* buffer, uint16_t size)
+
+  Description:
+    Writes the output of a dynamic variable callback.
+    What the socket cannot take is kept in an output buffer taken from
+    the pool and sent by TCPIP_HTTP_FileSend() before the page continues,
+    so a callback whose output fits can complete in one call.
+    Once a buffer is taken, all the following output goes to it,
+    to keep the data in order.
+
+  Precondition:
+    None
+
+  Parameters:
+    pHttpCon - HTTP connection
+    buffer   - data to be written
+    size     - number of bytes in buffer
+
+  Returns:
+    Number of bytes accepted.
+    Less than size only if the pool is exhausted or the buffer is full.
+  ***************************************************************************/
+static uint16_t _HTTP_OutBuffWrite(HTTP_CONN* pHttpCon, const uint8_t* buffer, uint16_t size)
+{
+    uint16_t nSent = 0;
+    uint16_t nKept;
+
+    if(pHttpCon->outBuff == 0)
+    {   // nothing pending, write directly
+        nSent = _HTTP_DynWrite(pHttpCon, buffer, size);
+        if(nSent == size || httpOutBuffFreeCount == 0)
+        {
+            return nSent;
+        }
+        pHttpCon->outBuff = httpOutBuffFree[--httpOutBuffFreeCount];
+        pHttpCon->outOffset = 0;
+        pHttpCon->outLen = 0;
+    }
+
+    nKept = mMIN(size - nSent, TCPIP_HTTP_OUTPUT_BUFFER_SIZE - pHttpCon->outOffset - pHttpCon->outLen);
+    memcpy(pHttpCon->outBuff + pHttpCon->outOffset + pHttpCon->outLen, buffer + nSent, nKept);
+    pHttpCon->outLen += nKept;
+    return nSent + nKept;
+}
+
+// sends the callback output kept in the connection output buffer
+// the buffer goes back to the pool once empty
+// returns true if no output is pending
+static bool _HTTP_OutBuffDrain(HTTP_CONN* pHttpCon)
+{
+    uint16_t nSent;
+
+    if(pHttpCon->outBuff == 0)
+    {
+        return true;
+    }
+
+    nSent = _HTTP_DynWrite(pHttpCon, pHttpCon->outBuff + pHttpCon->outOffset, pHttpCon->outLen);
+    pHttpCon->outOffset += nSent;
+    pHttpCon->outLen -= nSent;
+    if(pHttpCon->outLen != 0)
+    {
+        return false;
+    }
+
+    _HTTP_OutBuffRelease(pHttpCon);
+    return true;
+}
+
+// returns the connection output buffer to the pool; pending output is discarded
+static void _HTTP_OutBuffRelease(HTTP_CONN* pHttpCon)
+{
+    if(pHttpCon->outBuff != 0)
+    {
+        httpOutBuffFree[httpOutBuffFreeCount++] = pHttpCon->outBuff;
+        pHttpCon->outBuff = 0;
+        pHttpCon->outLen = 0;
+    }
+}
+#endif  // (TCPIP_HTTP_OUTPUT_BUFFERS != 0)
+
+/*****************************************************************************
+  Function:
+    static void HTTPHeaderParseLookup(HTTP_CONN* pHttpCon, int i)
+
+  Description:
+    Calls the appropriate header parser based on the index of the header
+    that was read from the request.
+
+  Precondition:
+    None
+
+  Parameters:
+    i - the index of the string found in HTTPRequestHeaders
+
+  Return Values:
+    true - the end of the file was reached and reading is done
+    false - more data remains to be read
+  ***************************************************************************/
+static void _HTTP_HeaderParseLookup(HTTP_CONN* pHttpCon, int i)
+{
+    // i corresponds to an index in HTTPRequestHeaders
+
+#if defined(TCPIP_HTTP_USE_COOKIES)
+    if(i == 0u)
+    {
+        _HTTP_HeaderParseCookie(pHttpCon);
+        return;
+    }
+#endif
+
+#if defined(TCPIP_HTTP_USE_AUTHENTICATION)    
+    if(i == 1u)
+    {
+        _HTTP_HeaderParseAuthorization(pHttpCon);
+        return;
+    }
+#endif
+
+#if defined(TCPIP_HTTP_USE_POST)
+    if(i == 2u)
+    {
+        _HTTP_HeaderParseContentLength(pHttpCon);
+        return;
+    }
+#endif
+
+#if defined(TCPIP_HTTP_USE_WEBSOCKETS)
+    if(i == 3u)
+    {
+        _HTTP_HeaderParseWebsocketKey(pHttpCon);
+        return;
+    }
+#endif
+
+    if(i == 4u)
+    {
+        _HTTP_HeaderParseConnection(pHttpCon);
+        return;
+    }
+
+    if(i == 5u)
+    {
+        _HTTP_HeaderParseIfNoneMatch(pHttpCon);
+        return;
+    }
+
+    if(i == 6u)
+    {
+        _HTTP_HeaderParseIfModifiedSince(pHttpCon);
+        return;
+    }
+
+    if(i == 7u)
+    {
+        _HTTP_HeaderParseRange(pHttpCon);
+        return;
+    }
+
+    if(i == 8u)
+    {
+        _HTTP_HeaderParseIfRange(pHttpCon);
+        return;
+    }
+
+    if(i == 9u)
+    {
+        _HTTP_HeaderParseAcceptEncoding(pHttpCon);
+        return;
+    }
+
+#if defined(TCPIP_HTTP_USE_MULTIPART)
+    if(i == 10u)
+    {
+        _HTTP_HeaderParseContentType(pHttpCon);
+        return;
+    }
+#endif
+}
+
+/*****************************************************************************
+  Function:
+    static void HTTPHeaderParseAuthorization(HTTP_CONN* pHttpCon)
+
+  Summary:
+    Parses the "Authorization:" header for a request and verifies the
+    credentials.
+
+  Description:
+    Parses the "Authorization:" header for a request.  For example, 
+    "BASIC YWRtaW46cGFzc3dvcmQ=" is decoded to a user name of "admin" and
+    a password of "password".  Once read, TCPIP_HTTP_UserAuthenticate is called from
+    custom_http_app.c to determine if the credentials are acceptable.
+
+    The return value of TCPIP_HTTP_UserAuthenticate is saved in pHttpCon->isAuthorized for
+    later use by the application.
+
+  Precondition:
+    None
+
+  Parameters:
+    None
+
+  Returns:
+    None
+
+  Remarks:
+    This function is ony available when TCPIP_HTTP_USE_AUTHENTICATION is defined.
+  ***************************************************************************/
+#if defined(TCPIP_HTTP_USE_AUTHENTICATION)
+static void _HTTP_HeaderParseAuthorization(HTTP_CONN* pHttpCon)
+{
+    uint16_t len;
+    uint8_t buf[40];
+    uint8_t *ptrBuf;
+
+    // If auth processing is not required, return
+    if(pHttpCon->isAuthorized & 0x80)
+        return;
+
+    // Clear the auth type ("BASIC ")
+    TCPIP_TCP_ArrayGet(pHttpCon->socket, NULL, 6);
+
+    // Find the terminating CRLF and make sure it's a multiple of four
+    len = TCPIP_TCP_ArrayFind(pHttpCon->socket, HTTP_CRLF, HTTP_CRLF_LEN, 0, 0, false);
+    len += 3;
+    len &= 0xfc;
+    len = mMIN(len, sizeof(buf)-4);
+
+    // Read in 4 bytes at a time and decode (slower, but saves RAM)
+    for(ptrBuf = buf; len > 0u; len-=4, ptrBuf+=3)
+    {
+        TCPIP_TCP_ArrayGet(pHttpCon->socket, ptrBuf, 4);
+        TCPIP_Helper_Base64Decode(ptrBuf, 4, ptrBuf, 3);
+    }
+
+    // Null terminate both, and make sure there's at least two terminators
+    *ptrBuf = '\0';
+    for(len = 0, ptrBuf = buf; len < sizeof(buf); len++, ptrBuf++)
+        if(*ptrBuf == ':')
+            break;
+    *(ptrBuf++) = '\0';
+
+    // Verify credentials
+    pHttpCon->isAuthorized = TCPIP_HTTP_UserAuthenticate(pHttpCon, buf, ptrBuf);
+
+    return;
+}
+#endif
+
+/*****************************************************************************
+  Function:
+    static void HTTPHeaderParseCookie(HTTP_CONN* pHttpCon)
+
+  Summary:
+    Parses the "Cookie:" headers for a request and stores them as GET
+    variables.
+
+  Description:
+    Parses the "Cookie:" headers for a request.  For example, 
+    "Cookie: name=Wile+E.+Coyote; order=ROCKET_LAUNCHER" is decoded to 
+    "name=Wile+E.+Coyote&order=ROCKET_LAUNCHER&" and stored as any other 
+    GET variable in pHttpCon->data.
+
+    The user application can easily access these values later using the
+    TCPIP_HTTP_ArgGet() and TCPIP_HTTP_ArgGet() functions.
+
+  Precondition:
+    None
+
+  Parameters:
+    None
+
+  Returns:
+    None
+
+  Remarks:
+    This function is ony available when TCPIP_HTTP_USE_COOKIES is defined.
+  ***************************************************************************/
+#if defined(TCPIP_HTTP_USE_COOKIES)
+static void _HTTP_HeaderParseCookie(HTTP_CONN* pHttpCon)
+{
+    uint16_t lenA, lenB;
+
+    // Verify there's enough space
+    lenB = TCPIP_TCP_ArrayFind(pHttpCon->socket, HTTP_CRLF, HTTP_CRLF_LEN, 0, 0, false);
+    if(lenB >= (uint16_t)(pHttpCon->data + httpConnDataSize - pHttpCon->ptrData - 2))
+    {// If not, overflow
+        pHttpCon->httpStatus = HTTP_OVERFLOW;
+        pHttpCon->sm = SM_HTTP_SERVE_HEADERS;
+        return;
+    }
+
+    // While a CRLF is not immediate, grab a cookie value
+    while(lenB != 0u)
+    {
+        // Look for a ';' and use the shorter of that or a CRLF
+        lenA = TCPIP_TCP_Find(pHttpCon->socket, ';', 0, 0, false);
+
+        // Read to the terminator
+        pHttpCon->ptrData += TCPIP_TCP_ArrayGet(pHttpCon->socket, pHttpCon->ptrData, mMIN(lenA, lenB));
+
+        // Insert an & to anticipate another cookie
+        *(pHttpCon->ptrData++) = '&';
+
+        // If semicolon, trash it and whitespace
+        if(lenA < lenB)
+        {
+            TCPIP_TCP_Get(pHttpCon->socket, NULL);
+            while(TCPIP_TCP_Find(pHttpCon->socket, ' ', 0, 0, false) == 0u)
+                TCPIP_TCP_Get(pHttpCon->socket, NULL);
+        }
+
+        // Find the new distance to the CRLF
+        lenB = TCPIP_TCP_ArrayFind(pHttpCon->socket, HTTP_CRLF, HTTP_CRLF_LEN, 0, 0, false);
+    }
+
+    return;
+
+}
+#endif
+
+/*****************************************************************************
+  Function:
+    static void HTTPHeaderParseContentLength(HTTP_CONN* pHttpCon)
+
+  Summary:
+    Parses the "Content-Length:" header for a request.
+
+  Description:
+    Parses the "Content-Length:" header to determine how many bytes of
+    POST data to expect after the request.  This value is stored in 
+    pHttpCon->byteCount.
+
+  Precondition:
+    None
+
+  Parameters:
+    None
+
+  Returns:
+    None
+
+  Remarks:
+    This function is ony available when TCPIP_HTTP_USE_POST is defined.
+  ***************************************************************************/
+#if defined(TCPIP_HTTP_USE_POST)
+static void _HTTP_HeaderParseContentLength(HTTP_CONN* pHttpCon)
+{
+    uint16_t len;
+    uint8_t buf[10];
+
+    // Read up to the CRLF (max 9 bytes or ~1GB)
+    len = TCPIP_TCP_ArrayFind(pHttpCon->socket, HTTP_CRLF, HTTP_CRLF_LEN, 0, 0, false);
+    if(len >= sizeof(buf))
+    {
+        pHttpCon->httpStatus = HTTP_BAD_REQUEST;
+        pHttpCon->byteCount = 0;
+        return;
+    }   
+    len = TCPIP_TCP_ArrayGet(pHttpCon->socket, buf, len);
+    buf[len] = '\0';
+
+    pHttpCon->byteCount = atol((char*)buf);
+}
+#endif
+
+/*****************************************************************************
+  Function:
+    static void _HTTP_HeaderParseWebsocketKey(void)
+  Summary:
+    Parses the "Sec-Websocket-Key:" header for a the Websocket Key.
+  Description:
+    Parses the "Sec-Websocket-Key:" header to determine the Websocket
+        Handshake Key.
+  Precondition:
+    None
+  Parameters:
+    None
+  Returns:
+    None
+  Remarks:
+    This function is only available when TCPIP_HTTP_USE_WEBSOCKETS is defined.
+  ***************************************************************************/
+#if defined(TCPIP_HTTP_USE_WEBSOCKETS)
+static void _HTTP_HeaderParseWebsocketKey(HTTP_CONN* pHttpCon)
+{
+    uint16_t index;
+    uint16_t length;
+    uint8_t buffer[WS_KEY_LENGTH];
+    
+    // Read up to the CRLF (should be 24 bytes)
+    length = TCPIP_TCP_ArrayFind(pHttpCon->socket, HTTP_CRLF, HTTP_CRLF_LEN, 0, 0, false);
+    
+    if (length != WS_KEY_LENGTH) {
+        pHttpCon->httpStatus = HTTP_BAD_REQUEST;
+        pHttpCon->byteCount  = 0;
+        return;
+    }
+    
+    length = TCPIP_TCP_ArrayGet(pHttpCon->socket, buffer, length);
+    
+    for (index = 0; index < length; index++) {
+        pHttpCon->webSocketKey[index] = buffer[index];
+    }
+    
+    TCPIP_TCP_FifoSizeAdjust(pHttpCon->socket, 1, 0, TCP_ADJUST_PRESERVE_RX);
+    pHttpCon->sm            = SM_HTTP_INIT_WEBSOCKET;
+    pHttpCon->httpStatus    = HTTP_WEBSOCKET_FRAME;
+}
+#endif
+
+/*****************************************************************************
+  Function:
+    static void _HTTP_HeaderParseContentType(HTTP_CONN* pHttpCon)
 
-        case SM_PARSE_DYN_VAR_STRING:
-            len = SYS_FS_FileRead(pHttpCon->file, sendDataBuffer, 1);
-            _HTTP_FileRdCheck(len==1, __FILE__, __LINE__);
-            pHttpCon->TxFile.numBytes-=1;
-            pHttpCon->TxFile.bytesReadCount+=1;
-            if(sendDataBuffer[0]=='~')
-            {
-                do
-                {
-                    len = SYS_FS_FileRead(pHttpCon->file, sendDataBuffer, 1);
-                    _HTTP_FileRdCheck(len==1, __FILE__, __LINE__);
-                    pHttpCon->TxFile.numBytes-=1;
-                    pHttpCon->TxFile.bytesReadCount+=1;
-                }
-                while(sendDataBuffer[0]!='~');
-            }
+  Summary:
+    Parses the "Content-Type:" header for a multipart/form-data boundary.
 
-            //Continue to next state to process the dynamic variable callback
-            pHttpCon->file_sm =SM_PROCESS_DYN_VAR_CALLBACK;
-            pHttpCon->TxFile.EndOfCallBackFileFlag = true;
+  Description:
+    A multipart/form-data request gets a parser for its body,
+    with the delimiter "\r\n--boundary" and its Boyer-Moore-Horspool
+    shift table.
+    Any other content type is left to the application.
 
-        case SM_PROCESS_DYN_VAR_CALLBACK:
+  Precondition:
+    None
 
-            TCPIP_HTTP_Print(pHttpCon, pHttpCon->TxFile.dynVarCallBackID);
+  Parameters:
+    None
 
-            if(pHttpCon->TxFile.EndOfCallBackFileFlag == true)
-            {
-                pHttpCon->TxFile.dynVarCntr-=1;
-                pHttpCon->file_sm=SM_GET_DYN_VAR_FILE_RCRD;
-                if(pHttpCon->TxFile.dynVarCntr == 0)
-                {       
-                    if (pHttpCon->TxFile.numBytes != 0)
-                    {
-                        pHttpCon->file_sm =SM_SERVE_TEXT_DATA;
-                    }
-                    pHttpCon->TxFile.lock_dynrcd = 0;
-                }
-            }
-            else if (pHttpCon->callbackPos != 0 && pHttpCon->callbackPos != -1)
-            {
-                needBreak = true;
-            }
+  Returns:
+    None
 
-            break;
+  Remarks:
+    This function is only available when TCPIP_HTTP_USE_MULTIPART is defined.
+  ***************************************************************************/
+#if defined(TCPIP_HTTP_USE_MULTIPART)
+static void _HTTP_HeaderParseContentType(HTTP_CONN* pHttpCon)
+{
+    HTTP_MULTIPART_DCPT* pDcpt;
+    uint8_t boundary[HTTP_MULTIPART_DELIM_MAX - 4];
+    uint16_t len, pos, bndLen;
+    uint8_t c;
+    bool quoted;
+    int ix;
 
-        case SM_SERVE_TEXT_DATA:
+    len = TCPIP_TCP_ArrayFind(pHttpCon->socket, HTTP_CRLF, HTTP_CRLF_LEN, 0, 0, false);
+    if(TCPIP_TCP_ArrayFind(pHttpCon->socket, (const uint8_t*)"multipart/form-data", 19, 0, len, true) == 0xffff)
+    {
+        return;
+    }
 
-            // If HashIndex do not match,that means no entry in the "FilRcrd.bin", means no dynamic variables for this wepage,
-            //then proceed to serve the page as normal HTML text
+    pos = TCPIP_TCP_ArrayFind(pHttpCon->socket, (const uint8_t*)"boundary=", 9, 0, len, true);
+    if(pos == 0xffff)
+    {
+        return;
+    }
 
-            TCPIP_TCP_PutIsReady(pHttpCon->socket);
-            
-            if (pHttpCon->TxFile.numBytes >= sizeof(sendDataBuffer))
-            {
-                cntr = sizeof(sendDataBuffer);
-            }
-            else
-            {
-                cntr = pHttpCon->TxFile.numBytes;
-            }
-            len = SYS_FS_FileRead(pHttpCon->file, sendDataBuffer, cntr);
-            _HTTP_FileRdCheck(len==cntr, __FILE__, __LINE__);
-            bytesPut = TCPIP_TCP_ArrayPut(pHttpCon->socket, sendDataBuffer, len);
-            if (bytesPut != len)
-            {
-                // we didn't transmit the entire buffer, so we have to seek backwards.
-                SYS_FS_FileSeek(pHttpCon->file, 0 - (len - bytesPut), SYS_FS_SEEK_CUR);
-            }
-            pHttpCon->TxFile.numBytes -=bytesPut;
-            pHttpCon->TxFile.bytesReadCount+=bytesPut;
+    // the boundary is either a token or a quoted string
+    pos += 9;
+    quoted = pos < len && TCPIP_TCP_Peek(pHttpCon->socket, pos) == '"';
+    if(quoted)
+    {
+        pos++;
+    }
 
+    for(bndLen = 0; pos < len; pos++)
+    {
+        c = TCPIP_TCP_Peek(pHttpCon->socket, pos);
+        if(quoted ? c == '"' : (c == ';' || c == ' ' || c == '\t'))
+        {
             break;
+        }
+        if(bndLen == sizeof(boundary))
+        {   // longer than allowed
+            return;
+        }
+        boundary[bndLen++] = c;
+    }
 
-        default:
-            return false;
+    if(bndLen == 0)
+    {
+        return;
     }
 
-    if((((pHttpCon->TxFile.numBytes == 0)) && (pHttpCon->TxFile.EndOfCallBackFileFlag == true)) \
-        || (fileErr==1))    // Exception on file reading
+    if(pHttpCon->pMultipart == 0)
     {
-        TCPIP_TCP_Flush(pHttpCon->socket);
+        pHttpCon->pMultipart = (HTTP_MULTIPART_DCPT*)TCPIP_STACK_MALLOC_FUNC(sizeof(*pHttpCon->pMultipart));
+        if(pHttpCon->pMultipart == 0)
+        {
+            return;
+        }
+    }
 
-        pHttpCon->TxFile.nameHashMatched = false;
-        pHttpCon->TxFile.lock_dynrcd = 0;
-        pHttpCon->TxFile.dynVarCallBackID = 0;
-        pHttpCon->TxFile.DynRcrdRdCount = 0;
-        
-        pHttpCon->TxFile.bytesReadCount=0;
-        pHttpCon->file_sm=SM_IDLE;
-        pHttpCon->TxFile.fileTxDone = 1;
+    pDcpt = pHttpCon->pMultipart;
+    memcpy(pDcpt->delim, "\r\n--", 4);
+    memcpy(pDcpt->delim + 4, boundary, bndLen);
+    pDcpt->delimLen = 4 + bndLen;
+    pDcpt->state = HTTP_MULTIPART_PREAMBLE;
 
-        fileErr = 0;
-        return false;
+    // shift by the distance from the last occurrence to the end of the delimiter
+    memset(pDcpt->skip, pDcpt->delimLen, sizeof(pDcpt->skip));
+    for(ix = 0; ix < pDcpt->delimLen - 1; ix++)
+    {
+        pDcpt->skip[pDcpt->delim[ix]] = pDcpt->delimLen - 1 - ix;
     }
+}
 
-    return needBreak ? true : false;
-
+// frees the multipart/form-data parser of a connection
+static void _HTTP_MultipartRelease(HTTP_CONN* pHttpCon)
+{
+    if(pHttpCon->pMultipart != 0)
+    {
+        TCPIP_STACK_FREE_FUNC(pHttpCon->pMultipart);
+        pHttpCon->pMultipart = 0;
+    }
 }
+#endif  // defined(TCPIP_HTTP_USE_MULTIPART)
 
 /*****************************************************************************
   Function:
-    static void HTTPHeaderParseLookup(HTTP_CONN* pHttpCon, int i)
+    static void _HTTP_HeaderParseConnection(HTTP_CONN* pHttpCon)
+
+  Summary:
+    Parses the "Connection:" header for a request.
 
   Description:
-    Calls the appropriate header parser based on the index of the header
-    that was read from the request.
+    Checks if the client asks for the connection to be closed
+    after the response.
 
   Precondition:
     None
 
   Parameters:
-    i - the index of the string found in HTTPRequestHeaders
+    None
 
-  Return Values:
-    true - the end of the file was reached and reading is done
-    false - more data remains to be read
+  Returns:
+    None
   ***************************************************************************/
-static void _HTTP_HeaderParseLookup(HTTP_CONN* pHttpCon, int i)
+static void _HTTP_HeaderParseConnection(HTTP_CONN* pHttpCon)
 {
-    // i corresponds to an index in HTTPRequestHeaders
+    uint16_t len;
 
-#if defined(TCPIP_HTTP_USE_COOKIES)
-    if(i == 0u)
+    len = TCPIP_TCP_ArrayFind(pHttpCon->socket, HTTP_CRLF, HTTP_CRLF_LEN, 0, 0, false);
+    if(TCPIP_TCP_ArrayFind(pHttpCon->socket, (const uint8_t*)"close", 5, 0, len, true) != 0xffff)
     {
-        _HTTP_HeaderParseCookie(pHttpCon);
-        return;
+        pHttpCon->connFlags |= HTTP_CONN_FLAG_CONN_CLOSE;
     }
-#endif
+}
 
-#if defined(TCPIP_HTTP_USE_AUTHENTICATION)    
-    if(i == 1u)
-    {
-        _HTTP_HeaderParseAuthorization(pHttpCon);
-        return;
-    }
-#endif
+/*****************************************************************************
+  Function:
+    static void _HTTP_HeaderParseIfNoneMatch(HTTP_CONN* pHttpCon)
 
-#if defined(TCPIP_HTTP_USE_POST)
-    if(i == 2u)
+  Summary:
+    Parses the "If-None-Match:" header for a request.
+
+  Description:
+    Checks if the entity tag of the requested file is in the list
+    of entity tags the client has cached.
+    The header is noted even when there's no match, as it takes
+    precedence over "If-Modified-Since:".
+
+  Precondition:
+    None
+
+  Parameters:
+    None
+
+  Returns:
+    None
+  ***************************************************************************/
+static void _HTTP_HeaderParseIfNoneMatch(HTTP_CONN* pHttpCon)
+{
+    uint16_t len;
+    char eTag[HTTP_ETAG_LEN];
+
+    pHttpCon->connFlags |= HTTP_CONN_FLAG_COND_ETAG;
+    if((pHttpCon->connFlags & HTTP_CONN_FLAG_FILE_FOUND) == 0)
     {
-        _HTTP_HeaderParseContentLength(pHttpCon);
         return;
     }
-#endif
 
-#if defined(TCPIP_HTTP_USE_WEBSOCKETS)
-    if(i == 3u)
+    _HTTP_ETagFormat(pHttpCon, eTag);
+    len = TCPIP_TCP_ArrayFind(pHttpCon->socket, HTTP_CRLF, HTTP_CRLF_LEN, 0, 0, false);
+    if(TCPIP_TCP_ArrayFind(pHttpCon->socket, (const uint8_t*)eTag, strlen(eTag), 0, len, false) != 0xffff ||
+       TCPIP_TCP_ArrayFind(pHttpCon->socket, (const uint8_t*)"*", 1, 0, len, false) != 0xffff)
     {
-        _HTTP_HeaderParseWebsocketKey(pHttpCon);
-        return;
+        pHttpCon->connFlags |= HTTP_CONN_FLAG_ETAG_MATCH;
     }
-#endif
 }
 
 /*****************************************************************************
   Function:
-    static void HTTPHeaderParseAuthorization(HTTP_CONN* pHttpCon)
+    static void _HTTP_HeaderParseIfModifiedSince(HTTP_CONN* pHttpCon)
 
   Summary:
-    Parses the "Authorization:" header for a request and verifies the
-    credentials.
+    Parses the "If-Modified-Since:" header for a request.
 
   Description:
-    Parses the "Authorization:" header for a request.  For example, 
-    "BASIC YWRtaW46cGFzc3dvcmQ=" is decoded to a user name of "admin" and
-    a password of "password".  Once read, TCPIP_HTTP_UserAuthenticate is called from
-    custom_http_app.c to determine if the credentials are acceptable.
-
-    The return value of TCPIP_HTTP_UserAuthenticate is saved in pHttpCon->isAuthorized for
-    later use by the application.
+    Checks if the date the client has is the "Last-Modified:" date
+    of the requested file.
+    Clients send back the date exactly as the server sent it,
+    so the date is compared as a string, not parsed.
 
   Precondition:
     None
@@ -1645,67 +5043,37 @@ static void _HTTP_HeaderParseLookup(HTTP_CONN* pHttpCon, int i)
 
   Returns:
     None
-
-  Remarks:
-    This function is ony available when TCPIP_HTTP_USE_AUTHENTICATION is defined.
   ***************************************************************************/
-#if defined(TCPIP_HTTP_USE_AUTHENTICATION)
-static void _HTTP_HeaderParseAuthorization(HTTP_CONN* pHttpCon)
+static void _HTTP_HeaderParseIfModifiedSince(HTTP_CONN* pHttpCon)
 {
     uint16_t len;
-    uint8_t buf[40];
-    uint8_t *ptrBuf;
+    char date[HTTP_DATE_LEN];
 
-    // If auth processing is not required, return
-    if(pHttpCon->isAuthorized & 0x80)
+    if((pHttpCon->connFlags & HTTP_CONN_FLAG_FILE_FOUND) == 0 || !_HTTP_DateFormat(pHttpCon, date))
+    {
         return;
+    }
 
-    // Clear the auth type ("BASIC ")
-    TCPIP_TCP_ArrayGet(pHttpCon->socket, NULL, 6);
-
-    // Find the terminating CRLF and make sure it's a multiple of four
     len = TCPIP_TCP_ArrayFind(pHttpCon->socket, HTTP_CRLF, HTTP_CRLF_LEN, 0, 0, false);
-    len += 3;
-    len &= 0xfc;
-    len = mMIN(len, sizeof(buf)-4);
-
-    // Read in 4 bytes at a time and decode (slower, but saves RAM)
-    for(ptrBuf = buf; len > 0u; len-=4, ptrBuf+=3)
+    if(TCPIP_TCP_ArrayFind(pHttpCon->socket, (const uint8_t*)date, strlen(date), 0, len, false) != 0xffff)
     {
-        TCPIP_TCP_ArrayGet(pHttpCon->socket, ptrBuf, 4);
-        TCPIP_Helper_Base64Decode(ptrBuf, 4, ptrBuf, 3);
+        pHttpCon->connFlags |= HTTP_CONN_FLAG_DATE_MATCH;
     }
-
-    // Null terminate both, and make sure there's at least two terminators
-    *ptrBuf = '\0';
-    for(len = 0, ptrBuf = buf; len < sizeof(buf); len++, ptrBuf++)
-        if(*ptrBuf == ':')
-            break;
-    *(ptrBuf++) = '\0';
-
-    // Verify credentials
-    pHttpCon->isAuthorized = TCPIP_HTTP_UserAuthenticate(pHttpCon, buf, ptrBuf);
-
-    return;
 }
-#endif
 
 /*****************************************************************************
   Function:
-    static void HTTPHeaderParseCookie(HTTP_CONN* pHttpCon)
+    static void _HTTP_HeaderParseRange(HTTP_CONN* pHttpCon)
 
   Summary:
-    Parses the "Cookie:" headers for a request and stores them as GET
-    variables.
+    Parses the "Range:" header for a request.
 
   Description:
-    Parses the "Cookie:" headers for a request.  For example, 
-    "Cookie: name=Wile+E.+Coyote; order=ROCKET_LAUNCHER" is decoded to 
-    "name=Wile+E.+Coyote&order=ROCKET_LAUNCHER&" and stored as any other 
-    GET variable in pHttpCon->data.
-
-    The user application can easily access these values later using the
-    TCPIP_HTTP_ArgGet() and TCPIP_HTTP_ArgGet() functions.
+    Parses a list of byte ranges: "bytes=first-last, first-, -suffix".
+    The ranges are clipped to the size of the requested file
+    and the ones starting past the end of the file are dropped.
+    A malformed header, or one with more than TCPIP_HTTP_MAX_RANGES
+    ranges, is ignored and the whole file is served.
 
   Precondition:
     None
@@ -1715,64 +5083,112 @@ static void _HTTP_HeaderParseAuthorization(HTTP_CONN* pHttpCon)
 
   Returns:
     None
-
-  Remarks:
-    This function is ony available when TCPIP_HTTP_USE_COOKIES is defined.
   ***************************************************************************/
-#if defined(TCPIP_HTTP_USE_COOKIES)
-static void _HTTP_HeaderParseCookie(HTTP_CONN* pHttpCon)
+static void _HTTP_HeaderParseRange(HTTP_CONN* pHttpCon)
 {
-    uint16_t lenA, lenB;
+    uint16_t len;
+    uint32_t first, last;
+    int      nRanges;
+    char*    pSpec;
+    char*    pEnd;
+    char     rangeBuff[HTTP_RANGE_HDR_LEN + 1];
 
-    // Verify there's enough space
-    lenB = TCPIP_TCP_ArrayFind(pHttpCon->socket, HTTP_CRLF, HTTP_CRLF_LEN, 0, 0, false);
-    if(lenB >= (uint16_t)(pHttpCon->data + httpConnDataSize - pHttpCon->ptrData - 2))
-    {// If not, overflow
-        pHttpCon->httpStatus = HTTP_OVERFLOW;
-        pHttpCon->sm = SM_HTTP_SERVE_HEADERS;
+    if((pHttpCon->connFlags & HTTP_CONN_FLAG_FILE_FOUND) == 0)
+    {
         return;
     }
 
-    // While a CRLF is not immediate, grab a cookie value
-    while(lenB != 0u)
+    len = TCPIP_TCP_Find(pHttpCon->socket, '\r', 0, 0, false);
+    if(len > HTTP_RANGE_HDR_LEN)
     {
-        // Look for a ';' and use the shorter of that or a CRLF
-        lenA = TCPIP_TCP_Find(pHttpCon->socket, ';', 0, 0, false);
-
-        // Read to the terminator
-        pHttpCon->ptrData += TCPIP_TCP_ArrayGet(pHttpCon->socket, pHttpCon->ptrData, mMIN(lenA, lenB));
-
-        // Insert an & to anticipate another cookie
-        *(pHttpCon->ptrData++) = '&';
+        return;
+    }
+    TCPIP_TCP_ArrayGet(pHttpCon->socket, (uint8_t*)rangeBuff, len);
+    rangeBuff[len] = '\0';
 
-        // If semicolon, trash it and whitespace
-        if(lenA < lenB)
+    if(strncmp(rangeBuff, "bytes=", 6) != 0)
+    {
+        return;
+    }
+
+    nRanges = 0;
+    pSpec = rangeBuff + 6;
+    while(1)
+    {
+        while(*pSpec == ' ')
+            pSpec++;
+
+        if(*pSpec == '-')
+        {   // suffix: the last bytes of the file
+            pSpec++;
+            if(*pSpec < '0' || *pSpec > '9')
+                return;
+            last = strtoul(pSpec, &pEnd, 10);
+            first = last < pHttpCon->fileSize ? pHttpCon->fileSize - last : 0;
+            last = last != 0 ? pHttpCon->fileSize - 1 : 0;
+            if(pHttpCon->fileSize == 0 || first > last)
+            {   // empty suffix or file, unsatisfiable
+                first = pHttpCon->fileSize;
+            }
+        }
+        else
         {
-            TCPIP_TCP_Get(pHttpCon->socket, NULL);
-            while(TCPIP_TCP_Find(pHttpCon->socket, ' ', 0, 0, false) == 0u)
-                TCPIP_TCP_Get(pHttpCon->socket, NULL);
+            if(*pSpec < '0' || *pSpec > '9')
+                return;
+            first = strtoul(pSpec, &pEnd, 10);
+            if(*pEnd != '-')
+                return;
+            pSpec = pEnd + 1;
+            if(*pSpec >= '0' && *pSpec <= '9')
+            {
+                last = strtoul(pSpec, &pEnd, 10);
+                if(last < first)
+                    return;
+            }
+            else
+            {   // up to the end of the file
+                last = 0xffffffff;
+                pEnd = pSpec;
+            }
+            if(last >= pHttpCon->fileSize)
+            {
+                last = pHttpCon->fileSize - 1;
+            }
         }
 
-        // Find the new distance to the CRLF
-        lenB = TCPIP_TCP_ArrayFind(pHttpCon->socket, HTTP_CRLF, HTTP_CRLF_LEN, 0, 0, false);
-    }
+        if(first < pHttpCon->fileSize)
+        {   // satisfiable range
+            if(nRanges == TCPIP_HTTP_MAX_RANGES)
+                return;
+            pHttpCon->rangeStart[nRanges] = first;
+            pHttpCon->rangeLen[nRanges] = last - first + 1;
+            nRanges++;
+        }
 
-    return;
+        pSpec = pEnd;
+        while(*pSpec == ' ')
+            pSpec++;
+        if(*pSpec == '\0')
+            break;
+        if(*pSpec++ != ',')
+            return;
+    }
 
+    pHttpCon->nRanges = nRanges;
+    pHttpCon->connFlags |= HTTP_CONN_FLAG_RANGE_REQ;
 }
-#endif
 
 /*****************************************************************************
   Function:
-    static void HTTPHeaderParseContentLength(HTTP_CONN* pHttpCon)
+    static void _HTTP_HeaderParseIfRange(HTTP_CONN* pHttpCon)
 
   Summary:
-    Parses the "Content-Length:" header for a request.
+    Parses the "If-Range:" header for a request.
 
   Description:
-    Parses the "Content-Length:" header to determine how many bytes of
-    POST data to expect after the request.  This value is stored in 
-    pHttpCon->byteCount.
+    The byte ranges are served only if the client still has the current
+    version of the file: the header has to carry the file entity tag
+    or its "Last-Modified:" date.
 
   Precondition:
     None
@@ -1782,75 +5198,104 @@ static void _HTTP_HeaderParseCookie(HTTP_CONN* pHttpCon)
 
   Returns:
     None
-
-  Remarks:
-    This function is ony available when TCPIP_HTTP_USE_POST is defined.
   ***************************************************************************/
-#if defined(TCPIP_HTTP_USE_POST)
-static void _HTTP_HeaderParseContentLength(HTTP_CONN* pHttpCon)
+static void _HTTP_HeaderParseIfRange(HTTP_CONN* pHttpCon)
 {
     uint16_t len;
-    uint8_t buf[10];
+    char eTag[HTTP_ETAG_LEN];
+    char date[HTTP_DATE_LEN];
 
-    // Read up to the CRLF (max 9 bytes or ~1GB)
-    len = TCPIP_TCP_ArrayFind(pHttpCon->socket, HTTP_CRLF, HTTP_CRLF_LEN, 0, 0, false);
-    if(len >= sizeof(buf))
+    if((pHttpCon->connFlags & HTTP_CONN_FLAG_FILE_FOUND) != 0)
     {
-        pHttpCon->httpStatus = HTTP_BAD_REQUEST;
-        pHttpCon->byteCount = 0;
-        return;
-    }   
-    len = TCPIP_TCP_ArrayGet(pHttpCon->socket, buf, len);
-    buf[len] = '\0';
+        len = TCPIP_TCP_ArrayFind(pHttpCon->socket, HTTP_CRLF, HTTP_CRLF_LEN, 0, 0, false);
+        _HTTP_ETagFormat(pHttpCon, eTag);
+        if(TCPIP_TCP_ArrayFind(pHttpCon->socket, (const uint8_t*)eTag, strlen(eTag), 0, len, false) != 0xffff)
+        {
+            return;
+        }
+        if(_HTTP_DateFormat(pHttpCon, date) &&
+           TCPIP_TCP_ArrayFind(pHttpCon->socket, (const uint8_t*)date, strlen(date), 0, len, false) != 0xffff)
+        {
+            return;
+        }
+    }
 
-    pHttpCon->byteCount = atol((char*)buf);
+    pHttpCon->connFlags |= HTTP_CONN_FLAG_IF_RANGE_FAIL;
 }
-#endif
 
 /*****************************************************************************
   Function:
-    static void _HTTP_HeaderParseWebsocketKey(void)
+    static void _HTTP_HeaderParseAcceptEncoding(HTTP_CONN* pHttpCon)
+
   Summary:
-    Parses the "Sec-Websocket-Key:" header for a the Websocket Key.
+    Parses the "Accept-Encoding:" header for a request.
+
   Description:
-    Parses the "Sec-Websocket-Key:" header to determine the Websocket
-        Handshake Key.
+    Checks if the client accepts the gzip encoding, either by name
+    or through the "*" wildcard, and not with a zero quality value.
+    If it does, the precompressed variant of the file is selected.
+
   Precondition:
     None
+
   Parameters:
     None
+
   Returns:
     None
-  Remarks:
-    This function is only available when TCPIP_HTTP_USE_WEBSOCKETS is defined.
   ***************************************************************************/
-#if defined(TCPIP_HTTP_USE_WEBSOCKETS)
-static void _HTTP_HeaderParseWebsocketKey(HTTP_CONN* pHttpCon)
+static void _HTTP_HeaderParseAcceptEncoding(HTTP_CONN* pHttpCon)
 {
-    uint16_t index;
-    uint16_t length;
-    uint8_t buffer[WS_KEY_LENGTH];
-    
-    // Read up to the CRLF (should be 24 bytes)
-    length = TCPIP_TCP_ArrayFind(pHttpCon->socket, HTTP_CRLF, HTTP_CRLF_LEN, 0, 0, false);
-    
-    if (length != WS_KEY_LENGTH) {
-        pHttpCon->httpStatus = HTTP_BAD_REQUEST;
-        pHttpCon->byteCount  = 0;
-        return;
+    uint16_t len;
+    char*    pToken;
+    char*    pNext;
+    char*    pQ;
+    bool     isGzip, isAccepted;
+    char     encBuff[HTTP_ACCEPT_ENC_LEN + 1];
+
+    len = TCPIP_TCP_Find(pHttpCon->socket, '\r', 0, 0, false);
+    if(len > HTTP_ACCEPT_ENC_LEN)
+    {   // parse what fits; a truncated last token won't match
+        len = HTTP_ACCEPT_ENC_LEN;
     }
-    
-    length = TCPIP_TCP_ArrayGet(pHttpCon->socket, buffer, length);
-    
-    for (index = 0; index < length; index++) {
-        pHttpCon->webSocketKey[index] = buffer[index];
+    TCPIP_TCP_ArrayGet(pHttpCon->socket, (uint8_t*)encBuff, len);
+    encBuff[len] = '\0';
+
+    isAccepted = false;
+    for(pToken = encBuff; pToken != 0; pToken = pNext)
+    {
+        if((pNext = strchr(pToken, ',')) != 0)
+        {
+            *pNext++ = '\0';
+        }
+        while(*pToken == ' ')
+            pToken++;
+
+        len = strcspn(pToken, "; ");
+        isGzip = len == 4 && strncmp(pToken, "gzip", 4) == 0;
+        if(!isGzip && !(len == 1 && pToken[0] == '*'))
+        {
+            continue;
+        }
+
+        // q=0, q=0.0, etc. means not acceptable
+        if((pQ = strstr(pToken, "q=")) != 0 && strspn(pQ + 2, "0.") == strcspn(pQ + 2, " "))
+        {
+            if(isGzip)
+            {   // explicitly refused, whatever "*" says
+                return;
+            }
+            continue;
+        }
+
+        isAccepted = true;
+    }
+
+    if(isAccepted)
+    {
+        _HTTP_FileVariantSelect(pHttpCon);
     }
-    
-    TCPIP_TCP_FifoSizeAdjust(pHttpCon->socket, 1, 0, TCP_ADJUST_PRESERVE_RX);
-    pHttpCon->sm            = SM_HTTP_INIT_WEBSOCKET;
-    pHttpCon->httpStatus    = HTTP_WEBSOCKET_FRAME;
 }
-#endif
 
 /*****************************************************************************
   Function:
@@ -1883,6 +5328,9 @@ static void _HTTP_HeaderParseWebsocketKey(HTTP_CONN* pHttpCon)
     This function is called by the stack to parse GET arguments and 
     cookie data.  User applications can use this function to decode POST
     data, but first need to verify that the string is null-terminated.
+
+    When cData is the data buffer of a connection, the decoded arguments
+    are indexed for TCPIP_HTTP_ArgGet().
   ***************************************************************************/
 uint8_t* TCPIP_HTTP_URLDecode(uint8_t* cData)
 {
@@ -1890,6 +5338,14 @@ uint8_t* TCPIP_HTTP_URLDecode(uint8_t* cData)
     uint16_t wLen;
     uint8_t c;
     uint16_t hex;
+#if (TCPIP_HTTP_ARG_INDEX_SIZE != 0)
+    HTTP_CONN* pHttpCon;
+
+    if((pHttpCon = _HTTP_ArgIndexConnGet(cData)) != 0)
+    {   // the buffer is about to change
+        pHttpCon->argEnd = 0;
+    }
+#endif  // (TCPIP_HTTP_ARG_INDEX_SIZE != 0)
 
     // Determine length of input
     wLen = strlen((char*)cData);
@@ -1925,9 +5381,117 @@ uint8_t* TCPIP_HTTP_URLDecode(uint8_t* cData)
     *pWrite++ = '\0';
     *pWrite = '\0';
 
+#if (TCPIP_HTTP_ARG_INDEX_SIZE != 0)
+    if(pHttpCon != 0 && pHttpCon->data == cData)
+    {
+        _HTTP_ArgIndexBuild(pHttpCon, pWrite);
+    }
+#endif  // (TCPIP_HTTP_ARG_INDEX_SIZE != 0)
+
     return pWrite;
 }
 
+#if (TCPIP_HTTP_ARG_INDEX_SIZE != 0)
+// hash of an argument name, for the argument index
+static uint16_t _HTTP_ArgHash(const uint8_t* name)
+{
+    uint16_t nameHash = 0;
+
+    while(*name != '\0')
+    {
+        nameHash = nameHash * 31 + *name++;
+    }
+
+    return nameHash;
+}
+
+// checks if the value at valueOffset in data follows the argument name
+static bool _HTTP_ArgNameMatch(const uint8_t* data, uint16_t valueOffset, const uint8_t* name, size_t nameLen)
+{
+    if(valueOffset < nameLen + 1)
+    {
+        return false;
+    }
+
+    valueOffset -= nameLen + 1;
+    return (valueOffset == 0 || data[valueOffset - 1] == '\0') && memcmp(data + valueOffset, name, nameLen) == 0;
+}
+
+// returns the connection whose data buffer holds ptr, 0 if none
+static HTTP_CONN* _HTTP_ArgIndexConnGet(const uint8_t* ptr)
+{
+    if(httpConnData == 0 || ptr < httpConnData || ptr >= httpConnData + httpConnNo * httpConnDataSize)
+    {
+        return 0;
+    }
+
+    return httpConnCtrl + (ptr - httpConnData) / httpConnDataSize;
+}
+
+/*****************************************************************************
+  Function:
+    static void _HTTP_ArgIndexBuild(HTTP_CONN* pHttpCon, const uint8_t* pEnd)
+
+  Description:
+    Indexes the name/value pairs just decoded in the connection data buffer.
+    The index is an open addressing table of the name hashes,
+    with the offsets of the values.
+    Only the first of the arguments with the same name is indexed,
+    the one a linear search finds.
+    When the table fills up, the remaining arguments are left
+    for the linear search.
+
+  Precondition:
+    pHttpCon->data holds the output of TCPIP_HTTP_URLDecode().
+
+  Parameters:
+    pHttpCon  - HTTP connection
+    pEnd      - the last null terminator of the arguments
+
+  Returns:
+    None
+  ***************************************************************************/
+static void _HTTP_ArgIndexBuild(HTTP_CONN* pHttpCon, const uint8_t* pEnd)
+{
+    const uint8_t   *pName, *pValue;
+    HTTP_ARG_ENTRY* pEntry;
+    uint16_t        nameHash, slot;
+    size_t          nameLen;
+    int             nArgs;
+
+    memset(pHttpCon->argIndex, 0, sizeof(pHttpCon->argIndex));
+    for(pName = pHttpCon->data, nArgs = 0; pName < pEnd && *pName != '\0'; pName = pValue + strlen((const char*)pValue) + 1)
+    {
+        nameLen = strlen((const char*)pName);
+        pValue = pName + nameLen + 1;
+        if(pValue > pEnd || nArgs == TCPIP_HTTP_ARG_INDEX_SIZE - 1)
+        {   // no value or no room
+            break;
+        }
+
+        nameHash = _HTTP_ArgHash(pName);
+        for(slot = nameHash & (TCPIP_HTTP_ARG_INDEX_SIZE - 1); (pEntry = pHttpCon->argIndex + slot)->valueOffset != 0; slot = (slot + 1) & (TCPIP_HTTP_ARG_INDEX_SIZE - 1))
+        {
+            if(pEntry->nameHash == nameHash && _HTTP_ArgNameMatch(pHttpCon->data, pEntry->valueOffset, pName, nameLen))
+            {   // a duplicate
+                break;
+            }
+        }
+
+        if(pEntry->valueOffset == 0)
+        {
+            pEntry->nameHash = nameHash;
+            pEntry->valueOffset = (uint16_t)(pValue - pHttpCon->data);
+            nArgs++;
+        }
+    }
+
+    pHttpCon->argEnd = (uint16_t)(pEnd - pHttpCon->data);
+    // the loop stops early when an argument does not fit
+    pHttpCon->argAllIndexed = pName >= pEnd || *pName == '\0';
+}
+#endif  // (TCPIP_HTTP_ARG_INDEX_SIZE != 0)
+
 /*****************************************************************************
   Function:
     const uint8_t* TCPIP_HTTP_ArgGet(const uint8_t* cData, const uint8_t* cArg)
@@ -1953,9 +5517,43 @@ uint8_t* TCPIP_HTTP_URLDecode(uint8_t* cData)
 
   Returns:
     A pointer to the argument value, or NULL if not found.
+
+  Remarks:
+    The arguments decoded by TCPIP_HTTP_URLDecode() in the data buffer
+    of a connection are found through its index, without a linear search.
+    A miss is final when all the arguments fit the index.
+    Otherwise, or if the buffer no longer ends where the indexed
+    arguments did, cData is searched linearly from the start.
   ***************************************************************************/
 const uint8_t* TCPIP_HTTP_ArgGet(const uint8_t* cData, const uint8_t* cArg)
 {
+#if (TCPIP_HTTP_ARG_INDEX_SIZE != 0)
+    HTTP_CONN* pHttpCon = _HTTP_ArgIndexConnGet(cData);
+    const HTTP_ARG_ENTRY* pEntry;
+    uint16_t nameHash, slot;
+    size_t nameLen;
+
+    // the index is used while the data is the one indexed
+    if(pHttpCon != 0 && pHttpCon->data == cData && pHttpCon->argEnd != 0 && cData[pHttpCon->argEnd - 1] == '\0' && cData[pHttpCon->argEnd] == '\0')
+    {
+        nameHash = _HTTP_ArgHash(cArg);
+        nameLen = strlen((const char*)cArg);
+        for(slot = nameHash & (TCPIP_HTTP_ARG_INDEX_SIZE - 1); (pEntry = pHttpCon->argIndex + slot)->valueOffset != 0; slot = (slot + 1) & (TCPIP_HTTP_ARG_INDEX_SIZE - 1))
+        {
+            if(pEntry->nameHash == nameHash && _HTTP_ArgNameMatch(cData, pEntry->valueOffset, cArg, nameLen))
+            {
+                return cData + pEntry->valueOffset;
+            }
+        }
+
+        if(pHttpCon->argAllIndexed)
+        {
+            return NULL;
+        }
+        // some arguments did not fit the index
+    }
+#endif  // (TCPIP_HTTP_ARG_INDEX_SIZE != 0)
+
     // Search through the array while bytes remain
     while(*cData != '\0')
     { 
@@ -2138,6 +5736,11 @@ static HTTP_READ_STATUS _HTTP_ReadTo(HTTP_CONN* pHttpCon, uint8_t cDelim, uint8_
     HTTP_READ_STATUS status;
     uint16_t wPos;
 
+#if (TCPIP_HTTP_ARG_INDEX_SIZE != 0)
+    // the buffer may hold indexed arguments
+    pHttpCon->argEnd = 0;
+#endif  // (TCPIP_HTTP_ARG_INDEX_SIZE != 0)
+
     // Either look for delimiter, or read all available data
     if(cDelim)
         wPos = TCPIP_TCP_Find(pHttpCon->socket, cDelim, 0, 0, false);
@@ -2177,9 +5780,213 @@ static HTTP_READ_STATUS _HTTP_ReadTo(HTTP_CONN* pHttpCon, uint8_t cDelim, uint8_
     if(cDelim)
         pHttpCon->byteCount -= TCPIP_TCP_Get(pHttpCon->socket, NULL);
 
-    return status;
-}   
-#endif
+    return status;
+}   
+#endif
+
+#if defined(TCPIP_HTTP_USE_MULTIPART)
+// Boyer-Moore-Horspool search for the multipart delimiter in the first len bytes of the RX FIFO
+// returns the delimiter offset, 0xffff if not found
+static uint16_t _HTTP_MultipartFind(HTTP_CONN* pHttpCon, uint16_t len)
+{
+    HTTP_MULTIPART_DCPT* pDcpt = pHttpCon->pMultipart;
+    uint16_t pos;
+    int ix;
+
+    for(pos = 0; len >= pDcpt->delimLen && pos <= len - pDcpt->delimLen; pos += pDcpt->skip[TCPIP_TCP_Peek(pHttpCon->socket, pos + pDcpt->delimLen - 1)])
+    {
+        for(ix = pDcpt->delimLen - 1; TCPIP_TCP_Peek(pHttpCon->socket, pos + ix) == pDcpt->delim[ix]; ix--)
+        {
+            if(ix == 0)
+            {
+                return pos;
+            }
+        }
+    }
+
+    return 0xffff;
+}
+
+// removes len bytes of the request body from the RX FIFO
+static void _HTTP_MultipartDiscard(HTTP_CONN* pHttpCon, uint16_t len)
+{
+    pHttpCon->byteCount -= TCPIP_TCP_ArrayGet(pHttpCon->socket, NULL, len);
+}
+
+/*****************************************************************************
+  Function:
+    HTTP_IO_RESULT TCPIP_HTTP_MultipartRead(HTTP_CONN_HANDLE connHandle, HTTP_MULTIPART_CALLBACK callback)
+
+  Summary:
+    Parses a multipart/form-data request body from the TCP buffer.
+
+  Description:
+    Runs the parser set up by _HTTP_HeaderParseContentType() over the
+    available request data.
+    The data handed to the callback is peeked into the connection data buffer
+    and removed from the RX FIFO only when the callback accepts it.
+    A part body is passed on up to the last bytes that could start
+    a delimiter; these stay in the FIFO until more data arrives.
+
+  Precondition:
+    None
+
+  Parameters:
+    connHandle  - HTTP connection handle
+    callback    - handler of the part events
+
+  Return Values:
+    HTTP_IO_DONE - the whole body was read, or the request is not a valid multipart one
+    HTTP_IO_NEED_DATA - more data is needed
+    HTTP_IO_WAITING - the callback is not ready
+  ***************************************************************************/
+HTTP_IO_RESULT TCPIP_HTTP_MultipartRead(HTTP_CONN_HANDLE connHandle, HTTP_MULTIPART_CALLBACK callback)
+{
+    HTTP_CONN* pHttpCon = (HTTP_CONN*)connHandle;
+    HTTP_MULTIPART_DCPT* pDcpt = pHttpCon->pMultipart;
+    uint16_t avlblBytes, pos, len;
+    bool allIn;
+
+    if(pDcpt == 0)
+    {
+        pHttpCon->httpStatus = HTTP_BAD_REQUEST;
+        return HTTP_IO_DONE;
+    }
+
+#if (TCPIP_HTTP_ARG_INDEX_SIZE != 0)
+    // the buffer may hold indexed arguments
+    pHttpCon->argEnd = 0;
+#endif  // (TCPIP_HTTP_ARG_INDEX_SIZE != 0)
+
+    while(true)
+    {
+        // never read past the request body
+        avlblBytes = TCPIP_TCP_GetIsReady(pHttpCon->socket);
+        allIn = pHttpCon->byteCount <= avlblBytes;
+        if(allIn)
+        {
+            avlblBytes = (uint16_t)pHttpCon->byteCount;
+        }
+
+        switch(pDcpt->state)
+        {
+            case HTTP_MULTIPART_PREAMBLE:
+                // the first delimiter has no leading CRLF
+                pos = TCPIP_TCP_ArrayFind(pHttpCon->socket, pDcpt->delim + 2, pDcpt->delimLen - 2, 0, avlblBytes, false);
+                if(pos == 0xffff || pos + pDcpt->delimLen - 2 > avlblBytes)
+                {   // keep what could be the start of the delimiter
+                    if(avlblBytes > pDcpt->delimLen - 2)
+                    {
+                        _HTTP_MultipartDiscard(pHttpCon, avlblBytes - (pDcpt->delimLen - 2));
+                    }
+                    break;
+                }
+                _HTTP_MultipartDiscard(pHttpCon, pos + pDcpt->delimLen - 2);
+                pDcpt->state = HTTP_MULTIPART_BOUNDARY;
+                continue;
+
+            case HTTP_MULTIPART_BOUNDARY:
+                // "--" after the boundary closes the body; otherwise skip to the end of the line
+                if(avlblBytes >= 2 && TCPIP_TCP_Peek(pHttpCon->socket, 0) == '-' && TCPIP_TCP_Peek(pHttpCon->socket, 1) == '-')
+                {
+                    pDcpt->state = HTTP_MULTIPART_EPILOGUE;
+                    continue;
+                }
+                pos = TCPIP_TCP_Find(pHttpCon->socket, '\n', 0, avlblBytes, false);
+                if(pos == 0xffff || pos >= avlblBytes)
+                {
+                    break;
+                }
+                _HTTP_MultipartDiscard(pHttpCon, pos + 1);
+                pDcpt->state = HTTP_MULTIPART_HEADERS;
+                continue;
+
+            case HTTP_MULTIPART_HEADERS:
+                pos = TCPIP_TCP_Find(pHttpCon->socket, '\n', 0, avlblBytes, false);
+                if(pos == 0xffff || pos >= avlblBytes)
+                {
+                    break;
+                }
+
+                // an empty line ends the headers
+                len = pos;
+                if(len != 0 && TCPIP_TCP_Peek(pHttpCon->socket, len - 1) == '\r')
+                {
+                    len--;
+                }
+                if(len == 0)
+                {
+                    _HTTP_MultipartDiscard(pHttpCon, pos + 1);
+                    pDcpt->state = HTTP_MULTIPART_BODY;
+                    continue;
+                }
+
+                if(len > httpConnDataSize - 1)
+                {
+                    len = httpConnDataSize - 1;
+                }
+                len = TCPIP_TCP_ArrayPeek(pHttpCon->socket, pHttpCon->data, len, 0);
+                pHttpCon->data[len] = '\0';
+                if(!callback(connHandle, HTTP_MULTIPART_EVENT_HEADER, pHttpCon->data, len))
+                {
+                    return HTTP_IO_WAITING;
+                }
+                _HTTP_MultipartDiscard(pHttpCon, pos + 1);
+                continue;
+
+            case HTTP_MULTIPART_BODY:
+                // only a delimiter starting within the next chunk matters
+                len = avlblBytes < httpConnDataSize + pDcpt->delimLen - 1 ? avlblBytes : httpConnDataSize + pDcpt->delimLen - 1;
+                pos = _HTTP_MultipartFind(pHttpCon, len);
+                if(pos == 0)
+                {   // the delimiter is at the front
+                    if(!callback(connHandle, HTTP_MULTIPART_EVENT_PART_END, 0, 0))
+                    {
+                        return HTTP_IO_WAITING;
+                    }
+                    _HTTP_MultipartDiscard(pHttpCon, pDcpt->delimLen);
+                    pDcpt->state = HTTP_MULTIPART_BOUNDARY;
+                    continue;
+                }
+
+                if(pos == 0xffff)
+                {   // the data that cannot start a delimiter
+                    if(len < pDcpt->delimLen)
+                    {
+                        break;
+                    }
+                    pos = len - (pDcpt->delimLen - 1);
+                }
+
+                len = pos > httpConnDataSize ? httpConnDataSize : pos;
+                len = TCPIP_TCP_ArrayPeek(pHttpCon->socket, pHttpCon->data, len, 0);
+                if(!callback(connHandle, HTTP_MULTIPART_EVENT_DATA, pHttpCon->data, len))
+                {
+                    return HTTP_IO_WAITING;
+                }
+                _HTTP_MultipartDiscard(pHttpCon, len);
+                continue;
+
+            default:    // HTTP_MULTIPART_EPILOGUE
+                _HTTP_MultipartDiscard(pHttpCon, avlblBytes);
+                if(pHttpCon->byteCount == 0)
+                {
+                    return HTTP_IO_DONE;
+                }
+                return HTTP_IO_NEED_DATA;
+        }
+
+        // more data is needed
+        if(allIn)
+        {   // the body ended without the close delimiter
+            _HTTP_MultipartDiscard(pHttpCon, avlblBytes);
+            pHttpCon->httpStatus = HTTP_BAD_REQUEST;
+            return HTTP_IO_DONE;
+        }
+        return HTTP_IO_NEED_DATA;
+    }
+}
+#endif  // defined(TCPIP_HTTP_USE_MULTIPART)
 
 /*****************************************************************************
   Function:
@@ -2244,6 +6051,7 @@ static HTTP_IO_RESULT TCPIP_HTTP_MPFSUpload(HTTP_CONN* pHttpCon)
                     if(pHttpCon->uploadBufferStart == 0)
                     {
                         pHttpCon->uploadBufferStart = (uint8_t*)TCPIP_STACK_MALLOC_FUNC(mpfsAllocSize);
+                        TCPIP_HTTP_FileIndexInvalidate();
                         SYS_FS_Unmount_Wrapper((const char *)&pHttpCon->data[1]);
                     }
 
@@ -2340,6 +6148,7 @@ static HTTP_IO_RESULT TCPIP_HTTP_MPFSUpload(HTTP_CONN* pHttpCon)
                 TCPIP_STACK_FREE_FUNC(pHttpCon->uploadBufferStart);
                 pHttpCon->uploadBufferStart = 0;
 
+                TCPIP_HTTP_FileIndexInvalidate();
                 if(SYS_FS_Mount(SYS_FS_NVM_VOL, LOCAL_WEBSITE_PATH_FS, MPFS2, 0, NULL)  != SYS_FS_RES_FAILURE)
                 {
                     pHttpCon->sm = SM_HTTP_PROCESS_REQUEST;
@@ -2379,12 +6188,11 @@ static HTTP_IO_RESULT TCPIP_HTTP_MPFSUpload(HTTP_CONN* pHttpCon)
     a basic templating system for HTML web pages.  This reduces unneeded
     duplication of visual elements such as headers, menus, etc.
 
-    When pHttpCon->callbackPos is 0, the file is opened and as many bytes
-    as possible are written.  The current position is then saved to 
-    pHttpCon->callbackPos and the file is closed.  On subsequent calls, 
-    reading begins at the saved location and continues.  Once the end of
-    the input file is reached, pHttpCon->callbackPos is set back to 0 to 
-    indicate completion.
+    The file is opened on the first call and as many bytes as possible
+    are written.  The file stays open in the connection until its end is
+    reached; the following calls continue from the saved position.
+    An included file can itself include other files using ~inc:name~,
+    up to TCPIP_HTTP_MAX_INCLUDE_DEPTH levels deep.
 
   Precondition:
     None
@@ -2403,77 +6211,226 @@ static HTTP_IO_RESULT TCPIP_HTTP_MPFSUpload(HTTP_CONN* pHttpCon)
   ***************************************************************************/
 void TCPIP_HTTP_FileInclude(HTTP_CONN_HANDLE connHandle, const uint8_t* cFile)
 {
-    SYS_FS_HANDLE fp;
-    uint32_t cntr=0;
-    uint8_t incDataBuffer[HTTP_INC_DATABUF_SIZE];
-    uint32_t availbleTcpBuffSize,len;
+    HTTP_INC_FRAME* pFrame;
+    uint32_t cntr, len;
+    uint16_t availbleTcpBuffSize, bytesPut;
     HTTP_CONN* pHttpCon = (HTTP_CONN*)connHandle;
-    uint16_t bytesPut;
 
-
-    if((fp = SYS_FS_FileOpen_Wrapper((const char *)cFile, SYS_FS_FILE_OPEN_READ)) == SYS_FS_HANDLE_INVALID)
-    {// File not found, so abort
-        pHttpCon->TxFile.incFileRdCnt = 0;
+    if(!_HTTP_OutBuffDrain(pHttpCon))
+    {// output written before the include goes first
+        pHttpCon->TxFile.EndOfCallBackFileFlag=0x00;
         return;
     }
-    else
-    {// The file opened successfully, so seek the file
-        if(pHttpCon->TxFile.lock_hdr == 0)
+
+    if(pHttpCon->TxFile.incDepth == 0)
+    {// First call for this include
+        if(!_HTTP_IncludePush(pHttpCon, (const char *)cFile))
+        {// File not found or empty, nothing to send
+            pHttpCon->TxFile.EndOfCallBackFileFlag=0x01;
+            return;
+        }
+    }
+
+    // continue with the innermost file being included
+    while(pHttpCon->TxFile.incDepth != 0)
+    {
+        pFrame = pHttpCon->TxFile.incStack + pHttpCon->TxFile.incDepth - 1;
+        if(pFrame->numBytes == 0)
+        {// EOF, back to the including file
+            _HTTP_IncludePop(pHttpCon);
+            continue;
+        }
+
+        availbleTcpBuffSize = _HTTP_DynWriteIsReady(pHttpCon);
+        if(availbleTcpBuffSize == 0)
+        {// keep the files open, resume on the next call
+            pHttpCon->TxFile.EndOfCallBackFileFlag=0x00;
+            return;
+        }
+
+        // read only what the socket can take
+        cntr = mMIN(pFrame->numBytes, httpFileBuffSize);
+        cntr = mMIN(cntr, availbleTcpBuffSize);
+        len = _HTTP_FileReadAt(pFrame->file, pFrame->offset, httpFileBuff, cntr);
+        _HTTP_FileRdCheck(len==cntr, __FILE__, __LINE__);
+        if(len != cntr)
+        {// read error; abandon the include
+            _HTTP_IncludeRelease(pHttpCon);
+            break;
+        }
+
+        if((cntr = _HTTP_IncludeNestedCheck(pHttpCon, pFrame, len)) == 0)
+        {// a nested include was started
+            continue;
+        }
+
+        bytesPut = _HTTP_DynWrite(pHttpCon, httpFileBuff, cntr);
+        pFrame->offset += bytesPut;
+        pFrame->numBytes -= bytesPut;
+        if(bytesPut != cntr)
         {
-            pHttpCon->TxFile.numBytesHdrFile = SYS_FS_FileSize(fp);
-            pHttpCon->TxFile.incFileRdCnt = 0x00;
-            if ((pHttpCon->TxFile.numBytesHdrFile == -1) || (pHttpCon->TxFile.numBytesHdrFile == 0)) {
-                SYS_FS_FileClose(fp);
-                pHttpCon->TxFile.EndOfCallBackFileFlag=0x01;
-                return;   
-            }
-            pHttpCon->TxFile.lock_hdr=1;
+            pHttpCon->TxFile.EndOfCallBackFileFlag=0x00;
+            return;
         }
-        SYS_FS_FileSeek(fp, pHttpCon->TxFile.incFileRdCnt, SYS_FS_SEEK_SET);
     }
 
-    availbleTcpBuffSize = TCPIP_TCP_PutIsReady(pHttpCon->socket);
+    pHttpCon->TxFile.EndOfCallBackFileFlag=0x01;
+}
+
+// opens a file to be included and makes it the innermost include
+// returns false if the file cannot be included: not found, empty or too deep
+static bool _HTTP_IncludePush(HTTP_CONN* pHttpCon, const char* fileName)
+{
+    SYS_FS_HANDLE fp;
+    int32_t fileSize;
+    HTTP_INC_FRAME* pFrame;
 
-    if(availbleTcpBuffSize == 0)
+    if(pHttpCon->TxFile.incDepth == TCPIP_HTTP_MAX_INCLUDE_DEPTH)
     {
-        // Save the new address and close the file
-        pHttpCon->TxFile.incFileRdCnt = SYS_FS_FileTell(fp);
-        SYS_FS_FileClose(fp);
-        pHttpCon->TxFile.EndOfCallBackFileFlag=0x00;
-        return;
+        return false;
     }
 
-    if(pHttpCon->TxFile.numBytesHdrFile <= sizeof(incDataBuffer))
+    if((fp = _HTTP_FileHandleGet(fileName)) == SYS_FS_HANDLE_INVALID)
     {
-        cntr = pHttpCon->TxFile.numBytesHdrFile;
+        return false;
     }
-    else
+
+    fileSize = SYS_FS_FileSize(fp);
+    if(fileSize == -1 || fileSize == 0)
+    {
+        _HTTP_FileHandleRelease(fp);
+        return false;
+    }
+
+    pFrame = pHttpCon->TxFile.incStack + pHttpCon->TxFile.incDepth++;
+    pFrame->file = fp;
+    pFrame->offset = 0;
+    pFrame->numBytes = (uint32_t)fileSize;
+    return true;
+}
+
+// closes the innermost included file
+static void _HTTP_IncludePop(HTTP_CONN* pHttpCon)
+{
+    HTTP_INC_FRAME* pFrame = pHttpCon->TxFile.incStack + --pHttpCon->TxFile.incDepth;
+
+    _HTTP_FileHandleRelease(pFrame->file);
+    pFrame->file = SYS_FS_HANDLE_INVALID;
+}
+
+// closes all the files being included by the connection
+static void _HTTP_IncludeRelease(HTTP_CONN* pHttpCon)
+{
+    while(pHttpCon->TxFile.incDepth != 0)
     {
-        cntr = sizeof(incDataBuffer);
+        _HTTP_IncludePop(pHttpCon);
     }
-    len = SYS_FS_FileRead(fp, incDataBuffer, cntr);
-    _HTTP_FileRdCheck(len==cntr, __FILE__, __LINE__);
-    bytesPut = TCPIP_TCP_ArrayPut(pHttpCon->socket, incDataBuffer, len);
-    if (bytesPut != len)
+}
+
+// checks the len bytes of the included file read in httpFileBuff for a nested ~inc:name~
+// returns how many bytes can be sent as they are, up to the next '~'
+// returns 0 if a nested include was found and started
+static uint32_t _HTTP_IncludeNestedCheck(HTTP_CONN* pHttpCon, HTTP_INC_FRAME* pFrame, uint32_t len)
+{
+    uint8_t* pTilde;
+    uint32_t tokenLen, nameLen;
+    char incName[SYS_FS_MAX_PATH];
+
+    if(httpFileBuff[0] != '~')
     {
-        // we didn't transmit the entire buffer, so we have to seek backwards.
-        SYS_FS_FileSeek(fp, 0 - (len - bytesPut), SYS_FS_SEEK_CUR);
+        pTilde = memchr(httpFileBuff, '~', len);
+        return pTilde == 0 ? len : pTilde - httpFileBuff;
     }
-    pHttpCon->TxFile.numBytesHdrFile -= bytesPut;
 
-    if(pHttpCon->TxFile.numBytesHdrFile == 0)
-    {// If no bytes were read, an EOF was reached
-    SYS_FS_FileClose(fp);
-        pHttpCon->TxFile.incFileRdCnt = 0x00;
-        pHttpCon->TxFile.EndOfCallBackFileFlag=0x01;
-        pHttpCon->TxFile.lock_hdr=0;
-        return;
+    if(pHttpCon->TxFile.incDepth == TCPIP_HTTP_MAX_INCLUDE_DEPTH)
+    {// too deep, send the token as it is
+        return 1;
     }
 
-    // Save the new address and close the file
-    pHttpCon->TxFile.incFileRdCnt = SYS_FS_FileTell(fp);
-    SYS_FS_FileClose(fp);
-    pHttpCon->TxFile.EndOfCallBackFileFlag=-1;
+    if(len < pFrame->numBytes && len < httpFileBuffSize)
+    {// the read was limited by the socket; get the whole token
+        len = _HTTP_FileReadAt(pFrame->file, pFrame->offset, httpFileBuff, mMIN(pFrame->numBytes, httpFileBuffSize));
+    }
+
+    pTilde = len > 1 ? memchr(httpFileBuff + 1, '~', len - 1) : 0;
+    tokenLen = pTilde == 0 ? 0 : pTilde - httpFileBuff + 1;
+    if(tokenLen <= 5 || memcmp(httpFileBuff, "~inc:", 5) != 0 || (nameLen = tokenLen - 6) >= sizeof(incName))
+    {// not an include; the '~' is plain data
+        return 1;
+    }
+
+    memcpy(incName, httpFileBuff + 5, nameLen);
+    incName[nameLen] = 0;
+
+    // skip the token; a missing file includes nothing
+    pFrame->offset += tokenLen;
+    pFrame->numBytes -= tokenLen;
+    _HTTP_IncludePush(pHttpCon, incName);
+    return 0;
+}
+
+uint16_t TCPIP_HTTP_DynamicWrite(HTTP_CONN_HANDLE connHandle, const void* buffer, uint16_t size)
+{
+    HTTP_CONN* pHttpCon = (HTTP_CONN*)connHandle;
+    uint16_t nWritten;
+#if (TCPIP_HTTP_DYNVAR_TTL_ENTRIES != 0)
+    uint16_t sktReady = TCPIP_TCP_PutIsReady(pHttpCon->socket);
+#endif  // (TCPIP_HTTP_DYNVAR_TTL_ENTRIES != 0)
+
+#if (TCPIP_HTTP_OUTPUT_BUFFERS != 0)
+    nWritten = _HTTP_OutBuffWrite(pHttpCon, (const uint8_t*)buffer, size);
+#else
+    nWritten = _HTTP_DynWrite(pHttpCon, (const uint8_t*)buffer, size);
+#endif  // (TCPIP_HTTP_OUTPUT_BUFFERS != 0)
+
+#if (TCPIP_HTTP_DYNVAR_TTL_ENTRIES != 0)
+    if(httpDynVarCapture != 0)
+    {
+        // tells the socket writes of the callback apart from these
+        httpDynVarSktBytes += sktReady - TCPIP_TCP_PutIsReady(pHttpCon->socket);
+        if(nWritten != size)
+        {   // the callback will resume; its output is not cached
+            httpDynVarCapture->isOverflow = true;
+        }
+        _HTTP_DynVarCapture((const uint8_t*)buffer, nWritten);
+    }
+#endif  // (TCPIP_HTTP_DYNVAR_TTL_ENTRIES != 0)
+
+    return nWritten;
+}
+
+const uint8_t* TCPIP_HTTP_DynamicStringWrite(HTTP_CONN_HANDLE connHandle, const uint8_t* str)
+{
+    HTTP_CONN* pHttpCon = (HTTP_CONN*)connHandle;
+    size_t len = strlen((const char*)str);
+
+    if(len > 0xffff)
+    {
+        len = 0xffff;
+    }
+    return str + TCPIP_HTTP_DynamicWrite(pHttpCon, str, (uint16_t)len);
+}
+
+uint16_t TCPIP_HTTP_DynamicWriteIsReady(HTTP_CONN_HANDLE connHandle)
+{
+    HTTP_CONN* pHttpCon = (HTTP_CONN*)connHandle;
+#if (TCPIP_HTTP_OUTPUT_BUFFERS != 0)
+    uint32_t avlbSize;
+
+    if(pHttpCon->outBuff != 0)
+    {   // the output goes to the buffer
+        return TCPIP_HTTP_OUTPUT_BUFFER_SIZE - pHttpCon->outOffset - pHttpCon->outLen;
+    }
+
+    avlbSize = _HTTP_DynWriteIsReady(pHttpCon);
+    if(httpOutBuffFreeCount != 0)
+    {
+        avlbSize += TCPIP_HTTP_OUTPUT_BUFFER_SIZE;
+    }
+    return avlbSize > 0xffff ? 0xffff : (uint16_t)avlbSize;
+#else
+    return _HTTP_DynWriteIsReady(pHttpCon);
+#endif  // (TCPIP_HTTP_OUTPUT_BUFFERS != 0)
 }
 
 SYS_FS_HANDLE TCPIP_HTTP_CurrentConnectionFileGet(HTTP_CONN_HANDLE connHandle)
@@ -2656,6 +6613,344 @@ HTTP_CONN_HANDLE TCPIP_HTTP_CurrentConnectionHandleGet(int connIx)
     return 0;
 }
 
+void TCPIP_HTTP_FileIndexInvalidate(void)
+{
+    int ix;
+
+    if(httpFileIndex != 0)
+    {
+        for(ix = 0; ix < httpFileIndexCount; ix++)
+        {
+            if(httpFileIndex[ix].hdrBlock != 0)
+            {
+                TCPIP_STACK_FREE_FUNC((void*)httpFileIndex[ix].hdrBlock);
+            }
+        }
+        TCPIP_STACK_FREE_FUNC(httpFileIndex);
+        httpFileIndex = 0;
+        httpFileIndexCount = 0;
+    }
+    httpFileIndexFailed = false;
+
+    if(httpDynPageIndex != 0)
+    {
+        TCPIP_STACK_FREE_FUNC(httpDynPageIndex);
+        httpDynPageIndex = 0;
+    }
+    httpDynPageCount = 0;
+    httpDynPageIndexValid = false;
+
+    // the requests in progress fall back to the name hash
+    for(ix = 0; ix < httpConnNo; ix++)
+    {
+        httpConnCtrl[ix].fileIx = HTTP_FILE_IX_NONE;
+    }
+
+    // the tables in use are detached and freed when released
+    _HTTP_DynVarCachePurge(TCPIP_HTTP_DYNVAR_CACHE_SIZE);
+    httpDynVarTables = 0;
+    httpDynVarCacheSize = 0;
+
+    _HTTP_FileHandleCachePurge();
+
+#if (TCPIP_HTTP_DYNVAR_TTL_ENTRIES != 0)
+    for(ix = 0; ix < TCPIP_HTTP_DYNVAR_TTL_ENTRIES; ix++)
+    {   // the callback IDs may have changed
+        httpDynVarTtl[ix].isValid = false;
+    }
+#endif  // (TCPIP_HTTP_DYNVAR_TTL_ENTRIES != 0)
+
+#if (TCPIP_HTTP_FILE_CACHE_SIZE != 0)
+    // same for the cached files
+    _HTTP_FileCachePurge(TCPIP_HTTP_FILE_CACHE_SIZE);
+    httpFileCache = 0;
+    httpFileCacheSize = 0;
+#endif  // (TCPIP_HTTP_FILE_CACHE_SIZE != 0)
+}
+
+bool TCPIP_HTTP_DynVarTtlSet(uint32_t callbackID, uint32_t ttlMs)
+{
+#if (TCPIP_HTTP_DYNVAR_TTL_ENTRIES != 0)
+    HTTP_DYNVAR_TTL_ENTRY* pEntry;
+    int ix;
+
+    if((pEntry = _HTTP_DynVarTtlFind(callbackID)) == 0)
+    {
+        if(ttlMs == 0)
+        {
+            return true;
+        }
+        for(ix = 0, pEntry = httpDynVarTtl; ix < TCPIP_HTTP_DYNVAR_TTL_ENTRIES; ix++, pEntry++)
+        {
+            if(pEntry->ttlTicks == 0)
+            {
+                break;
+            }
+        }
+        if(ix == TCPIP_HTTP_DYNVAR_TTL_ENTRIES)
+        {   // no free entry
+            return false;
+        }
+    }
+
+    pEntry->callbackID = callbackID;
+    pEntry->ttlTicks = (uint32_t)(((uint64_t)ttlMs * SYS_TMR_TickCounterFrequencyGet() + 999) / 1000);
+    pEntry->isValid = false;
+    return true;
+#else
+    return ttlMs == 0;
+#endif  // (TCPIP_HTTP_DYNVAR_TTL_ENTRIES != 0)
+}
+
+HTTP_ASYNC_TOKEN TCPIP_HTTP_AsyncTokenGet(HTTP_CONN_HANDLE connHandle)
+{
+    HTTP_CONN* pHttpCon = (HTTP_CONN*)connHandle;
+
+    // the sequence number invalidates the tokens of previous operations
+    pHttpCon->asyncSeq++;
+    pHttpCon->asyncTick = SYS_TMR_TickCountGet() + TCPIP_HTTP_TIMEOUT * SYS_TMR_TickCounterFrequencyGet();
+    pHttpCon->asyncState = HTTP_ASYNC_WAIT;
+
+    return ((uint32_t)pHttpCon->asyncSeq << 16) | (pHttpCon->connIx + 1);
+}
+
+bool TCPIP_HTTP_AsyncComplete(HTTP_ASYNC_TOKEN token)
+{
+    HTTP_CONN* pHttpCon;
+    int connIx = (int)(token & 0xffff) - 1;
+
+    if(httpConnCtrl == 0 || connIx < 0 || connIx >= httpConnNo)
+    {
+        return false;
+    }
+
+    pHttpCon = httpConnCtrl + connIx;
+    if(pHttpCon->asyncState != HTTP_ASYNC_WAIT || pHttpCon->asyncSeq != (uint16_t)(token >> 16))
+    {
+        return false;
+    }
+
+    pHttpCon->asyncState = HTTP_ASYNC_DONE;
+    // called by the application, the stack manager needs to be alerted
+    _TCPIPStackModuleSignalRequest(TCPIP_THIS_MODULE_ID, TCPIP_MODULE_SIGNAL_RX_PENDING, false);
+    return true;
+}
+
+bool TCPIP_HTTP_RoutesSet(const HTTP_ROUTE* routes, int nRoutes)
+{
+    HTTP_ROUTE_ENTRY* pEntry;
+    const char* path;
+    size_t pathLen;
+    int ix, nExact, nPattern;
+
+    if(httpRouteIndex != 0)
+    {
+        TCPIP_STACK_FREE_FUNC(httpRouteIndex);
+        httpRouteIndex = 0;
+    }
+    httpRoutes = 0;
+    httpRouteCount = httpRouteExactCount = 0;
+
+    if(nRoutes <= 0)
+    {
+        return true;
+    }
+
+    if((pEntry = (HTTP_ROUTE_ENTRY*)TCPIP_STACK_MALLOC_FUNC(nRoutes * sizeof(*pEntry))) == 0)
+    {
+        return false;
+    }
+
+    // count the exact routes first, they go before the patterns
+    for(ix = 0, nExact = 0; ix < nRoutes; ix++)
+    {
+        path = routes[ix].path;
+        pathLen = strlen(path);
+        if(strchr(path, ':') == 0 && (pathLen == 0 || path[pathLen - 1] != '*'))
+        {
+            nExact++;
+        }
+    }
+
+    for(ix = 0, nPattern = nExact, nExact = 0; ix < nRoutes; ix++)
+    {
+        path = routes[ix].path;
+        pathLen = strlen(path);
+        if(strchr(path, ':') == 0 && (pathLen == 0 || path[pathLen - 1] != '*'))
+        {
+            pEntry[nExact].nameHash = _HTTP_NameHash(path);
+            pEntry[nExact++].routeIx = (uint16_t)ix;
+        }
+        else
+        {
+            pEntry[nPattern].nameHash = 0;
+            pEntry[nPattern++].routeIx = (uint16_t)ix;
+        }
+    }
+    qsort(pEntry, nExact, sizeof(*pEntry), _HTTP_RouteEntryCompare);
+
+    httpRoutes = routes;
+    httpRouteIndex = pEntry;
+    httpRouteCount = nRoutes;
+    httpRouteExactCount = nExact;
+    return true;
+}
+
+const HTTP_ROUTE* TCPIP_HTTP_CurrentConnectionRouteGet(HTTP_CONN_HANDLE connHandle)
+{
+    return ((HTTP_CONN*)connHandle)->pRoute;
+}
+
+int TCPIP_HTTP_RouteParamGet(HTTP_CONN_HANDLE connHandle, int paramIx, char* buff, int buffSize)
+{
+    HTTP_CONN* pHttpCon = (HTTP_CONN*)connHandle;
+    int paramLen, copyLen;
+
+    if(pHttpCon->pRoute == 0 || paramIx < 0 || paramIx >= pHttpCon->routeNParams)
+    {
+        return -1;
+    }
+
+    paramLen = pHttpCon->routeParamLen[paramIx];
+    if(buffSize > 0)
+    {
+        copyLen = paramLen < buffSize ? paramLen : buffSize - 1;
+        memcpy(buff, pHttpCon->fileName + pHttpCon->routeParamOff[paramIx], copyLen);
+        buff[copyLen] = '\0';
+    }
+    return paramLen;
+}
+
+#if defined(TCPIP_HTTP_USE_SSE)
+bool TCPIP_HTTP_SSEPathRegister(const char* path)
+{
+    int ix, freeIx = -1;
+
+    for(ix = 0; ix < TCPIP_HTTP_SSE_MAX_PATHS; ix++)
+    {
+        if(httpSSEPaths[ix] == 0)
+        {
+            if(freeIx < 0)
+            {
+                freeIx = ix;
+            }
+        }
+        else if(strcmp(httpSSEPaths[ix], path) == 0)
+        {
+            return true;
+        }
+    }
+
+    if(freeIx < 0)
+    {
+        return false;
+    }
+
+    httpSSEPaths[freeIx] = path;
+    return true;
+}
+
+// returns the next line of SSE data, 0 if none; lines end with CR, LF or CRLF
+static const char* _HTTP_SSELineNext(const char* pLine)
+{
+    pLine += strcspn(pLine, "\r\n");
+    if(*pLine == '\0')
+    {
+        return 0;
+    }
+
+    return pLine[0] == '\r' && pLine[1] == '\n' ? pLine + 2 : pLine + 1;
+}
+
+int TCPIP_HTTP_SSESend(HTTP_CONN_HANDLE connHandle, const char* event, const char* data)
+{
+    HTTP_CONN* pHttpCon = (HTTP_CONN*)connHandle;
+    const char* pLine;
+    size_t lineLen;
+    uint32_t eventLen;
+
+    if(pHttpCon->sm != SM_HTTP_PROC_SSE)
+    {
+        return 1;
+    }
+
+    // an event is sent whole or not at all
+    eventLen = 1;
+    if(event != 0)
+    {
+        if(event[strcspn(event, "\r\n")] != '\0')
+        {   // would end the field and start another one
+            return -1;
+        }
+        eventLen += 7 + strlen(event) + 1;
+    }
+    for(pLine = data; pLine != 0; pLine = _HTTP_SSELineNext(pLine))
+    {   // every line of the data goes in a "data:" field
+        eventLen += 6 + strcspn(pLine, "\r\n") + 1;
+    }
+
+    if(eventLen > (uint32_t)TCPIP_TCP_PutIsReady(pHttpCon->socket) + TCPIP_TCP_FifoTxFullGet(pHttpCon->socket))
+    {   // larger than the whole TX buffer
+        return -1;
+    }
+
+    if(TCPIP_TCP_PutIsReady(pHttpCon->socket) < eventLen)
+    {   // not enough space in TX buffer; the application tries again later
+        return 1;
+    }
+
+    if(event != 0)
+    {
+        TCPIP_TCP_ArrayPut(pHttpCon->socket, (const uint8_t*)"event: ", 7);
+        TCPIP_TCP_StringPut(pHttpCon->socket, (const uint8_t*)event);
+        TCPIP_TCP_Put(pHttpCon->socket, '\n');
+    }
+    for(pLine = data; pLine != 0; pLine = _HTTP_SSELineNext(pLine))
+    {
+        lineLen = strcspn(pLine, "\r\n");
+        TCPIP_TCP_ArrayPut(pHttpCon->socket, (const uint8_t*)"data: ", 6);
+        TCPIP_TCP_ArrayPut(pHttpCon->socket, (const uint8_t*)pLine, lineLen);
+        TCPIP_TCP_Put(pHttpCon->socket, '\n');
+    }
+    TCPIP_TCP_Put(pHttpCon->socket, '\n');
+
+    // flushed together with the other events of this pass
+    pHttpCon->connFlags |= HTTP_CONN_FLAG_SSE_PENDING;
+    return 0;
+}
+#endif  // defined(TCPIP_HTTP_USE_SSE)
+
+#if defined(TCPIP_HTTP_MAPPED_IMAGE_ENABLE)
+bool TCPIP_HTTP_MappedImageSet(const void* pImage, size_t imageSize)
+{
+    const uint8_t* pImg = (const uint8_t*)pImage;
+    uint16_t nFiles;
+
+    httpMappedImage = 0;
+    httpMappedImageSize = 0;
+    if(pImg == 0)
+    {
+        return true;
+    }
+
+    // check the header: "MPFS", version 2.x, number of files
+    if(imageSize < HTTP_MPFS2_HDR_SIZE || memcmp(pImg, "MPFS", 4) != 0 || pImg[4] != 2)
+    {
+        return false;
+    }
+
+    memcpy(&nFiles, pImg + 6, 2);
+    if(HTTP_MPFS2_HDR_SIZE + (size_t)nFiles * (HTTP_MPFS2_HASH_SIZE + HTTP_MPFS2_FAT_RCRD_SIZE) > imageSize)
+    {
+        return false;
+    }
+
+    httpMappedImage = pImg;
+    httpMappedImageSize = imageSize;
+    return true;
+}
+#endif  // defined(TCPIP_HTTP_MAPPED_IMAGE_ENABLE)
+
 int TCPIP_HTTP_ActiveConnectionCountGet(int* pOpenCount)
 {
     HTTP_CONN* pHttpCon;
@@ -76,9 +76,12 @@ typedef enum
     HTTP_NOT_FOUND,              // 404 Not Found will be returned
     HTTP_OVERFLOW,               // 414 Request-URI Too Long will be returned
     HTTP_INTERNAL_SERVER_ERROR,  // 500 Internal Server Error will be returned
-    HTTP_NOT_IMPLEMENTED,        // 501 Not Implemented (not a GET or POST command)
+    HTTP_NOT_IMPLEMENTED,        // 501 Not Implemented (not a GET, HEAD, POST or OPTIONS command)
     HTTP_REDIRECT,               // 302 Redirect will be returned
     HTTP_SSL_REQUIRED,           // 403 Forbidden is returned, indicating SSL is required
+    HTTP_NOT_MODIFIED,           // 304 Not Modified is returned, the client cached copy is still valid
+    HTTP_OPTIONS,                // OPTIONS command, the supported methods are returned
+    HTTP_RANGE_NOT_SATISFIABLE,  // 416 Range Not Satisfiable is returned
 
     HTTP_MPFS_FORM,              // Show the MPFS Upload form
     HTTP_MPFS_UP,                // An MPFS Upload is being processed
@@ -133,6 +136,10 @@ typedef enum
     HTTP_JAVA,          // File is java (extension .class)
     HTTP_WAV,           // File is audio (extension .wav)
     HTTP_SVG,           // File is SVG (extension .svg))
+    HTTP_JSON,          // File is JSON (extension .json)
+    HTTP_ICO,           // File is icon (extension .ico)
+    HTTP_WOFF2,         // File is web font (extension .woff2)
+    HTTP_WASM,          // File is WebAssembly (extension .wasm)
     HTTP_UNKNOWN        // File type is unknown
 
 } HTTP_FILE_TYPE;
@@ -140,6 +147,22 @@ typedef enum
 // HTTP connection identifier, handle of a HTTP connection
 typedef const void*     HTTP_CONN_HANDLE;
 
+// Token of an asynchronous operation of a HTTP connection; see TCPIP_HTTP_AsyncTokenGet()
+typedef uint32_t        HTTP_ASYNC_TOKEN;
+
+// Route handler: writes the response body of a routed request; see TCPIP_HTTP_RoutesSet()
+typedef HTTP_IO_RESULT  (*HTTP_ROUTE_HANDLER)(HTTP_CONN_HANDLE connHandle);
+
+// Route: a URL served by a handler instead of a file
+typedef struct
+{
+    const char*         path;       // URL path, without the leading '/'
+                                    // a ":name" segment matches any path segment,
+                                    // a final '*' matches the rest of the path
+    HTTP_FILE_TYPE      fileType;   // Content-Type of the response
+    HTTP_ROUTE_HANDLER  handler;    // writes the response body
+} HTTP_ROUTE;
+
 // HTTP module configuration flags
 // Multiple flags can be OR-ed
 typedef enum
@@ -150,6 +173,12 @@ typedef enum
                                                  // Improves throughput when the socket buffers are small.
     HTTP_MODULE_FLAG_NO_DELAY            = 0x02, // Create the HTTP sockets with NO-DELAY option.
                                                  // It will flush data as soon as possible.
+    HTTP_MODULE_FLAG_KEEP_ALIVE          = 0x04, // Keep HTTP/1.1 connections open after a response
+                                                 // whose length is known to the client.
+    HTTP_MODULE_FLAG_CHUNKED             = 0x08, // Send dynamic pages using the chunked
+                                                 // transfer encoding.
+                                                 // The dynamic variable callbacks have to write
+                                                 // their output using TCPIP_HTTP_DynamicWrite().
 }HTTP_MODULE_FLAGS;
 
 // HTTP module dynamic configuration data
@@ -166,6 +195,9 @@ typedef struct
     uint16_t    tlsSktRxBuffSize;  // Not used in the current implementation;
                                 // Size of TLS RX buffer for the associated socket; leave 0 for default (min 512 bytes)
     uint16_t    configFlags;    // a HTTP_MODULE_FLAGS value.
+    uint16_t    fileBuffSize;   // size of the buffer used to read the served files (bytes); leave 0 for default
+                                // The buffer is shared by all connections;
+                                // a larger buffer moves a file in fewer, bigger socket writes.
 
 } TCPIP_HTTP_MODULE_CONFIG;
 
@@ -207,6 +239,10 @@ typedef struct
     This function is called by the stack to parse GET arguments and
     cookie data.  User applications can use this function to decode POST
     data, but first need to verify that the string is null-terminated.
+
+    When cData is the data buffer of a connection, the decoded name/value
+    pairs are indexed, so that TCPIP_HTTP_ArgGet() does not have to search
+    the buffer linearly.
  */
 uint8_t*  TCPIP_HTTP_URLDecode(uint8_t* cData);
 
@@ -255,7 +291,11 @@ uint8_t*  TCPIP_HTTP_URLDecode(uint8_t* cData);
   </code>
 
   Remarks:
-    None.
+    The arguments decoded by TCPIP_HTTP_URLDecode() in the connection data
+    buffer are found through the connection argument index.
+    When all the arguments fit the index, an argument missing from it
+    is not present. Otherwise, or for any other buffer, cData is searched
+    linearly from the start.
  */
 const uint8_t*      TCPIP_HTTP_ArgGet(const uint8_t* cData, const uint8_t* cArg);
 
@@ -273,12 +313,11 @@ const uint8_t*      TCPIP_HTTP_ArgGet(const uint8_t* cData, const uint8_t* cArg)
     a basic templating system for HTML web pages.  This reduces unneeded
     duplication of visual elements such as headers, menus, etc.
 
-    When pHttpCon->callbackPos is 0, the file is opened and as many bytes
-    as possible are written.  The current position is then saved to
-    pHttpCon->callbackPos and the file is closed.  On subsequent calls,
-    reading begins at the saved location and continues.  Once the end of
-    the input file is reached, pHttpCon->callbackPos is set back to 0 to
-    indicate completion.
+    The file is opened on the first call and as many bytes as possible
+    are written.  The file stays open in the connection until its end is
+    reached; the following calls continue from the saved position.
+    An included file can itself include other files using <c>~inc:name~</c>,
+    up to TCPIP_HTTP_MAX_INCLUDE_DEPTH levels deep.
 
   Precondition:
     None.
@@ -299,6 +338,106 @@ const uint8_t*      TCPIP_HTTP_ArgGet(const uint8_t* cData, const uint8_t* cArg)
 void  TCPIP_HTTP_FileInclude(HTTP_CONN_HANDLE connHandle, const uint8_t* cFile);
 
 
+//*****************************************************************************
+/*
+  Function:
+    uint16_t TCPIP_HTTP_DynamicWrite(HTTP_CONN_HANDLE connHandle, const void* buffer, uint16_t size)
+
+  Summary:
+    Writes dynamic variable output to the current response.
+
+  Description:
+    This function writes the output of a dynamic variable callback to the
+    response of the HTTP connection.
+    When the response uses the chunked transfer encoding (HTTP_MODULE_FLAG_CHUNKED)
+    small writes are coalesced in a connection buffer and the data is sent to the
+    socket as complete chunks.
+    Otherwise the data is written directly to the connection socket.
+
+  Precondition:
+    None.
+
+  Parameters:
+    connHandle  - HTTP connection handle
+    buffer      - data to be written
+    size        - number of bytes in buffer
+
+  Returns:
+    The number of bytes accepted.
+    If less than size, the callback should save its progress using
+    TCPIP_HTTP_CurrentConnectionCallbackPosSet() and try again later.
+
+  Remarks:
+    When HTTP_MODULE_FLAG_CHUNKED is set, the dynamic variable callbacks
+    must not write directly to the connection socket.
+
+    When TCPIP_HTTP_OUTPUT_BUFFERS is not 0, the output that does not fit
+    the socket is kept in a buffer taken from a pool and sent before the
+    page continues.  A callback whose output fits the socket and the buffer
+    completes in a single call and does not need to save its progress.
+ */
+uint16_t  TCPIP_HTTP_DynamicWrite(HTTP_CONN_HANDLE connHandle, const void* buffer, uint16_t size);
+
+
+//*****************************************************************************
+/*
+  Function:
+    const uint8_t* TCPIP_HTTP_DynamicStringWrite(HTTP_CONN_HANDLE connHandle, const uint8_t* str)
+
+  Summary:
+    Writes a null terminated string to the current response.
+
+  Description:
+    This function writes a string using TCPIP_HTTP_DynamicWrite().
+    The null terminator is not written.
+
+  Precondition:
+    None.
+
+  Parameters:
+    connHandle  - HTTP connection handle
+    str         - string to be written
+
+  Returns:
+    Pointer to the first character that was not written.
+    If the whole string was written, the returned pointer points to the null terminator.
+
+  Remarks:
+    None.
+ */
+const uint8_t*  TCPIP_HTTP_DynamicStringWrite(HTTP_CONN_HANDLE connHandle, const uint8_t* str);
+
+
+//*****************************************************************************
+/*
+  Function:
+    uint16_t TCPIP_HTTP_DynamicWriteIsReady(HTTP_CONN_HANDLE connHandle)
+
+  Summary:
+    Returns the number of bytes TCPIP_HTTP_DynamicWrite() can accept.
+
+  Description:
+    This function is the counterpart of TCPIP_TCP_PutIsReady() for the
+    dynamic variable callbacks.
+    It takes into account the chunk encoding overhead and the pending
+    data in the connection chunk buffer.
+    The room of the pooled output buffer is included when one is available.
+
+  Precondition:
+    None.
+
+  Parameters:
+    connHandle  - HTTP connection handle
+
+  Returns:
+    Number of bytes that can be written with TCPIP_HTTP_DynamicWrite().
+
+  Remarks:
+    None.
+ */
+uint16_t  TCPIP_HTTP_DynamicWriteIsReady(HTTP_CONN_HANDLE connHandle);
+
+
 //*****************************************************************************
 /*
   Function:
@@ -424,7 +563,10 @@ HTTP_READ_STATUS  TCPIP_HTTP_PostValueRead(HTTP_CONN_HANDLE connHandle, uint8_t*
   </code>
 
   Remarks:
-    None.
+    The handle may be shared with other connections serving the same file,
+    so its position is not preserved between calls.
+    Seek to the needed position before reading.
+    Do not close the handle.
  */
 SYS_FS_HANDLE  TCPIP_HTTP_CurrentConnectionFileGet(HTTP_CONN_HANDLE connHandle);
 
@@ -1216,6 +1358,404 @@ HTTP_CONN_HANDLE    TCPIP_HTTP_CurrentConnectionHandleGet(int connIx);
 
  */
 int    TCPIP_HTTP_ActiveConnectionCountGet(int* pOpenCount);
+
+//*****************************************************************************
+/*
+  Function:
+    void    TCPIP_HTTP_FileIndexInvalidate(void);
+
+  Summary:
+    Discards the cached metadata of the web page files.
+
+  Description:
+    The HTTP server caches the size, date and attributes of the web page
+    files and the dynamic page records (FileRcrd.bin) the first time
+    it accesses the file system, so that the requests are served
+    without a file system lookup.
+    This function discards the cached data; it is built again
+    with the next request.
+    If the cache could not be built (directory not readable, no memory),
+    the files are looked up in the file system until this function is called.
+   
+  Precondition:
+    None.
+
+  Parameters:
+    None.
+
+  Returns:
+    None.
+
+  Example:
+  <code>
+    TCPIP_HTTP_FileIndexInvalidate();
+    SYS_FS_Unmount(LOCAL_WEBSITE_PATH_FS);
+    // update the web pages
+    SYS_FS_Mount(SYS_FS_NVM_VOL, LOCAL_WEBSITE_PATH_FS, MPFS2, 0, NULL);
+    TCPIP_HTTP_FileIndexInvalidate();
+  </code>
+
+  Remarks:
+    The application has to call this function when it changes or remounts
+    the web pages file system.
+    The function also closes the files the server keeps open for reuse,
+    so it should be called before unmounting the file system as well.
+    The MPFS upload performed by the HTTP server invalidates the cached
+    data by itself.
+
+ */
+void    TCPIP_HTTP_FileIndexInvalidate(void);
+
+//*****************************************************************************
+/*
+  Function:
+    bool    TCPIP_HTTP_MappedImageSet(const void* pImage, size_t imageSize);
+
+  Summary:
+    Sets the address of a directly addressable MPFS2 image.
+
+  Description:
+    When the MPFS2 image of the web pages can be addressed directly
+    (program flash, a memory mapped file, etc.) the HTTP server sends
+    the static files straight from the image to the socket,
+    without reading them through the file system.
+    The file system is still used for the file metadata, the dynamic pages
+    and the included files.
+   
+  Precondition:
+    TCPIP_HTTP_MAPPED_IMAGE_ENABLE defined.
+
+  Parameters:
+    pImage      - address of the MPFS2 image
+                  Use 0 to stop using the mapped image.
+    imageSize   - size of the image, bytes
+
+  Returns:
+    true  - the image is valid and will be used
+    false - the image is not a valid MPFS2 image; it is not used
+
+  Example:
+  <code>
+    extern const uint8_t mpfsImage[];
+    extern const size_t  mpfsImageSize;
+
+    TCPIP_HTTP_MappedImageSet(mpfsImage, mpfsImageSize);
+  </code>
+
+  Remarks:
+    The image has to be the one mounted at LOCAL_WEBSITE_PATH_FS.
+    The image has to stay addressable while connections may be serving from it,
+    so it should not be changed or released while the server is running.
+    Stop using the image before an MPFS upload.
+
+ */
+bool    TCPIP_HTTP_MappedImageSet(const void* pImage, size_t imageSize);
+
+//*****************************************************************************
+/*
+  Function:
+    bool    TCPIP_HTTP_DynVarTtlSet(uint32_t callbackID, uint32_t ttlMs);
+
+  Summary:
+    Sets how long the output of a dynamic variable can be reused.
+
+  Description:
+    The output of a dynamic variable with a TTL is cached the first time
+    it's rendered and, for ttlMs milliseconds, it is sent to all the
+    connections serving the variable without calling TCPIP_HTTP_Print().
+    Use it for values that don't change that often:
+    firmware version, uptime to the second, etc.
+
+  Precondition:
+    TCPIP_HTTP_DYNVAR_TTL_ENTRIES not 0.
+
+  Parameters:
+    callbackID  - callback ID of the variable
+                  A variable used with different arguments has an ID for each of them.
+    ttlMs       - lifetime of the cached output, milliseconds
+                  Use 0 to remove the TTL.
+
+  Returns:
+    true  - the TTL is set
+    false - all the TCPIP_HTTP_DYNVAR_TTL_ENTRIES are in use
+
+  Remarks:
+    Only the output written with TCPIP_HTTP_DynamicWrite() in a single call
+    of the callback and fitting TCPIP_HTTP_DYNVAR_TTL_OUTPUT_SIZE is cached.
+    A variable whose callback writes to the socket directly
+    (TCPIP_TCP_StringPut(), etc.) or writes nothing is never cached;
+    its callback is called every time.
+    Setting the TTL again drops the cached output.
+
+ */
+bool    TCPIP_HTTP_DynVarTtlSet(uint32_t callbackID, uint32_t ttlMs);
+
+//*****************************************************************************
+/*
+  Function:
+    HTTP_ASYNC_TOKEN TCPIP_HTTP_AsyncTokenGet(HTTP_CONN_HANDLE connHandle)
+
+  Summary:
+    Starts waiting for an asynchronous operation of a connection.
+
+  Description:
+    Called by TCPIP_HTTP_GetExecute() or TCPIP_HTTP_PostExecute() before
+    returning HTTP_IO_WAITING.
+    The connection is then left alone until the application calls
+    TCPIP_HTTP_AsyncComplete() with the token, instead of calling
+    the handler again on every pass of the HTTP server.
+
+  Precondition:
+    Called from TCPIP_HTTP_GetExecute() or TCPIP_HTTP_PostExecute().
+
+  Parameters:
+    connHandle  - HTTP connection handle
+
+  Returns:
+    The token to be passed to TCPIP_HTTP_AsyncComplete().
+
+  Remarks:
+    If the completion is not signaled within TCPIP_HTTP_TIMEOUT seconds
+    the handler is called again, as with polling.
+
+    The token is dropped if the handler does not return HTTP_IO_WAITING.
+    A handler returning HTTP_IO_WAITING without a token is polled.
+ */
+HTTP_ASYNC_TOKEN TCPIP_HTTP_AsyncTokenGet(HTTP_CONN_HANDLE connHandle);
+
+//*****************************************************************************
+/*
+  Function:
+    bool TCPIP_HTTP_AsyncComplete(HTTP_ASYNC_TOKEN token)
+
+  Summary:
+    Signals the completion of an asynchronous operation.
+
+  Description:
+    Called by the application completion routine.
+    The waiting connection is processed on the next pass of the HTTP server
+    and the handler that took the token is called again.
+
+  Precondition:
+    None
+
+  Parameters:
+    token   - token returned by TCPIP_HTTP_AsyncTokenGet()
+
+  Returns:
+    true  - the connection is signaled
+    false - the token is stale: the connection timed out or was closed
+            in the meantime
+
+  Remarks:
+    None
+ */
+bool    TCPIP_HTTP_AsyncComplete(HTTP_ASYNC_TOKEN token);
+
+//*****************************************************************************
+/*
+  Function:
+    bool    TCPIP_HTTP_RoutesSet(const HTTP_ROUTE* routes, int nRoutes);
+
+  Summary:
+    Sets the table of the URLs served by handlers.
+
+  Description:
+    A request for a route is dispatched to its handler before any file
+    system access; only the requests that match no route look for a file.
+    Exact routes are found by the path hash. Routes with parameters
+    (":name" segments or a final '*') are tried after, in table order.
+
+    TCPIP_HTTP_GetExecute() and TCPIP_HTTP_PostExecute() are called
+    as for a file. The handler is then called to write the response body
+    with TCPIP_HTTP_DynamicWrite(), once per pass of the HTTP server,
+    until it returns HTTP_IO_DONE.
+    TCPIP_HTTP_CurrentConnectionCallbackPosGet()/Set() can keep its
+    progress; the position is 0 on the first call.
+
+  Precondition:
+    None
+
+  Parameters:
+    routes  - the route table
+              The table is not copied, it has to stay valid.
+    nRoutes - number of routes; 0 removes the table
+
+  Returns:
+    true  - the routes are set
+    false - no memory for the route index; no routes are set
+
+  Example:
+    <code>
+    static const HTTP_ROUTE appRoutes[] =
+    {
+        { "api/status",             HTTP_JSON,  APP_StatusGet },
+        { "api/sensors/:id",        HTTP_JSON,  APP_SensorGet },
+        { "api/logs/:day/:file",    HTTP_TXT,   APP_LogGet },
+    };
+
+    TCPIP_HTTP_RoutesSet(appRoutes, sizeof(appRoutes) / sizeof(*appRoutes));
+    </code>
+
+  Remarks:
+    Routed responses are dynamic: they are not cached and have no
+    Content-Length.
+ */
+bool    TCPIP_HTTP_RoutesSet(const HTTP_ROUTE* routes, int nRoutes);
+
+//*****************************************************************************
+/*
+  Function:
+    const HTTP_ROUTE* TCPIP_HTTP_CurrentConnectionRouteGet(HTTP_CONN_HANDLE connHandle)
+
+  Summary:
+    Returns the route serving the current request.
+
+  Description:
+    Lets TCPIP_HTTP_GetExecute(), TCPIP_HTTP_PostExecute() and the handlers
+    shared by several routes tell the routes apart.
+
+  Precondition:
+    None
+
+  Parameters:
+    connHandle  - HTTP connection handle
+
+  Returns:
+    The route; 0 if the request is served from the file system.
+
+  Remarks:
+    None
+ */
+const HTTP_ROUTE* TCPIP_HTTP_CurrentConnectionRouteGet(HTTP_CONN_HANDLE connHandle);
+
+//*****************************************************************************
+/*
+  Function:
+    int TCPIP_HTTP_RouteParamGet(HTTP_CONN_HANDLE connHandle, int paramIx, char* buff, int buffSize)
+
+  Summary:
+    Gets a path parameter of the current route.
+
+  Description:
+    The parameters are the path parts matched by the ":name" segments
+    and the final '*' of the route, in the order they appear.
+    For "api/sensors/:id", the request "/api/sensors/12" has parameter 0 "12".
+
+  Precondition:
+    None
+
+  Parameters:
+    connHandle  - HTTP connection handle
+    paramIx     - index of the parameter
+    buff        - buffer to copy the parameter to, null terminated
+    buffSize    - size of buff; a longer parameter is truncated
+
+  Returns:
+    The length of the parameter; -1 if there's no such parameter.
+
+  Remarks:
+    The parameters are URL decoded.
+ */
+int     TCPIP_HTTP_RouteParamGet(HTTP_CONN_HANDLE connHandle, int paramIx, char* buff, int buffSize);
+
+#if defined(TCPIP_HTTP_USE_SSE)
+//*****************************************************************************
+/*
+  Function:
+    bool    TCPIP_HTTP_SSEPathRegister(const char* path);
+
+  Summary:
+    Registers a path served as a Server-Sent Events stream.
+
+  Description:
+    A GET request for the path gets a text/event-stream response that stays
+    open until the client or the application closes it.
+    While the stream is open, TCPIP_HTTP_SSETaskCallback() is called
+    on every pass of the HTTP server, and the application sends
+    the events with TCPIP_HTTP_SSESend().
+
+  Precondition:
+    TCPIP_HTTP_USE_SSE defined.
+
+  Parameters:
+    path    - the path, without the leading '/', e.g. "events"
+              The string is not copied, it has to stay valid.
+
+  Returns:
+    true  - the path is registered
+    false - all the TCPIP_HTTP_SSE_MAX_PATHS paths are in use
+
+  Remarks:
+    The path has no file in the web pages file system.
+ */
+bool    TCPIP_HTTP_SSEPathRegister(const char* path);
+
+//*****************************************************************************
+/*
+  Function:
+    int TCPIP_HTTP_SSESend(HTTP_CONN_HANDLE connHandle, const char* event, const char* data)
+
+  Summary:
+    Sends an event on an open event stream.
+
+  Description:
+    Formats the event with an optional "event:" field and one "data:" field
+    for each line of data.
+    The events sent during the same pass of the HTTP server are flushed
+    to the network together.
+
+  Precondition:
+    The connection serves an event stream.
+
+  Parameters:
+    connHandle  - HTTP connection handle
+    event       - event type; 0 for the default "message" type
+                  It cannot contain CR or LF characters.
+    data        - event data; CR, LF or CRLF separate the data lines
+
+  Returns:
+    0 on success, 1 if the event could not be sent now
+    (lack of space in the TX buffer or the stream is not open).
+    The event is sent whole or not at all, so a slow client makes the
+    application skip or coalesce events instead of blocking the server.
+    -1 if the event can never be sent: the event type has a CR or LF,
+    or the event is larger than the whole socket TX buffer.
+
+  Remarks:
+    None
+ */
+int     TCPIP_HTTP_SSESend(HTTP_CONN_HANDLE connHandle, const char* event, const char* data);
+
+//*****************************************************************************
+/*
+  Function:
+    int TCPIP_HTTP_SSETaskCallback(HTTP_CONN_HANDLE connHandle, int pathIx)
+
+  Summary:
+    Main task of an open event stream.
+
+  Description:
+    This function is implemented by the application developer.
+    It is called on every pass of the HTTP server while the event stream
+    is open, to send new events with TCPIP_HTTP_SSESend().
+
+  Precondition:
+    None
+
+  Parameters:
+    connHandle  - HTTP connection handle
+    pathIx      - index of the stream path, in the order of registration
+
+  Returns:
+    0 to keep the stream open or 1 to close the connection.
+
+  Remarks:
+    Events can be sent from elsewhere in the application as well;
+    they are flushed on the next pass.
+ */
+int     TCPIP_HTTP_SSETaskCallback(HTTP_CONN_HANDLE connHandle, int pathIx);
+#endif  // defined(TCPIP_HTTP_USE_SSE)
 //*****************************************************************************
 /*
   Function:
@@ -1458,6 +1998,98 @@ void TCPIP_HTTP_CurrentConnectionSMSet(HTTP_CONN_HANDLE connHandle, uint8_t stat
  */
 #define TCPIP_HTTP_PostReadPair(connHandle, cData, wLen) TCPIP_HTTP_PostValueRead(connHandle, cData, wLen)
 
+#if defined(TCPIP_HTTP_USE_MULTIPART)
+// Events reported by TCPIP_HTTP_MultipartRead()
+typedef enum
+{
+    HTTP_MULTIPART_EVENT_HEADER,    // a part header line, e.g. "Content-Disposition: form-data; name="cfg"; filename="cfg.bin""
+    HTTP_MULTIPART_EVENT_DATA,      // a chunk of the part body
+    HTTP_MULTIPART_EVENT_PART_END,  // the part body is complete
+} HTTP_MULTIPART_EVENT;
+
+// Multipart event handler: data/len hold the header line or the body chunk;
+// returns false to have the same event reported again on the next call
+typedef bool (*HTTP_MULTIPART_CALLBACK)(HTTP_CONN_HANDLE connHandle, HTTP_MULTIPART_EVENT event, const uint8_t* data, uint16_t len);
+
+//*****************************************************************************
+/*
+  Function:
+    HTTP_IO_RESULT TCPIP_HTTP_MultipartRead(HTTP_CONN_HANDLE connHandle, HTTP_MULTIPART_CALLBACK callback)
+
+  Summary:
+    Parses a multipart/form-data request body from the TCP buffer.
+
+  Description:
+    This function is meant to be called from an TCPIP_HTTP_PostExecute callback
+    when the form was posted with enctype="multipart/form-data".
+    It reads as much of the request body as is available and reports
+    each part to the callback: its header lines, one at a time and null terminated,
+    then its body in chunks of up to the connection data buffer size,
+    then the end of the part.
+    The fields and files of the form are never needed whole in memory.
+
+    The part delimiters are searched for in the TCP buffer with the
+    Boyer-Moore-Horspool algorithm, so the body data is scanned
+    in steps of up to the boundary length.
+
+    This function properly updates the connection byteCount
+    (see TCPIP_HTTP_CurrentConnectionByteCountGet()).
+
+  Precondition:
+    The request has a "Content-Type: multipart/form-data" header
+    with a boundary parameter.
+
+  Parameters:
+    connHandle  - HTTP connection handle
+    callback    - handler of the part events
+
+  Returns:
+    - HTTP_IO_DONE - the whole body was read.
+                    If the request is not a multipart/form-data one or the
+                    body is malformed, the connection status is set to HTTP_BAD_REQUEST.
+    - HTTP_IO_NEED_DATA - more data is needed, call again later
+    - HTTP_IO_WAITING - the callback returned false, call again later
+
+  Example:
+  <code>
+    static bool CfgPartHandler(HTTP_CONN_HANDLE connHandle, HTTP_MULTIPART_EVENT event, const uint8_t* data, uint16_t len)
+    {
+        switch(event)
+        {
+            case HTTP_MULTIPART_EVENT_HEADER:
+                if(strstr((const char*)data, "name=\"cfg\"") != 0)
+                {
+                    CfgWriteBegin();
+                }
+                return true;
+
+            case HTTP_MULTIPART_EVENT_DATA:
+                // not ready: the same chunk comes again
+                return CfgWrite(data, len);
+
+            default:
+                return CfgWriteEnd();
+        }
+    }
+
+    HTTP_IO_RESULT TCPIP_HTTP_PostExecute(HTTP_CONN_HANDLE connHandle)
+    {
+        return TCPIP_HTTP_MultipartRead(connHandle, CfgPartHandler);
+    }
+  </code>
+
+  Remarks:
+    The callback gets the data in the connection data buffer;
+    header lines longer than the buffer are truncated.
+    The callback may not call TCPIP_HTTP_MultipartRead() or
+    read from the TCP buffer.
+
+    This function is only available when TCPIP_HTTP_USE_POST and
+    TCPIP_HTTP_USE_MULTIPART are defined.
+ */
+HTTP_IO_RESULT  TCPIP_HTTP_MultipartRead(HTTP_CONN_HANDLE connHandle, HTTP_MULTIPART_CALLBACK callback);
+#endif  // defined(TCPIP_HTTP_USE_MULTIPART)
+
 // *****************************************************************************
 // *****************************************************************************
 // Section: User-implemented Callback Function Prototypes
@@ -1514,6 +2146,8 @@ void TCPIP_HTTP_CurrentConnectionSMSet(HTTP_CONN_HANDLE connHandle, uint8_t stat
     - HTTP_IO_WAITING - the application is waiting for an asynchronous
                       process to complete, and this function should be
                       called again later
+                      (when TCPIP_HTTP_AsyncComplete() is called, if a
+                      token was taken with TCPIP_HTTP_AsyncTokenGet())
 
   Remarks:
     This function is only called if variables are received via URL
@@ -1593,6 +2227,8 @@ HTTP_IO_RESULT TCPIP_HTTP_GetExecute(HTTP_CONN_HANDLE connHandle);
     - HTTP_IO_WAITING - the application is waiting for an asynchronous
                       process to complete, and this function should
                       be called again later
+                      (when TCPIP_HTTP_AsyncComplete() is called, if a
+                      token was taken with TCPIP_HTTP_AsyncTokenGet())
 
   Remarks:
     This function is only called when the request method is POST, and is
@@ -1725,6 +2361,9 @@ uint8_t TCPIP_HTTP_UserAuthenticate(HTTP_CONN_HANDLE connHandle, uint8_t* cUser,
     When called, this function should write its output directly to the TCP
     socket using any combination of TCPIP_TCP_PutIsReady, TCPIP_TCP_Put, TCPIP_TCP_ArrayPut,
     TCPIP_TCP_StringPut, TCPIP_TCP_ArrayPut, and TCPIP_TCP_StringPut.
+    When the HTTP module is configured with HTTP_MODULE_FLAG_CHUNKED, the output
+    has to be written using TCPIP_HTTP_DynamicWriteIsReady, TCPIP_HTTP_DynamicWrite
+    and TCPIP_HTTP_DynamicStringWrite instead.
 
     Before calling, the HTTP server guarantees that at least
     HTTP_MIN_CALLBACK_FREE bytes (defaults to 16 bytes) are free in the
@@ -39,6 +39,100 @@ SUBSTITUTE GOODS, TECHNOLOGY, SERVICES, OR ANY CLAIMS BY THIRD PARTIES
 #ifndef __HTTP_PRIVATE_H
 #define __HTTP_PRIVATE_H
 
+// Memory budget, in bytes, for the cached dynamic variable tables of the pages.
+// Tables not in use are released, least recently used first, to stay within it.
+#if !defined(TCPIP_HTTP_DYNVAR_CACHE_SIZE)
+#define TCPIP_HTTP_DYNVAR_CACHE_SIZE   4096
+#endif
+
+// Memory budget, in bytes, for the RAM cache of small static files.
+// Entries not in use are released, least recently used first, to stay within it.
+// 0 disables the cache.
+#if !defined(TCPIP_HTTP_FILE_CACHE_SIZE)
+#define TCPIP_HTTP_FILE_CACHE_SIZE   0
+#endif
+
+// Largest file, in bytes, kept in the RAM file cache
+#if !defined(TCPIP_HTTP_FILE_CACHE_MAX_OBJECT)
+#define TCPIP_HTTP_FILE_CACHE_MAX_OBJECT   2048
+#endif
+
+// Number of open file handles kept for reuse by all the connections.
+// 0 opens and closes the files for each request.
+#if !defined(TCPIP_HTTP_FILE_HANDLE_CACHE)
+#define TCPIP_HTTP_FILE_HANDLE_CACHE   4
+#endif
+
+// Maximum number of byte ranges served in one multipart/byteranges response.
+// With the default of 1 only single range requests are served as 206,
+// requests for more ranges get the whole file.
+#if !defined(TCPIP_HTTP_MAX_RANGES)
+#define TCPIP_HTTP_MAX_RANGES   1
+#endif
+
+// Number of output buffers pooled for the dynamic variable callbacks.
+// A connection takes a buffer when the callback output does not fit
+// the socket and gives it back once the output is sent.
+// 0 disables the pool: the callbacks resume on their own.
+#if !defined(TCPIP_HTTP_OUTPUT_BUFFERS)
+#define TCPIP_HTTP_OUTPUT_BUFFERS   0
+#endif
+
+// Size of each pooled output buffer.
+#if !defined(TCPIP_HTTP_OUTPUT_BUFFER_SIZE)
+#define TCPIP_HTTP_OUTPUT_BUFFER_SIZE   512
+#endif
+
+// Number of dynamic variables whose output can be cached for a TTL.
+// 0 disables the cache.
+#if !defined(TCPIP_HTTP_DYNVAR_TTL_ENTRIES)
+#define TCPIP_HTTP_DYNVAR_TTL_ENTRIES   0
+#endif
+
+// Largest dynamic variable output that's cached.
+#if !defined(TCPIP_HTTP_DYNVAR_TTL_OUTPUT_SIZE)
+#define TCPIP_HTTP_DYNVAR_TTL_OUTPUT_SIZE   64
+#endif
+
+// Number of paths that can be registered as event streams
+// with TCPIP_HTTP_SSEPathRegister().
+#if !defined(TCPIP_HTTP_SSE_MAX_PATHS)
+#define TCPIP_HTTP_SSE_MAX_PATHS    2
+#endif
+
+// Seconds without events after which a comment line is sent on an
+// event stream, so that proxies don't drop the idle connection.
+// 0 disables it.
+#if !defined(TCPIP_HTTP_SSE_KEEP_ALIVE)
+#define TCPIP_HTTP_SSE_KEEP_ALIVE   15
+#endif
+
+// Maximum nesting of ~inc:file~ includes.
+// An include found deeper than this is sent as it is.
+#if !defined(TCPIP_HTTP_MAX_INCLUDE_DEPTH)
+#define TCPIP_HTTP_MAX_INCLUDE_DEPTH   3
+#endif
+
+// Number of slots of the per connection index of the decoded
+// GET/cookie arguments, a power of 2; one slot is always left free.
+// An argument not found in the index is searched linearly.
+// 0 disables the index.
+#if !defined(TCPIP_HTTP_ARG_INDEX_SIZE)
+#define TCPIP_HTTP_ARG_INDEX_SIZE   16
+#endif
+#if ((TCPIP_HTTP_ARG_INDEX_SIZE & (TCPIP_HTTP_ARG_INDEX_SIZE - 1)) != 0)
+#error "TCPIP_HTTP_ARG_INDEX_SIZE must be a power of 2"
+#endif
+
+// Maximum number of path parameters of a route.
+#if !defined(TCPIP_HTTP_ROUTE_MAX_PARAMS)
+#define TCPIP_HTTP_ROUTE_MAX_PARAMS   4
+#endif
+
+// The multipart/form-data parser reads POST data.
+#if defined(TCPIP_HTTP_USE_MULTIPART) && !defined(TCPIP_HTTP_USE_POST)
+#undef TCPIP_HTTP_USE_MULTIPART
+#endif
 
 /****************************************************************************
 Section:
@@ -55,6 +149,10 @@ typedef enum
 #if defined (TCPIP_HTTP_USE_WEBSOCKETS)
     SM_HTTP_INIT_WEBSOCKET,
     SM_HTTP_PROC_WEBSOCKET,
+#endif
+#if defined (TCPIP_HTTP_USE_SSE)
+    SM_HTTP_INIT_SSE,                           // Sends the event stream response headers
+    SM_HTTP_PROC_SSE,                           // Streams the application events until either side closes
 #endif
     SM_HTTP_PROCESS_GET,                        // Invokes user callback for GET args or cookies
     SM_HTTP_PROCESS_POST,                       // Invokes user callback for POSTed data
@@ -78,8 +176,178 @@ typedef enum
     SM_PARSE_DYN_VAR_STRING,
     SM_PROCESS_DYN_VAR_CALLBACK,
     SM_SERVE_TEXT_DATA,
+    SM_PAGE_SEGMENT_GET,
+    SM_PAGE_CALLBACK,
+    SM_PAGE_SERVE_TEXT,
+    SM_ROUTE_HANDLER,
+    SM_ROUTE_DONE,
 } SM_FILETX;
 
+// Per connection flags describing the current request/response
+typedef enum
+{
+    HTTP_CONN_FLAG_NONE         = 0x0000,
+    HTTP_CONN_FLAG_KEEP_ALIVE   = 0x0001,       // connection is kept open after the response is sent
+    HTTP_CONN_FLAG_CHUNKED      = 0x0002,       // response body uses chunked transfer encoding
+    HTTP_CONN_FLAG_HTTP_1_1     = 0x0004,       // request was made using HTTP/1.1
+    HTTP_CONN_FLAG_CONN_CLOSE   = 0x0008,       // connection has to be closed after the response
+    HTTP_CONN_FLAG_FILE_FOUND   = 0x0010,       // the requested file exists; fileSize, fileDate, fileTime and fileAttr are valid
+    HTTP_CONN_FLAG_COND_ETAG    = 0x0020,       // request has an If-None-Match header
+    HTTP_CONN_FLAG_ETAG_MATCH   = 0x0040,       // If-None-Match matched the file entity tag
+    HTTP_CONN_FLAG_DATE_MATCH   = 0x0080,       // If-Modified-Since matched the file modification date
+    HTTP_CONN_FLAG_HEAD         = 0x0100,       // HEAD request: processed as GET but the response has no body
+    HTTP_CONN_FLAG_RANGE_REQ    = 0x0200,       // request has a valid Range header; nRanges satisfiable ranges
+    HTTP_CONN_FLAG_IF_RANGE_FAIL= 0x0400,       // If-Range did not match the file, the Range header is ignored
+    HTTP_CONN_FLAG_RANGE        = 0x0800,       // the response is 206 Partial Content
+    HTTP_CONN_FLAG_GZIP_VARIANT = 0x1000,       // the precompressed "<file>.gz" variant is served
+    HTTP_CONN_FLAG_VARY         = 0x2000,       // the file has a precompressed variant; response varies on Accept-Encoding
+    HTTP_CONN_FLAG_COMPILED_PAGE= 0x4000,       // the compiled "<file>.dpg" page is served
+    HTTP_CONN_FLAG_SSE_PENDING  = 0x8000,       // events were written to the event stream and not flushed yet
+} HTTP_CONN_FLAGS;
+
+// State of an asynchronous operation started by TCPIP_HTTP_GetExecute()/TCPIP_HTTP_PostExecute()
+typedef enum
+{
+    HTTP_ASYNC_NONE = 0,                        // no token taken; a connection returning HTTP_IO_WAITING is polled
+    HTTP_ASYNC_WAIT,                            // the connection is not processed until TCPIP_HTTP_AsyncComplete()
+    HTTP_ASYNC_DONE,                            // the operation completed, the connection is processed on the next pass
+} HTTP_ASYNC_STATE;
+
+
+// File index flags
+typedef enum
+{
+    HTTP_FILE_FLAG_NONE         = 0x00,
+    HTTP_FILE_FLAG_GZIP_VARIANT = 0x01,         // a precompressed "<file>.gz" variant is in the image
+} HTTP_FILE_FLAGS;
+
+// File index entry: file metadata cached when the image is first accessed
+typedef struct
+{
+    uint16_t    nameHash;                       // hash of the file name, as in HTTP_CONN::nameHash
+    uint16_t    nameOffset;                     // offset of the file name in the index name pool
+    uint32_t    fileSize;                       // size of the file
+    uint16_t    fileDate;                       // modification date, FAT format
+    uint16_t    fileTime;                       // modification time, FAT format
+    uint8_t     fileAttr;                       // file attributes
+    uint8_t     fileFlags;                      // HTTP_FILE_FLAGS value
+    uint16_t    hdrLen;                         // length of hdrBlock
+    const char* hdrBlock;                       // response headers of a GET for the file; 0 if not formatted yet
+    uint8_t     hdrFileType;                    // HTTP_FILE_TYPE used in hdrBlock
+    uint8_t     hdrGzip;                        // hdrBlock is for the negotiated gzip variant of the file
+    uint16_t    dynPageIx;                      // index of the page in the dynamic page index, HTTP_DYN_PAGE_IX_NONE if not dynamic
+                                                // HTTP_DYN_PAGE_IX_UNKNOWN if not resolved yet
+} HTTP_FILE_ENTRY;
+
+// Argument index entry, a slot of the open addressing table of the decoded arguments
+typedef struct
+{
+    uint16_t    nameHash;                       // hash of the argument name
+    uint16_t    valueOffset;                    // offset of the value in the connection data; 0 for a free slot
+} HTTP_ARG_ENTRY;
+
+#if defined(TCPIP_HTTP_USE_MULTIPART)
+// Longest multipart delimiter: CRLF, "--" and a boundary of up to 70 characters
+#define HTTP_MULTIPART_DELIM_MAX    (4 + 70)
+
+// multipart/form-data parser states
+typedef enum
+{
+    HTTP_MULTIPART_PREAMBLE = 0,                // discarding the data before the first boundary
+    HTTP_MULTIPART_BOUNDARY,                    // reading the rest of a boundary line
+    HTTP_MULTIPART_HEADERS,                     // reading the part headers
+    HTTP_MULTIPART_BODY,                        // reading the part body, up to the next delimiter
+    HTTP_MULTIPART_EPILOGUE,                    // discarding the data after the close delimiter
+} HTTP_MULTIPART_STATE;
+
+// multipart/form-data parser of a connection
+typedef struct
+{
+    uint8_t         skip[256];                  // Boyer-Moore-Horspool shift for each byte value
+    uint8_t         delim[HTTP_MULTIPART_DELIM_MAX];    // CRLF, "--" and the boundary
+    uint8_t         delimLen;                   // length of delim
+    uint8_t         state;                      // HTTP_MULTIPART_STATE value
+} HTTP_MULTIPART_DCPT;
+#endif  // defined(TCPIP_HTTP_USE_MULTIPART)
+
+// Route index entry: the exact routes sorted by path hash come first, then the pattern routes in table order
+typedef struct
+{
+    uint16_t    nameHash;                       // hash of the route path; 0 for a pattern route
+    uint16_t    routeIx;                        // index of the route in the application table
+} HTTP_ROUTE_ENTRY;
+
+// Dynamic page entry: a FileRcrd.bin record cached in RAM
+typedef struct
+{
+    uint16_t    nameHash;                       // hash of the page name
+    uint16_t    rcrdIx;                         // index of the record in FileRcrd.bin
+    uint32_t    dynRcrdOffset;                  // offset of the page records in DynRcrd.bin
+    uint32_t    dynVarCount;                    // number of dynamic variables in the page
+} HTTP_DYN_PAGE_ENTRY;
+
+// Dynamic variable record of a page, as stored in DynRcrd.bin
+typedef struct
+{
+    uint32_t    dynVarOffset;                   // offset of the variable in the page
+    uint32_t    callbackID;                     // callback ID of the variable
+} HTTP_DYN_VAR_RCRD;
+
+// Cached dynamic variable table of a page; shared by all the connections serving the page
+typedef struct _tag_HTTP_DYN_VAR_TABLE
+{
+    struct _tag_HTTP_DYN_VAR_TABLE* next;       // next table, in most recently used order
+    uint32_t    dynRcrdOffset;                  // offset of the page records in DynRcrd.bin
+    uint16_t    nVars;                          // number of records in the table
+    uint16_t    refCount;                       // number of connections using the table
+    uint16_t*   varLen;                         // placeholder length of each variable, 0 if not known yet; nVars entries
+    HTTP_DYN_VAR_RCRD   rcrd[1];                // the page records; nVars entries
+} HTTP_DYN_VAR_TABLE;
+
+// RAM cached static file; shared by all the connections serving the file
+typedef struct _tag_HTTP_FILE_CACHE_ENTRY
+{
+    struct _tag_HTTP_FILE_CACHE_ENTRY* next;    // next entry, in most recently used order
+    const char* fileName;                       // name of the file; the entry key
+    const char* validators;                     // precomputed ETag and Last-Modified header lines
+    uint32_t    fileSize;                       // size of the file
+    uint16_t    fileDate;                       // modification date of the file, FAT format
+    uint16_t    fileTime;                       // modification time of the file, FAT format
+    uint32_t    entrySize;                      // memory taken by the entry
+    uint16_t    refCount;                       // number of connections serving the entry
+    uint16_t    padding;                        // padding field to have structure multiple of 32 bits
+    uint8_t     data[1];                        // file contents, then the file name and the validators
+} HTTP_FILE_CACHE_ENTRY;
+
+// Open file handle shared by the connections serving the file
+typedef struct
+{
+    SYS_FS_HANDLE   handle;                     // open file; SYS_FS_HANDLE_INVALID if the slot is free
+    uint16_t        refCount;                   // number of users of the handle
+    uint16_t        padding;                    // padding field to have structure multiple of 32 bits
+    uint32_t        useTick;                    // when the handle was last acquired
+    char            fileName[SYS_FS_MAX_PATH];  // name of the file
+} HTTP_FILE_HANDLE_ENTRY;
+
+// Cached output of a dynamic variable with a TTL; shared by all the connections
+typedef struct
+{
+    uint32_t    callbackID;                     // callback ID of the variable
+    uint32_t    ttlTicks;                       // output lifetime; 0 if the entry is free
+    uint32_t    expiryTick;                     // when the cached output gets stale
+    uint16_t    outLen;                         // bytes in data
+    uint8_t     isValid;                        // data holds a complete output
+    uint8_t     isOverflow;                     // the output being captured does not fit data
+    uint8_t     data[TCPIP_HTTP_DYNVAR_TTL_OUTPUT_SIZE];    // the cached output
+} HTTP_DYNVAR_TTL_ENTRY;
+
+// File being sent by TCPIP_HTTP_FileInclude; kept open until its end
+typedef struct
+{
+    SYS_FS_HANDLE   file;                       // included file
+    uint32_t        offset;                     // position of the next byte to send
+    uint32_t        numBytes;                   // bytes left to send
+} HTTP_INC_FRAME;
 
 typedef struct
 {
@@ -88,17 +356,15 @@ typedef struct
     uint32_t    dynVarCallBackID;               // Call back ID
     uint32_t    dynVarCntr;                     // Number of dynamic variable
     uint32_t    bytesReadCount;                 // Counter of current file already reading
-    uint32_t    incFileRdCnt;                   // Position of current including file
     size_t      numBytes;                       // Number of bytes of the current file
-    size_t      numBytesHdrFile;                // Number of bytes of included header file
-    uint16_t    DynRcrdRdCount;                 // Dynamic variable file, read position
-    int8_t      lock_dynrcd;                    // Flag - If first read on this record
+    HTTP_INC_FRAME  incStack[TCPIP_HTTP_MAX_INCLUDE_DEPTH]; // Files being included, innermost last
+    uint16_t    dynVarIx;                       // Index of the next dynamic variable in the page table
     int8_t      nameHashMatched;                // Name hash match flag
     // Including file or variable file
     uint8_t     EndOfCallBackFileFlag;          // Flag - if current call back service finished
-    uint8_t     lock_hdr;                       // Flag - If first read of current header file
+    uint8_t     incDepth;                       // Number of used incStack frames
     uint8_t     fileTxDone; 
-    uint8_t     padding;                        // padding field to have structure multiple of 32 bits 
+    uint8_t     padding[2];                     // padding field to have structure multiple of 32 bits 
 } FILE_CTRL;
 
 // Stores extended state data for each connection
@@ -115,13 +381,22 @@ typedef struct
     uint8_t*        ptrData;                        // Points to first free byte in data
     uint8_t*        ptrRead;                        // Points to current read location
     SYS_FS_HANDLE   file;                           // File pointer for the file being served
+    const uint8_t*  fileData;                       // contents of the file in the mapped image or the RAM cache; 0 if read from the file system
+    HTTP_FILE_CACHE_ENTRY* pFileCache;              // RAM cache entry being served; 0 if none
+    HTTP_DYN_VAR_TABLE* pDynVars;                   // dynamic variables of the page being served; 0 if none
     FILE_CTRL       TxFile;                         // Current sending file stub
     HTTP_STATUS     httpStatus;                     // Request method/status
     HTTP_FILE_TYPE  fileType;                       // File type to return with Content-Type
     SM_HTTP2        sm;                             // Current connection state
     SM_FILETX       file_sm;                        // Current file sending state
     uint8_t*        data;                           // General purpose data buffer
+#if (TCPIP_HTTP_ARG_INDEX_SIZE != 0)
+    HTTP_ARG_ENTRY  argIndex[TCPIP_HTTP_ARG_INDEX_SIZE];    // index of the arguments decoded in data
+    uint16_t        argEnd;                         // offset of the last null terminator of the indexed arguments; 0 if no index
+    uint8_t         argAllIndexed;                  // all the arguments fit the index, a miss needs no linear search
+#endif  // (TCPIP_HTTP_ARG_INDEX_SIZE != 0)
     uint16_t        nameHash;                       // Current file name hash
+    uint16_t        fileIx;                         // index of the requested file in the file index; HTTP_FILE_IX_NONE if not indexed
     uint16_t        connIx;                         // index of this connection in the HTTP server
     const void*     userData;                       // user supplied data; not used by the HTTP module
     uint8_t         hasArgs;                        // True if there were get or cookie arguments
@@ -138,12 +413,41 @@ typedef struct
 #endif  // defined(TCPIP_HTTP_FILE_UPLOAD_ENABLE)
     
     TCPIP_TCP_SIGNAL_HANDLE socketSignal;           // socket signal handler
+    uint16_t        connFlags;                      // HTTP_CONN_FLAGS value
+    uint16_t        chunkLen;                       // bytes pending in chunkBuff
+    uint8_t*        chunkBuff;                      // buffer for coalescing small chunks; 0 if not used
+    uint32_t        asyncTick;                      // a waiting connection is processed anyway after this time
+    uint16_t        asyncSeq;                       // sequence number of the last async token
+    uint8_t         asyncState;                     // HTTP_ASYNC_STATE value
+#if (TCPIP_HTTP_OUTPUT_BUFFERS != 0)
+    uint8_t*        outBuff;                        // pooled buffer with callback output not sent yet; 0 if none
+    uint16_t        outOffset;                      // next byte of outBuff to be sent
+    uint16_t        outLen;                         // bytes pending in outBuff
+#endif  // (TCPIP_HTTP_OUTPUT_BUFFERS != 0)
+    uint32_t        fileSize;                       // size of the requested file
+    uint16_t        fileDate;                       // modification date of the requested file, FAT format
+    uint16_t        fileTime;                       // modification time of the requested file, FAT format
+    uint8_t         fileAttr;                       // attributes of the requested file
+    uint8_t         nRanges;                        // number of byte ranges to be served
+    uint8_t         rangeIx;                        // index of the next range to be sent
+    uint32_t        rangeStart[TCPIP_HTTP_MAX_RANGES];  // file offset of each range
+    uint32_t        rangeLen[TCPIP_HTTP_MAX_RANGES];    // length of each range
     char            fileName[SYS_FS_MAX_PATH];      // file name storage
+    const HTTP_ROUTE* pRoute;                       // route serving the request; 0 if served from the file system
+    uint16_t        routeParamOff[TCPIP_HTTP_ROUTE_MAX_PARAMS]; // offset of each path parameter in fileName
+    uint16_t        routeParamLen[TCPIP_HTTP_ROUTE_MAX_PARAMS]; // length of each path parameter
+    uint8_t         routeNParams;                   // number of path parameters
     
 #if defined (TCPIP_HTTP_USE_WEBSOCKETS)
     uint8_t         webSocketKey[24];
     uint8_t         subscriptions;
 #endif
+#if defined (TCPIP_HTTP_USE_SSE)
+    uint8_t         sseIx;                          // 1 + index of the requested event stream path; 0 if not an event stream
+#endif
+#if defined (TCPIP_HTTP_USE_MULTIPART)
+    HTTP_MULTIPART_DCPT* pMultipart;                // parser of a multipart/form-data request; 0 if none
+#endif
 } HTTP_CONN;
 
 
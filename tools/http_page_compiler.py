@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+"""Compiles web pages with ~var~ dynamic variables into the HTTP server
+compiled page format.
+
+A compiled page replaces the FileRcrd.bin/DynRcrd.bin records of a page:
+the server serves "<page>.dpg" in place of "<page>" in a single pass.
+
+Layout, all words little endian:
+    "DPG1"                      signature and format version
+    segments, each starting with a 32 bit opcode word:
+        bit 31 clear            text segment: bits 0-30 = length, the text follows
+        bit 31 set              dynamic variable: bits 0-30 = callback ID
+
+The callback IDs are kept in a variables file, one token per line,
+the line number being the ID, so the IDs of a page do not change when
+other pages are compiled. New tokens are appended; blank lines keep
+their IDs unused.
+The default variables file is the HTTPPrint.idx of the MPFS2 generator,
+which has the same layout, so compiled pages and MPFS2 pages share
+one ID space and one TCPIP_HTTP_Print().
+The TCPIP_HTTP_Print() dispatcher for the IDs can be generated as well,
+for sites with no MPFS2 generated one.
+
+Usage:
+    http_page_compiler.py [-r ROOT] [-o OUTDIR] [-v VARSFILE] [-p PRINTFILE] page...
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+PAGE_SIGNATURE = b"DPG1"
+PAGE_EXT = ".dpg"
+OPCODE_VAR = 0x80000000
+MAX_SEGMENT = 0x7FFFFFFF
+
+# same token syntax as the MPFS2 generator
+TOKEN_RE = re.compile(rb"~(inc:[A-Za-z0-9 .\-_/]{1,60}|[A-Za-z0-9_]{0,40}(?:\([A-Za-z0-9_,]*\))?)~")
+
+
+def load_vars(path):
+    if path is None or not os.path.exists(path):
+        return []
+    with open(path, "r", encoding="ascii") as f:
+        # blank lines are kept: the line number is the ID
+        return [line.strip() for line in f.read().splitlines()]
+
+
+def save_vars(path, tokens):
+    with open(path, "w", encoding="ascii", newline="\n") as f:
+        for token in tokens:
+            f.write(token + "\n")
+
+
+def compile_page(data, tokens, ids):
+    out = bytearray(PAGE_SIGNATURE)
+
+    def text(chunk):
+        while chunk:
+            part = chunk[:MAX_SEGMENT]
+            out.extend(struct.pack("<I", len(part)))
+            out.extend(part)
+            chunk = chunk[MAX_SEGMENT:]
+
+    pos = 0
+    for m in TOKEN_RE.finditer(data):
+        token = m.group(1).decode("ascii")
+        if token == "":
+            # "~~" is a literal '~'
+            text(data[pos:m.start() + 1])
+            pos = m.end()
+            continue
+        text(data[pos:m.start()])
+        if token not in ids:
+            ids[token] = len(tokens)
+            tokens.append(token)
+        out.extend(struct.pack("<I", OPCODE_VAR | ids[token]))
+        pos = m.end()
+    text(data[pos:])
+    return bytes(out)
+
+
+def write_print(path, tokens):
+    protos = {}
+    cases = []
+    for ix, token in enumerate(tokens):
+        if not token or token.startswith("#"):
+            # unused ID
+            continue
+        if token.startswith("inc:"):
+            call = 'TCPIP_HTTP_FileInclude(connHandle, (const uint8_t*)"%s");' % token[4:]
+        else:
+            m = re.match(r"([A-Za-z0-9_]+)(?:\(([A-Za-z0-9_,]*)\))?$", token)
+            name, args = m.group(1), [a for a in (m.group(2) or "").split(",") if a]
+            protos[name] = len(args)
+            call = "TCPIP_HTTP_Print_%s(%s);" % (name, ", ".join(["connHandle"] + args))
+        cases.append("        case 0x%08x:\n            %s\n            break;\n" % (ix, call))
+
+    with open(path, "w", encoding="ascii", newline="\n") as f:
+        f.write("// Generated by http_page_compiler.py, do not edit\n\n")
+        f.write('#include "tcpip/tcpip.h"\n\n')
+        for name, nArgs in sorted(protos.items()):
+            f.write("void TCPIP_HTTP_Print_%s(%s);\n" % (name, ", ".join(["HTTP_CONN_HANDLE connHandle"] + ["uint16_t"] * nArgs)))
+        f.write("\nvoid TCPIP_HTTP_Print(HTTP_CONN_HANDLE connHandle, uint32_t callbackID)\n{\n")
+        f.write("    switch(callbackID)\n    {\n")
+        f.writelines(cases)
+        f.write("        default:\n")
+        f.write("            // Output notification for undefined values\n")
+        f.write('            TCPIP_HTTP_DynamicWrite(connHandle, "!DEF", 4);\n')
+        f.write("    }\n}\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compile web pages with ~var~ tokens to the .dpg page format")
+    parser.add_argument("pages", nargs="+", help="pages to compile")
+    parser.add_argument("-r", "--root", default=".", help="web pages root directory; page names are relative to it")
+    parser.add_argument("-o", "--outdir", default=".", help="output directory")
+    parser.add_argument("-v", "--vars", default="HTTPPrint.idx", help="variables file holding the callback IDs, shared with the MPFS2 generator")
+    parser.add_argument("-p", "--print", dest="printFile", help="write the TCPIP_HTTP_Print() dispatcher to this file; not with an MPFS2 generated one")
+    args = parser.parse_args()
+
+    tokens = load_vars(args.vars)
+    ids = dict((token, ix) for ix, token in enumerate(tokens))
+
+    for page in args.pages:
+        with open(page, "rb") as f:
+            data = f.read()
+        name = os.path.relpath(page, args.root)
+        outPath = os.path.join(args.outdir, name + PAGE_EXT)
+        if os.path.dirname(outPath):
+            os.makedirs(os.path.dirname(outPath), exist_ok=True)
+        with open(outPath, "wb") as f:
+            f.write(compile_page(data, tokens, ids))
+
+    save_vars(args.vars, tokens)
+    if args.printFile:
+        write_print(args.printFile, tokens)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())